@@ -0,0 +1,83 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace _462 {
+
+Arena::Arena( size_t block_size )
+    : block_size( block_size ), offset( 0 ), used( 0 ) { }
+
+Arena::Arena( const Arena& other )
+    : block_size( other.block_size ), offset( 0 ), used( 0 ) { }
+
+Arena::~Arena()
+{
+    free_blocks();
+}
+
+Arena& Arena::operator=( const Arena& other )
+{
+    if ( this != &other ) {
+        block_size = other.block_size;
+        reset();
+    }
+    return *this;
+}
+
+void* Arena::allocate( size_t size, size_t align )
+{
+    if ( !blocks.empty() ) {
+        const Block& block = blocks.back();
+        size_t misalign = (size_t) ( block.data + offset ) % align;
+        size_t start = misalign ? offset + align - misalign : offset;
+        if ( start + size <= block.size ) {
+            used += start + size - offset;
+            offset = start + size;
+            return block.data + start;
+        }
+    }
+
+    // the rest of the current block is given up; a block always has room
+    // for the request even when its start is badly aligned
+    add_block( std::max( block_size, size + align ) );
+    return allocate( size, align );
+}
+
+void Arena::reset()
+{
+    // fold everything into one block, so the next round fits in it
+    if ( blocks.size() > 1 ) {
+        size_t total = 0;
+        for ( size_t i = 0; i < blocks.size(); ++i ) {
+            total += blocks[i].size;
+        }
+        free_blocks();
+        add_block( total );
+    }
+    offset = 0;
+    used = 0;
+}
+
+void Arena::add_block( size_t size )
+{
+    Block block;
+    block.data = (char*) malloc( size );
+    if ( !block.data ) {
+        throw std::bad_alloc();
+    }
+    block.size = size;
+    blocks.push_back( block );
+    offset = 0;
+}
+
+void Arena::free_blocks()
+{
+    for ( size_t i = 0; i < blocks.size(); ++i ) {
+        free( blocks[i].data );
+    }
+    blocks.clear();
+    offset = 0;
+}
+
+} /* _462 */
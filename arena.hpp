@@ -0,0 +1,81 @@
+#ifndef _462_RAYTRACER_ARENA_HPP_
+#define _462_RAYTRACER_ARENA_HPP_
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace _462 {
+
+// allocations start on a cache line unless asked otherwise
+static const size_t ARENA_ALIGNMENT = 64;
+
+/**
+ * Hands out memory by bumping a pointer through large blocks, and takes it
+ * all back at once. Meant for data that is built in one go and thrown away
+ * in one go, like the arrays of a compiled scene or the records of one
+ * wave of rays.
+ *
+ * reset() keeps the memory, merging it into a single block if it had to
+ * grow, so an arena refilled with about the same amount each time stops
+ * calling malloc after the first round.
+ *
+ * Nothing allocated here is ever destroyed, so it must not need to be.
+ * Copying an arena copies none of its memory: the copy starts out empty,
+ * which lets per-thread state holding one live in a vector.
+ */
+class Arena
+{
+public:
+
+    explicit Arena( size_t block_size = 64 * 1024 );
+
+    Arena( const Arena& other );
+
+    ~Arena();
+
+    // empties this arena; nothing is copied
+    Arena& operator=( const Arena& other );
+
+    // size bytes aligned to align, which must be a power of two
+    void* allocate( size_t size, size_t align = ARENA_ALIGNMENT );
+
+    // an array of count default constructed values
+    template< typename T >
+    T* allocate_array( size_t count )
+    {
+        T* array = (T*) allocate( count * sizeof( T ) );
+        for ( size_t i = 0; i < count; ++i ) {
+            new ( array + i ) T();
+        }
+        return array;
+    }
+
+    // takes back everything allocated so far
+    void reset();
+
+    // bytes handed out since the last reset, including alignment padding
+    size_t bytes_used() const { return used; }
+
+private:
+
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+    void add_block( size_t size );
+
+    void free_blocks();
+
+    size_t block_size;
+    std::vector< Block > blocks;
+    // the block being allocated from, and how much of it is taken
+    size_t offset;
+    size_t used;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_ARENA_HPP_ */
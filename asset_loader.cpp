@@ -0,0 +1,245 @@
+#include "asset_loader.hpp"
+#include "mapped_file.hpp"
+#include "mesh_bvh.hpp"
+#include "mesh_cache.hpp"
+#include "obj_parser.hpp"
+#include "raytracer.hpp"
+#include "thread_pool.hpp"
+#include "scene/material.hpp"
+#include "scene/mesh.hpp"
+#include "scene/scene.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace _462 {
+
+// builds the bvh of one mesh whose data is in, and saves both to the
+// cache if given one
+class BuildJob : public ThreadPool::Job
+{
+public:
+
+    BuildJob()
+        : mesh( 0 ), bvh( 0 ), out_of_memory( false ),
+          cache( 0 ), source_hash( 0 ), source_size( 0 ) { }
+
+    virtual void run( ThreadPool& )
+    {
+        try {
+            bvh = new MeshBVH();
+            bvh->build( mesh );
+            if ( cache ) {
+                // a cache that cannot be written only costs the next run
+                cache->save( source_hash, source_size, mesh, bvh );
+            }
+        } catch ( std::bad_alloc const& ) {
+            delete bvh;
+            bvh = 0;
+            out_of_memory = true;
+        }
+    }
+
+    const Mesh* mesh;
+    MeshBVH* bvh;
+    bool out_of_memory;
+
+    const MeshCache* cache;
+    unsigned long long source_hash;
+    size_t source_size;
+};
+
+// reads one mesh file, copies it to every other mesh naming the same file,
+// then queues their bvh builds. meshes compiled by an earlier run come
+// straight from the cache instead.
+class MeshJob : public ThreadPool::Job
+{
+public:
+
+    MeshJob() : cache( 0 ), ok( false ), out_of_memory( false ) { }
+
+    virtual void run( ThreadPool& pool )
+    {
+        Mesh* mesh = meshes[0];
+        try {
+            if ( cache && file.data() ) {
+                unsigned long long hash = fnv_hash( file.data(), file.size() );
+                if ( load_cached( hash ) ) {
+                    file.close();
+                    ok = true;
+                    return;
+                }
+                builds[0].cache = cache;
+                builds[0].source_hash = hash;
+                builds[0].source_size = file.size();
+            }
+
+            ok = file.data() && parse_obj( file.data(), file.size(), mesh );
+            file.close();
+            // whatever the parser did not take, the mesh's own loader may
+            if ( !ok ) {
+                ok = mesh->load();
+            }
+            for ( size_t i = 1; ok && i < meshes.size(); ++i ) {
+                meshes[i]->vertices = mesh->vertices;
+                meshes[i]->triangles = mesh->triangles;
+                meshes[i]->has_tcoords = mesh->has_tcoords;
+                meshes[i]->has_normals = mesh->has_normals;
+            }
+        } catch ( std::bad_alloc const& ) {
+            ok = false;
+            out_of_memory = true;
+        }
+        file.close();
+
+        if ( ok ) {
+            for ( size_t i = 0; i < builds.size(); ++i ) {
+                pool.submit( &builds[i] );
+            }
+        }
+    }
+
+    // fills every mesh and its bvh from the cache, or none of them
+    bool load_cached( unsigned long long hash )
+    {
+        for ( size_t i = 0; i < meshes.size(); ++i ) {
+            builds[i].bvh = cache->load( hash, file.size(), meshes[i] );
+            if ( !builds[i].bvh ) {
+                for ( size_t j = 0; j < i; ++j ) {
+                    delete builds[j].bvh;
+                    builds[j].bvh = 0;
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // every mesh using the file, the one it is read into first
+    std::vector< Mesh* > meshes;
+    MappedFile file;
+    const MeshCache* cache;
+    // one per mesh, sized before the job runs
+    std::vector< BuildJob > builds;
+    bool ok;
+    bool out_of_memory;
+};
+
+// loads the texture of one material
+class MaterialJob : public ThreadPool::Job
+{
+public:
+
+    MaterialJob() : material( 0 ), ok( false ), out_of_memory( false ) { }
+
+    virtual void run( ThreadPool& )
+    {
+        try {
+            ok = material->load();
+        } catch ( std::bad_alloc const& ) {
+            out_of_memory = true;
+        }
+    }
+
+    Material* material;
+    bool ok;
+    bool out_of_memory;
+};
+
+// biggest files first, so a large one is not left running on its own at
+// the end
+static bool larger_file( const MeshJob* a, const MeshJob* b )
+{
+    return a->file.size() > b->file.size();
+}
+
+AssetLoader::AssetLoader( Raytracer* raytracer, size_t num_threads )
+    : raytracer( raytracer ), num_threads( num_threads > 0 ? num_threads : 1 ) { }
+
+bool AssetLoader::load( Scene* scene )
+{
+    Material* const* materials = scene->get_materials();
+    Mesh* const* meshes = scene->get_meshes();
+
+    std::vector< MaterialJob > material_jobs( scene->num_materials() );
+    for ( size_t i = 0; i < material_jobs.size(); ++i ) {
+        material_jobs[i].material = materials[i];
+    }
+
+    MeshCache cache( cache_directory );
+
+    // one job per distinct file
+    std::vector< MeshJob* > mesh_jobs;
+    std::map< std::string, MeshJob* > by_filename;
+    for ( size_t i = 0; i < scene->num_meshes(); ++i ) {
+        MeshJob*& job = by_filename[meshes[i]->filename];
+        if ( !job || meshes[i]->filename.empty() ) {
+            job = new MeshJob();
+            mesh_jobs.push_back( job );
+        }
+        job->meshes.push_back( meshes[i] );
+    }
+    for ( size_t i = 0; i < mesh_jobs.size(); ++i ) {
+        MeshJob* job = mesh_jobs[i];
+        job->builds.resize( job->meshes.size() );
+        for ( size_t j = 0; j < job->meshes.size(); ++j ) {
+            job->builds[j].mesh = job->meshes[j];
+        }
+        // a file that cannot be opened is left to the mesh's own loader
+        job->file.open( job->meshes[0]->filename.c_str() );
+        job->cache = cache_directory.empty() ? 0 : &cache;
+    }
+    std::stable_sort( mesh_jobs.begin(), mesh_jobs.end(), larger_file );
+
+    {
+        ThreadPool pool( num_threads );
+        for ( size_t i = 0; i < mesh_jobs.size(); ++i ) {
+            pool.submit( mesh_jobs[i] );
+        }
+        for ( size_t i = 0; i < material_jobs.size(); ++i ) {
+            pool.submit( &material_jobs[i] );
+        }
+        pool.wait();
+    }
+
+    bool ok = true;
+    bool out_of_memory = false;
+    for ( size_t i = 0; i < material_jobs.size(); ++i ) {
+        out_of_memory = out_of_memory || material_jobs[i].out_of_memory;
+        ok = ok && material_jobs[i].ok;
+    }
+    if ( !ok && !out_of_memory ) {
+        std::cout << "Error loading texture, aborting.\n";
+    }
+
+    for ( size_t i = 0; i < mesh_jobs.size(); ++i ) {
+        MeshJob* job = mesh_jobs[i];
+        out_of_memory = out_of_memory || job->out_of_memory;
+        if ( ok && !job->ok && !job->out_of_memory ) {
+            std::cout << "Error loading mesh, aborting.\n";
+        }
+        ok = ok && job->ok;
+
+        for ( size_t j = 0; j < job->builds.size(); ++j ) {
+            BuildJob& build = job->builds[j];
+            out_of_memory = out_of_memory || build.out_of_memory;
+            if ( ok && raytracer && build.bvh ) {
+                raytracer->adopt_mesh_bvh( build.bvh );
+            } else {
+                delete build.bvh;
+            }
+        }
+        delete job;
+    }
+
+    if ( out_of_memory ) {
+        throw std::bad_alloc();
+    }
+    return ok;
+}
+
+} /* _462 */
@@ -0,0 +1,51 @@
+#ifndef _462_RAYTRACER_ASSET_LOADER_HPP_
+#define _462_RAYTRACER_ASSET_LOADER_HPP_
+
+#include <cstddef>
+#include <string>
+
+namespace _462 {
+
+class Raytracer;
+class Scene;
+
+/**
+ * Loads the textures and meshes of a scene on a pool of threads. Mesh files
+ * are mapped into memory and parsed in place, biggest first, and a file
+ * named by several meshes is parsed once and copied to the rest. Each
+ * mesh's bvh is queued as soon as its data is in, so the builds overlap
+ * whatever is still being read, and are handed to the raytracer at the end.
+ * Given a cache directory, meshes compiled by an earlier run are mapped
+ * from there instead, and new ones are saved to it.
+ *
+ * OpenGL data is not created here; that has to happen on the thread that
+ * owns the context.
+ */
+class AssetLoader
+{
+public:
+
+    // prepared mesh bvhs go to raytracer, if not null
+    AssetLoader( Raytracer* raytracer, size_t num_threads );
+
+    // keeps compiled meshes in directory, which must exist; empty for none
+    void set_cache_directory( const std::string& directory ) { cache_directory = directory; }
+
+    // loads everything scene needs. prints what failed and returns false
+    // if anything did; throws std::bad_alloc if memory ran out.
+    bool load( Scene* scene );
+
+private:
+
+    // no meaningful copy
+    AssetLoader( const AssetLoader& );
+    AssetLoader& operator=( const AssetLoader& );
+
+    Raytracer* raytracer;
+    size_t num_threads;
+    std::string cache_directory;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_ASSET_LOADER_HPP_ */
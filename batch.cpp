@@ -0,0 +1,301 @@
+#include "batch.hpp"
+#include "asset_loader.hpp"
+#include "raytracer.hpp"
+#include "timer.hpp"
+#include "application/scene_loader.hpp"
+#include "scene/scene.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace _462 {
+
+// reads a number, failing on anything but a whole, valid word
+static bool parse_real( const std::string& word, real_t* value )
+{
+    char* end;
+    *value = (real_t) strtod( word.c_str(), &end );
+    return !word.empty() && *end == '\0';
+}
+
+static bool parse_int( const std::string& word, int* value )
+{
+    char* end;
+    *value = (int) strtol( word.c_str(), &end, 10 );
+    return !word.empty() && *end == '\0';
+}
+
+// reads x y z yaw pitch, starting at words[first], into a camera
+static bool parse_camera( const std::vector< std::string >& words, size_t first, Camera* camera )
+{
+    real_t x, y, z, yaw, pitch;
+    if ( !parse_real( words[first], &x ) || !parse_real( words[first + 1], &y )
+            || !parse_real( words[first + 2], &z ) || !parse_real( words[first + 3], &yaw )
+            || !parse_real( words[first + 4], &pitch ) ) {
+        return false;
+    }
+
+    camera->position = Vector3( x, y, z );
+    camera->orientation = normalize(
+        Quaternion( Vector3( 0, 1, 0 ), yaw * PI / 180 ) *
+        Quaternion( Vector3( 1, 0, 0 ), pitch * PI / 180 ) );
+    return true;
+}
+
+// whether pattern is safe to format a frame number with: it must have
+// exactly one %d or %i, with optional flags and width, and no other
+// conversion but %%
+static bool is_frame_pattern( const std::string& pattern )
+{
+    size_t conversions = 0;
+    for ( size_t i = 0; i < pattern.size(); ++i ) {
+        if ( pattern[i] != '%' )
+            continue;
+        ++i;
+        if ( i < pattern.size() && pattern[i] == '%' )
+            continue;
+        while ( i < pattern.size() && strchr( "-+ 0#", pattern[i] ) ) {
+            ++i;
+        }
+        while ( i < pattern.size() && isdigit( (unsigned char) pattern[i] ) ) {
+            ++i;
+        }
+        if ( i == pattern.size() || ( pattern[i] != 'd' && pattern[i] != 'i' ) )
+            return false;
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+// the camera a fraction s of the way from start to end
+static Camera interpolate_camera( const Camera& start, const Camera& end, real_t s )
+{
+    Camera result = start;
+    result.position = start.position * ( 1 - s ) + end.position * s;
+
+    // take the short way round
+    const Quaternion& a = start.orientation;
+    Quaternion b = end.orientation;
+    if ( a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z < 0 ) {
+        b = Quaternion( -b.w, -b.x, -b.y, -b.z );
+    }
+    result.orientation = normalize( Quaternion(
+        a.w * ( 1 - s ) + b.w * s,
+        a.x * ( 1 - s ) + b.x * s,
+        a.y * ( 1 - s ) + b.y * s,
+        a.z * ( 1 - s ) + b.z * s ) );
+    return result;
+}
+
+BatchRenderer::BatchRenderer( Raytracer* raytracer, int width, int height )
+    : raytracer( raytracer ), scene( 0 ), width( width ), height( height ),
+      num_frames( 0 ), load_time( 0 ), render_time( 0 ) { }
+
+BatchRenderer::~BatchRenderer()
+{
+    writer.finish();
+    for ( SceneMap::iterator i = scenes.begin(); i != scenes.end(); ++i ) {
+        raytracer->forget_scene( i->second.scene );
+        delete i->second.scene;
+    }
+}
+
+bool BatchRenderer::run( const char* manifest_filename )
+{
+    std::ifstream manifest( manifest_filename );
+    if ( !manifest ) {
+        std::cout << "Unable to open manifest '" << manifest_filename << "'.\n";
+        return false;
+    }
+
+    double start = timer_seconds();
+    bool ok = true;
+    std::string line;
+
+    for ( size_t number = 1; ok && std::getline( manifest, line ); ++number ) {
+        std::string::size_type comment = line.find( '#' );
+        if ( comment != std::string::npos ) {
+            line.erase( comment );
+        }
+
+        std::istringstream stream( line );
+        std::vector< std::string > words;
+        std::string word;
+        while ( stream >> word ) {
+            words.push_back( word );
+        }
+
+        if ( !words.empty() && !run_command( words ) ) {
+            std::cout << manifest_filename << ":" << number << ": batch stopped.\n";
+            ok = false;
+        }
+    }
+
+    // the last images may still be encoding
+    ok = writer.finish() && ok;
+
+    double total = timer_seconds() - start;
+    printf( "Batch: %u frames, %.3fs tracing (%.3fs per frame), %.3fs loading, %.3fs total\n",
+            (unsigned int) num_frames, render_time,
+            num_frames ? render_time / num_frames : 0.0, load_time, total );
+
+    return ok;
+}
+
+bool BatchRenderer::run_command( const std::vector< std::string >& words )
+{
+    const std::string& command = words[0];
+
+    if ( command == "size" && words.size() == 3 ) {
+        if ( !parse_int( words[1], &width ) || !parse_int( words[2], &height )
+                || width < 1 || height < 1 ) {
+            std::cout << "Invalid image size.\n";
+            return false;
+        }
+        return true;
+    }
+
+    if ( command == "scene" && words.size() == 2 ) {
+        return use_scene( words[1] );
+    }
+
+    if ( !scene ) {
+        std::cout << "No scene given before '" << command << "'.\n";
+        return false;
+    }
+
+    if ( command == "camera" && words.size() == 6 ) {
+        if ( !parse_camera( words, 1, &camera ) ) {
+            std::cout << "Invalid camera.\n";
+            return false;
+        }
+        return true;
+    }
+
+    if ( command == "move" && words.size() == 5 ) {
+        int index;
+        real_t x, y, z;
+        if ( !parse_int( words[1], &index ) || index < 0
+                || (size_t) index >= scene->num_geometries()
+                || !parse_real( words[2], &x ) || !parse_real( words[3], &y )
+                || !parse_real( words[4], &z ) ) {
+            std::cout << "Invalid move.\n";
+            return false;
+        }
+        scene->get_geometries()[index]->position = Vector3( x, y, z );
+        return true;
+    }
+
+    if ( command == "frame" && words.size() == 2 ) {
+        return render_frame( words[1].c_str() );
+    }
+
+    if ( command == "frames" && words.size() == 9 ) {
+        int first, last;
+        Camera target = camera;
+        if ( !parse_int( words[1], &first ) || !parse_int( words[2], &last ) || last < first
+                || !parse_camera( words, 3, &target ) ) {
+            std::cout << "Invalid frame range.\n";
+            return false;
+        }
+        if ( !is_frame_pattern( words[8] ) ) {
+            std::cout << "Invalid output pattern; it needs exactly one %d.\n";
+            return false;
+        }
+
+        Camera start = camera;
+        for ( int frame = first; frame <= last; ++frame ) {
+            real_t s = last > first ? real_t( frame - first ) / real_t( last - first ) : 1;
+            camera = interpolate_camera( start, target, s );
+
+            char filename[1024];
+            snprintf( filename, sizeof filename, words[8].c_str(), frame );
+            if ( !render_frame( filename ) )
+                return false;
+        }
+        camera = target;
+        return true;
+    }
+
+    std::cout << "Unknown or malformed command '" << command << "'.\n";
+    return false;
+}
+
+bool BatchRenderer::use_scene( const std::string& filename )
+{
+    SceneMap::iterator found = scenes.find( filename );
+    if ( found != scenes.end() ) {
+        scene = found->second.scene;
+        camera = found->second.camera;
+        return true;
+    }
+
+    double start = timer_seconds();
+    Scene* loaded = new Scene();
+
+    bool ok = load_scene( loaded, filename.c_str() );
+    if ( !ok ) {
+        std::cout << "Error loading scene " << filename << ".\n";
+    }
+
+    // textures and meshes stay loaded for as long as the scene does
+    if ( ok ) {
+        AssetLoader loader( raytracer, raytracer->get_num_threads() );
+        loader.set_cache_directory( cache_directory );
+        ok = loader.load( loaded );
+    }
+
+    if ( !ok ) {
+        // some of its meshes may have been prepared before the failure
+        raytracer->forget_scene( loaded );
+        delete loaded;
+        return false;
+    }
+
+    LoadedScene entry;
+    entry.scene = loaded;
+    entry.camera = loaded->camera;
+    scenes[filename] = entry;
+
+    scene = loaded;
+    camera = loaded->camera;
+
+    double elapsed = timer_seconds() - start;
+    load_time += elapsed;
+    printf( "Loaded scene '%s' in %.3fs\n", filename.c_str(), elapsed );
+    return true;
+}
+
+bool BatchRenderer::render_frame( const char* filename )
+{
+    double start = timer_seconds();
+
+    scene->camera = camera;
+    scene->camera.aspect = real_t( width ) / real_t( height );
+    buffer.resize( 4 * (size_t) width * (size_t) height );
+
+    // numbered in manifest order, so a rerun samples each frame alike
+    raytracer->set_frame( (unsigned int) num_frames );
+    if ( !raytracer->initialize( scene, width, height ) ) {
+        std::cout << "Raytracer initialization failed.\n";
+        return false;
+    }
+    raytracer->raytrace( &buffer[0], 0 );
+
+    double elapsed = timer_seconds() - start;
+    render_time += elapsed;
+    ++num_frames;
+    printf( "Frame %u '%s': %dx%d traced in %.3fs\n",
+            (unsigned int) num_frames, filename, width, height, elapsed );
+
+    // encoded while the next frame traces
+    writer.write( filename, &buffer[0], width, height );
+    return true;
+}
+
+} /* _462 */
@@ -0,0 +1,100 @@
+#ifndef _462_RAYTRACER_BATCH_HPP_
+#define _462_RAYTRACER_BATCH_HPP_
+
+#include "image_writer.hpp"
+#include "scene/camera.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace _462 {
+
+class Raytracer;
+class Scene;
+
+/**
+ * Renders every frame listed in a manifest without opening a window. Each
+ * line of the manifest is one command; blank lines and anything after a
+ * '#' are ignored.
+ *
+ *   size <width> <height>
+ *       image size of the frames that follow
+ *   scene <file>
+ *       makes the scene current, loading it and its meshes and textures on
+ *       first use only. the camera starts where the scene puts it.
+ *   camera <x> <y> <z> <yaw> <pitch>
+ *       moves the camera, turning it yaw degrees about the world y axis
+ *       and then pitch degrees about its own x axis from looking down -z
+ *   move <geometry> <x> <y> <z>
+ *       moves the geometry with the given index in the current scene
+ *   frame <output>
+ *       renders one frame with the current camera
+ *   frames <first> <last> <x> <y> <z> <yaw> <pitch> <output pattern>
+ *       renders frames first to last while the camera moves from where it
+ *       is to the given camera. the pattern is a printf format with exactly
+ *       one %d for the frame number, e.g. out/shot_%04d.png.
+ *
+ * Images are written on a separate thread while the next frame renders.
+ */
+class BatchRenderer
+{
+public:
+
+    // frames are traced with raytracer, configured as the caller left it,
+    // at the given size until the manifest says otherwise
+    BatchRenderer( Raytracer* raytracer, int width, int height );
+
+    ~BatchRenderer();
+
+    // runs a whole manifest. returns false if it could not be read or a
+    // command failed; frames before the failure are still written.
+    bool run( const char* manifest_filename );
+
+    // keeps compiled meshes in directory between runs
+    void set_cache_directory( const std::string& directory ) { cache_directory = directory; }
+
+private:
+
+    // runs one manifest line, already split into words
+    bool run_command( const std::vector< std::string >& words );
+
+    // makes a scene current, loading it if it has not been seen before
+    bool use_scene( const std::string& filename );
+
+    bool render_frame( const char* filename );
+
+    Raytracer* raytracer;
+    std::string cache_directory;
+
+    // a loaded scene, and the camera it was loaded with
+    struct LoadedScene
+    {
+        Scene* scene;
+        Camera camera;
+    };
+
+    // every scene loaded so far, by filename, and the current one
+    typedef std::map< std::string, LoadedScene > SceneMap;
+    SceneMap scenes;
+    Scene* scene;
+
+    // the camera the next frame is traced with
+    Camera camera;
+
+    int width, height;
+
+    std::vector< unsigned char > buffer;
+    ImageWriter writer;
+
+    // totals for the closing summary
+    size_t num_frames;
+    double load_time, render_time;
+
+    // no meaningful copy
+    BatchRenderer( const BatchRenderer& );
+    BatchRenderer& operator=( const BatchRenderer& );
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_BATCH_HPP_ */
@@ -0,0 +1,491 @@
+/*
+ * Benchmark harness: builds a fixed set of procedural scenes, traces each
+ * one headless and reports timings and ray counts, optionally as json and
+ * against the json of an earlier run.
+ *
+ * This file has a main of its own, so it is built as a separate program
+ * rather than into the raytracer: compile it with every source in this
+ * directory except main.cpp, plus the scene, math and application sources,
+ * using the same flags and libraries as the raytracer. From the project
+ * root, for example:
+ *
+ *     g++ -O2 -I. raytracer/bench.cpp \
+ *         $(ls raytracer/*.cpp | grep -v -e main.cpp -e bench.cpp) \
+ *         scene/*.cpp math/*.cpp application/*.cpp <raytracer libraries> -o bench
+ */
+
+#include "scene/scene.hpp"
+#include "scene/model.hpp"
+#include "scene/mesh.hpp"
+#include "scene/sphere.hpp"
+#include "scene/triangle.hpp"
+#include "raytracer/raytracer.hpp"
+#include "raytracer/timer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace _462 {
+
+// slowdown against a baseline that counts as a regression
+static const double REGRESSION_TOLERANCE = 0.10;
+
+struct BenchOptions
+{
+    int width, height;
+    int num_threads;
+    int packet_width;
+    bool wavefront;
+    const char* json_filename;
+    const char* baseline_filename;
+};
+
+struct BenchResult
+{
+    std::string name;
+    size_t num_geometries, num_lights;
+    double prepare_time, trace_time;
+    RayCounts rays;
+    WavefrontStats wavefront;
+
+    double rays_per_second() const
+    {
+        return trace_time > 0 ? rays.total() / trace_time : 0;
+    }
+};
+
+// small deterministic generator, so every run builds the same scenes
+class SceneRandom
+{
+public:
+
+    explicit SceneRandom( unsigned int seed ) : state( seed ) { }
+
+    // uniform in [lo, hi)
+    real_t next( real_t lo, real_t hi )
+    {
+        state = state * 1664525u + 1013904223u;
+        return lo + ( hi - lo ) * ( ( state >> 8 ) / 16777216.0 );
+    }
+
+private:
+
+    unsigned int state;
+};
+
+static Material* make_material( Scene* scene, const Color3& diffuse, const Color3& specular,
+                                real_t refractive_index )
+{
+    Material* material = new Material();
+    material->ambient = diffuse;
+    material->diffuse = diffuse;
+    material->specular = specular;
+    material->refractive_index = refractive_index;
+    scene->add_material( material );
+    return material;
+}
+
+static void add_light( Scene* scene, const Vector3& position, const Color3& color )
+{
+    PointLight light;
+    light.position = position;
+    light.color = color;
+    light.attenuation.constant = 1;
+    light.attenuation.linear = 0;
+    light.attenuation.quadratic = 0;
+    scene->add_light( light );
+}
+
+static void add_sphere( Scene* scene, const Vector3& position, real_t radius, const Material* material )
+{
+    Sphere* sphere = new Sphere();
+    sphere->position = position;
+    sphere->radius = radius;
+    sphere->material = material;
+    scene->add_geometry( sphere );
+}
+
+// a large floor made of two triangles at height y
+static void add_floor( Scene* scene, real_t y, const Material* material )
+{
+    static const real_t SIZE = 50;
+    const Vector3 corners[4] = {
+        Vector3( -SIZE, y, -SIZE ), Vector3( -SIZE, y, SIZE ),
+        Vector3( SIZE, y, SIZE ), Vector3( SIZE, y, -SIZE ) };
+    const int order[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+
+    for ( int i = 0; i < 2; ++i ) {
+        Triangle* triangle = new Triangle();
+        for ( int j = 0; j < 3; ++j ) {
+            Triangle::Vertex& vertex = triangle->vertices[j];
+            vertex.position = corners[order[i][j]];
+            vertex.normal = Vector3( 0, 1, 0 );
+            vertex.tex_coord = Vector2( vertex.position.x, vertex.position.z );
+            vertex.material = material;
+        }
+        scene->add_geometry( triangle );
+    }
+}
+
+static void setup_common( Scene* scene, const Vector3& eye )
+{
+    scene->background_color = Color3( 0.1, 0.1, 0.2 );
+    scene->ambient_light = Color3( 0.15, 0.15, 0.15 );
+    scene->refractive_index = 1;
+    scene->camera.position = eye;
+    scene->camera.orientation = Quaternion::Identity;
+}
+
+// thousands of small spheres scattered over a floor
+static void build_spheres( Scene* scene )
+{
+    setup_common( scene, Vector3( 0, 3, 18 ) );
+    SceneRandom random( 1 );
+
+    Material* floor = make_material( scene, Color3( 0.6, 0.6, 0.6 ), Color3( 0.1, 0.1, 0.1 ), 0 );
+    Material* colors[3] = {
+        make_material( scene, Color3( 0.8, 0.2, 0.2 ), Color3( 0.2, 0.2, 0.2 ), 0 ),
+        make_material( scene, Color3( 0.2, 0.7, 0.3 ), Color3( 0.3, 0.3, 0.3 ), 0 ),
+        make_material( scene, Color3( 0.2, 0.3, 0.8 ), Color3( 0.5, 0.5, 0.5 ), 0 ) };
+
+    add_floor( scene, -1, floor );
+    for ( int i = 0; i < 4000; ++i ) {
+        Vector3 position( random.next( -12, 12 ), random.next( -1, 6 ), random.next( -20, 6 ) );
+        add_sphere( scene, position, random.next( 0.08, 0.3 ), colors[i % 3] );
+    }
+
+    add_light( scene, Vector3( -8, 12, 8 ), Color3( 0.6, 0.6, 0.6 ) );
+    add_light( scene, Vector3( 8, 10, 4 ), Color3( 0.4, 0.4, 0.4 ) );
+}
+
+// a finely tessellated torus, instanced a few times
+static void build_mesh( Scene* scene )
+{
+    static const int RINGS = 400, SIDES = 200;
+    static const real_t MAJOR = 1.5, MINOR = 0.5;
+
+    setup_common( scene, Vector3( 0, 2, 9 ) );
+
+    Material* floor = make_material( scene, Color3( 0.6, 0.6, 0.6 ), Color3( 0.1, 0.1, 0.1 ), 0 );
+    Material* metal = make_material( scene, Color3( 0.7, 0.6, 0.3 ), Color3( 0.4, 0.4, 0.4 ), 0 );
+    add_floor( scene, -2, floor );
+
+    Mesh* mesh = new Mesh();
+    mesh->filename = "bench_torus";
+    for ( int r = 0; r <= RINGS; ++r ) {
+        real_t u = 2 * PI * r / RINGS;
+        for ( int s = 0; s <= SIDES; ++s ) {
+            real_t v = 2 * PI * s / SIDES;
+            Vector3 center( MAJOR * cos( u ), 0, MAJOR * sin( u ) );
+            Vector3 normal( cos( v ) * cos( u ), sin( v ), cos( v ) * sin( u ) );
+
+            MeshVertex vertex;
+            vertex.position = center + MINOR * normal;
+            vertex.normal = normal;
+            vertex.tex_coord = Vector2( (real_t) r / RINGS, (real_t) s / SIDES );
+            mesh->vertices.push_back( vertex );
+        }
+    }
+    for ( int r = 0; r < RINGS; ++r ) {
+        for ( int s = 0; s < SIDES; ++s ) {
+            unsigned int a = r * ( SIDES + 1 ) + s, b = a + SIDES + 1;
+            MeshTriangle first = { { a, b, a + 1 } };
+            MeshTriangle second = { { a + 1, b, b + 1 } };
+            mesh->triangles.push_back( first );
+            mesh->triangles.push_back( second );
+        }
+    }
+    scene->add_mesh( mesh );
+
+    for ( int i = 0; i < 3; ++i ) {
+        Model* model = new Model();
+        model->mesh = mesh;
+        model->material = metal;
+        model->position = Vector3( 3.5 * ( i - 1 ), 0, -i );
+        model->orientation = Quaternion( Vector3( 1, 0, 0 ), 0.4 * i );
+        scene->add_geometry( model );
+    }
+
+    add_light( scene, Vector3( 0, 10, 6 ), Color3( 0.8, 0.8, 0.8 ) );
+}
+
+// a handful of spheres lit by a grid of dim lights
+static void build_lights( Scene* scene )
+{
+    setup_common( scene, Vector3( 0, 2, 10 ) );
+
+    Material* floor = make_material( scene, Color3( 0.6, 0.6, 0.6 ), Color3( 0, 0, 0 ), 0 );
+    Material* shiny = make_material( scene, Color3( 0.7, 0.7, 0.7 ), Color3( 0.2, 0.2, 0.2 ), 0 );
+    add_floor( scene, -1, floor );
+
+    for ( int i = 0; i < 5; ++i ) {
+        for ( int j = 0; j < 3; ++j ) {
+            add_sphere( scene, Vector3( 2 * i - 4, 0, -2 * j ), 0.8, shiny );
+        }
+    }
+
+    for ( int i = 0; i < 8; ++i ) {
+        for ( int j = 0; j < 8; ++j ) {
+            add_light( scene, Vector3( 2 * i - 7, 8, 2 * j - 10 ), Color3( 0.02, 0.02, 0.02 ) );
+        }
+    }
+}
+
+// nested and overlapping glass, so most rays reach the depth limit
+static void build_glass( Scene* scene )
+{
+    setup_common( scene, Vector3( 0, 1, 7 ) );
+
+    Material* floor = make_material( scene, Color3( 0.6, 0.6, 0.6 ), Color3( 0.1, 0.1, 0.1 ), 0 );
+    Material* glass = make_material( scene, Color3( 0, 0, 0 ), Color3( 1, 1, 1 ), 1.5 );
+    Material* red = make_material( scene, Color3( 0.8, 0.2, 0.2 ), Color3( 0.2, 0.2, 0.2 ), 0 );
+    add_floor( scene, -1.5, floor );
+
+    for ( int i = 0; i < 3; ++i ) {
+        for ( int j = 0; j < 3; ++j ) {
+            Vector3 center( 1.6 * ( i - 1 ), 1.6 * ( j - 1 ), 0 );
+            add_sphere( scene, center, 0.9, glass );
+            add_sphere( scene, center, 0.6, glass );
+            add_sphere( scene, center, 0.25, red );
+        }
+    }
+
+    add_light( scene, Vector3( -4, 8, 6 ), Color3( 0.8, 0.8, 0.8 ) );
+}
+
+// bounce limit of the glass scene; the others use the default
+static const int GLASS_DEPTH = 8;
+
+struct BenchScene
+{
+    const char* name;
+    void ( *build )( Scene* scene );
+    int max_depth;
+};
+
+static const BenchScene SCENES[] = {
+    { "spheres", build_spheres, MAXNUMBER },
+    { "mesh", build_mesh, MAXNUMBER },
+    { "lights", build_lights, MAXNUMBER },
+    { "glass", build_glass, GLASS_DEPTH },
+};
+static const size_t NUM_SCENES = sizeof SCENES / sizeof SCENES[0];
+
+static BenchResult run_scene( const BenchScene& bench, const BenchOptions& opt )
+{
+    BenchResult result;
+    result.name = bench.name;
+
+    Scene scene;
+    bench.build( &scene );
+    scene.camera.aspect = real_t( opt.width ) / real_t( opt.height );
+    result.num_geometries = scene.num_geometries();
+    result.num_lights = scene.num_lights();
+
+    std::vector< unsigned char > buffer( 4 * opt.width * opt.height );
+    Raytracer raytracer;
+    raytracer.set_num_threads( opt.num_threads );
+    raytracer.set_packet_width( opt.packet_width );
+    raytracer.set_wavefront( opt.wavefront );
+    raytracer.set_max_depth( bench.max_depth );
+    // progress lines would be timed along with the trace
+    raytracer.set_verbose( false );
+
+    // building the bvhs is part of preparing
+    double start = timer_seconds();
+    Mesh* const* meshes = scene.get_meshes();
+    for ( size_t i = 0; i < scene.num_meshes(); ++i ) {
+        raytracer.prepare_mesh( meshes[i] );
+    }
+    raytracer.initialize( &scene, opt.width, opt.height );
+    result.prepare_time = timer_seconds() - start;
+
+    start = timer_seconds();
+    raytracer.raytrace( &buffer[0], 0 );
+    result.trace_time = timer_seconds() - start;
+
+    result.rays = raytracer.get_ray_counts();
+    result.wavefront = raytracer.get_wavefront_stats();
+    return result;
+}
+
+static bool write_json( const char* filename, const BenchOptions& opt,
+                        const std::vector< BenchResult >& results )
+{
+    FILE* file = fopen( filename, "w" );
+    if ( !file )
+        return false;
+
+    fprintf( file, "{\n" );
+    fprintf( file, "  \"width\": %d,\n  \"height\": %d,\n", opt.width, opt.height );
+    fprintf( file, "  \"threads\": %d,\n  \"packet_width\": %d,\n  \"wavefront\": %s,\n",
+             opt.num_threads, opt.packet_width, opt.wavefront ? "true" : "false" );
+    fprintf( file, "  \"scenes\": [\n" );
+
+    for ( size_t i = 0; i < results.size(); ++i ) {
+        const BenchResult& r = results[i];
+        fprintf( file, "    {\n" );
+        fprintf( file, "      \"name\": \"%s\",\n", r.name.c_str() );
+        fprintf( file, "      \"geometries\": %u,\n", (unsigned int) r.num_geometries );
+        fprintf( file, "      \"lights\": %u,\n", (unsigned int) r.num_lights );
+        fprintf( file, "      \"prepare_seconds\": %.6f,\n", r.prepare_time );
+        fprintf( file, "      \"trace_seconds\": %.6f,\n", r.trace_time );
+        fprintf( file, "      \"primary_rays\": %lu,\n", (unsigned long) r.rays.primary );
+        fprintf( file, "      \"secondary_rays\": %lu,\n", (unsigned long) r.rays.secondary );
+        fprintf( file, "      \"shadow_rays\": %lu,\n", (unsigned long) r.rays.shadow );
+        if ( opt.wavefront ) {
+            // summed over threads
+            fprintf( file, "      \"phases\": { \"generate\": %.6f, \"intersect\": %.6f, "
+                     "\"sort\": %.6f, \"shadow\": %.6f, \"shade\": %.6f },\n",
+                     r.wavefront.generate, r.wavefront.intersect, r.wavefront.sort,
+                     r.wavefront.shadow, r.wavefront.shade );
+        }
+        fprintf( file, "      \"rays_per_second\": %.1f\n", r.rays_per_second() );
+        fprintf( file, "    }%s\n", i + 1 < results.size() ? "," : "" );
+    }
+
+    fprintf( file, "  ]\n}\n" );
+    return fclose( file ) == 0;
+}
+
+// pulls "name" and "rays_per_second" pairs back out of a file written by
+// write_json. not a general json reader.
+static bool read_baseline( const char* filename, std::vector< std::string >* names,
+                           std::vector< double >* rates )
+{
+    std::ifstream file( filename );
+    if ( !file )
+        return false;
+
+    std::string line, name;
+    while ( std::getline( file, line ) ) {
+        std::string::size_type key = line.find( "\"name\":" );
+        if ( key != std::string::npos ) {
+            std::string::size_type open = line.find( '"', key + 7 );
+            std::string::size_type close = line.find( '"', open + 1 );
+            if ( open != std::string::npos && close != std::string::npos ) {
+                name = line.substr( open + 1, close - open - 1 );
+            }
+        }
+
+        key = line.find( "\"rays_per_second\":" );
+        if ( key != std::string::npos && !name.empty() ) {
+            names->push_back( name );
+            rates->push_back( atof( line.c_str() + key + 18 ) );
+            name.clear();
+        }
+    }
+    return true;
+}
+
+// prints each scene's speed against the baseline. returns false if any
+// scene got slower by more than the tolerance.
+static bool compare_baseline( const char* filename, const std::vector< BenchResult >& results )
+{
+    std::vector< std::string > names;
+    std::vector< double > rates;
+    if ( !read_baseline( filename, &names, &rates ) ) {
+        std::cout << "Unable to read baseline '" << filename << "'.\n";
+        return false;
+    }
+
+    bool ok = true;
+    for ( size_t i = 0; i < results.size(); ++i ) {
+        for ( size_t j = 0; j < names.size(); ++j ) {
+            if ( names[j] != results[i].name || rates[j] <= 0 )
+                continue;
+
+            double ratio = results[i].rays_per_second() / rates[j];
+            bool regressed = ratio < 1 - REGRESSION_TOLERANCE;
+            printf( "%-8s %6.2fx baseline%s\n", results[i].name.c_str(), ratio,
+                    regressed ? "  REGRESSION" : "" );
+            ok = ok && !regressed;
+        }
+    }
+    return ok;
+}
+
+static void print_usage( const char* progname )
+{
+    std::cout << "Usage: " << progname << " [-d width height] [-t threads] [-p width] [-w]"
+              << " [-o results.json] [-c baseline.json]\n";
+}
+
+static bool parse_args( BenchOptions* opt, int argc, char* argv[] )
+{
+    opt->width = 640;
+    opt->height = 480;
+    opt->num_threads = 1;
+    opt->packet_width = 1;
+    opt->wavefront = false;
+    opt->json_filename = 0;
+    opt->baseline_filename = 0;
+
+    for ( int i = 1; i < argc; ++i ) {
+        bool has_value = i + 1 < argc;
+        if ( strcmp( argv[i], "-d" ) == 0 && i + 2 < argc ) {
+            opt->width = atoi( argv[++i] );
+            opt->height = atoi( argv[++i] );
+        } else if ( strcmp( argv[i], "-t" ) == 0 && has_value ) {
+            opt->num_threads = atoi( argv[++i] );
+        } else if ( strcmp( argv[i], "-p" ) == 0 && has_value ) {
+            opt->packet_width = atoi( argv[++i] );
+        } else if ( strcmp( argv[i], "-w" ) == 0 ) {
+            opt->wavefront = true;
+        } else if ( strcmp( argv[i], "-o" ) == 0 && has_value ) {
+            opt->json_filename = argv[++i];
+        } else if ( strcmp( argv[i], "-c" ) == 0 && has_value ) {
+            opt->baseline_filename = argv[++i];
+        } else {
+            print_usage( argv[0] );
+            return false;
+        }
+    }
+
+    if ( opt->width < 1 || opt->height < 1 || opt->num_threads < 1 || opt->packet_width < 0 ) {
+        std::cout << "Invalid options\n";
+        return false;
+    }
+    return true;
+}
+
+} /* _462 */
+
+using namespace _462;
+
+int main( int argc, char* argv[] )
+{
+    BenchOptions opt;
+    if ( !parse_args( &opt, argc, argv ) ) {
+        return 1;
+    }
+
+    std::vector< BenchResult > results;
+    for ( size_t i = 0; i < NUM_SCENES; ++i ) {
+        BenchResult result = run_scene( SCENES[i], opt );
+        printf( "%-8s prepare %.3fs  trace %.3fs  primary %lu  secondary %lu  shadow %lu  %.2f Mrays/s\n",
+                result.name.c_str(), result.prepare_time, result.trace_time,
+                (unsigned long) result.rays.primary, (unsigned long) result.rays.secondary,
+                (unsigned long) result.rays.shadow, result.rays_per_second() / 1e6 );
+        results.push_back( result );
+    }
+
+    if ( opt.json_filename ) {
+        if ( !write_json( opt.json_filename, opt, results ) ) {
+            std::cout << "Unable to write '" << opt.json_filename << "'.\n";
+            return 1;
+        }
+        std::cout << "Wrote results to '" << opt.json_filename << "'.\n";
+    }
+
+    if ( opt.baseline_filename && !compare_baseline( opt.baseline_filename, results ) ) {
+        return 1;
+    }
+    return 0;
+}
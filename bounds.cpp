@@ -0,0 +1,109 @@
+#include "bounds.hpp"
+#include "scene/scene.hpp"
+#include "scene/sphere.hpp"
+#include "scene/triangle.hpp"
+#include "scene/model.hpp"
+#include "scene/mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace _462 {
+
+BoundingBox::BoundingBox()
+{
+    real_t inf = std::numeric_limits< real_t >::infinity();
+    lower = Vector3( inf, inf, inf );
+    upper = Vector3( -inf, -inf, -inf );
+}
+
+void BoundingBox::include( const Vector3& point )
+{
+    for ( int i = 0; i < 3; ++i ) {
+        lower[i] = std::min( lower[i], point[i] );
+        upper[i] = std::max( upper[i], point[i] );
+    }
+}
+
+void BoundingBox::include( const BoundingBox& box )
+{
+    if ( box.empty() )
+        return;
+    include( box.lower );
+    include( box.upper );
+}
+
+real_t BoundingBox::surface_area() const
+{
+    if ( empty() )
+        return 0;
+    Vector3 d = upper - lower;
+    return 2 * ( d.x * d.y + d.y * d.z + d.z * d.x );
+}
+
+void BoundingBox::pad()
+{
+    if ( empty() )
+        return;
+    for ( int i = 0; i < 3; ++i ) {
+        real_t eps = 1e-6 * ( upper[i] - lower[i] + fabs( lower[i] ) + fabs( upper[i] ) ) + 1e-9;
+        lower[i] -= eps;
+        upper[i] += eps;
+    }
+}
+
+BoundingBox transform_bounds( const BoundingBox& box, const Matrix4& transform )
+{
+    BoundingBox result;
+    if ( box.empty() )
+        return result;
+
+    for ( int i = 0; i < 8; ++i ) {
+        Vector3 corner(
+            ( i & 1 ) ? box.upper.x : box.lower.x,
+            ( i & 2 ) ? box.upper.y : box.lower.y,
+            ( i & 4 ) ? box.upper.z : box.lower.z );
+        result.include( transform.transform_point( corner ) );
+    }
+    return result;
+}
+
+bool get_local_bounds( const Geometry& geometry, BoundingBox* bounds )
+{
+    *bounds = BoundingBox();
+
+    if ( const Sphere* sphere = dynamic_cast< const Sphere* >( &geometry ) ) {
+        real_t r = sphere->radius;
+        bounds->include( Vector3( -r, -r, -r ) );
+        bounds->include( Vector3( r, r, r ) );
+        return true;
+    }
+
+    if ( const Triangle* triangle = dynamic_cast< const Triangle* >( &geometry ) ) {
+        for ( int i = 0; i < 3; ++i ) {
+            bounds->include( triangle->vertices[i].position );
+        }
+        return true;
+    }
+
+    if ( const Model* model = dynamic_cast< const Model* >( &geometry ) ) {
+        // a model without a mesh has no surface; a point at its origin
+        // keeps it out of the way of nearly every ray
+        const Mesh* mesh = model->mesh;
+        if ( !mesh ) {
+            bounds->include( Vector3::Zero );
+            return true;
+        }
+        const MeshVertex* vertices = mesh->get_vertices();
+        for ( size_t i = 0; i < mesh->num_vertices(); ++i ) {
+            bounds->include( vertices[i].position );
+        }
+        return true;
+    }
+
+    return false;
+}
+
+} /* _462 */
+
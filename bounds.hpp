@@ -0,0 +1,43 @@
+#ifndef _462_RAYTRACER_BOUNDS_HPP_
+#define _462_RAYTRACER_BOUNDS_HPP_
+
+#include "math/matrix.hpp"
+#include "math/vector.hpp"
+
+namespace _462 {
+
+class Geometry;
+
+// an axis-aligned box; empty until something is included
+struct BoundingBox
+{
+    Vector3 lower, upper;
+
+    BoundingBox();
+
+    bool empty() const { return lower.x > upper.x; }
+
+    void include( const Vector3& point );
+
+    void include( const BoundingBox& box );
+
+    Vector3 center() const { return ( lower + upper ) * 0.5; }
+
+    real_t surface_area() const;
+
+    // grows the box slightly so rounding never makes a ray miss it
+    void pad();
+};
+
+// the box around another box after an affine transform
+BoundingBox transform_bounds( const BoundingBox& box, const Matrix4& transform );
+
+// the local-space bounds of spheres, triangles and models; a model without
+// a mesh gets a single point. returns false for geometry whose extent is
+// unknown, which must then always be tested.
+bool get_local_bounds( const Geometry& geometry, BoundingBox* bounds );
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_BOUNDS_HPP_ */
+
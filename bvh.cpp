@@ -0,0 +1,341 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+namespace _462 {
+
+// SAH costs, relative to one primitive test
+static const real_t TRAVERSAL_COST = 1.0;
+static const size_t NUM_BINS = 16;
+// larger sets are always split, even when the SAH says not to
+static const size_t MAX_LEAF_SIZE = 4;
+// below this depth splits fall back to halving, which bounds the tree height
+static const size_t MAX_SAH_DEPTH = 48;
+// refitted trees whose nodes have grown past this multiple of their built
+// area are rebuilt instead
+static const real_t MAX_REFIT_GROWTH = 2.0;
+
+struct BVHBuildEntry
+{
+    BoundingBox bounds;
+    Vector3 center;
+    unsigned int index;
+};
+
+// float versions of the bounds that still enclose the real_t ones
+static float round_down( real_t value )
+{
+    float f = (float) value;
+    return f > value ? nextafterf( f, -HUGE_VALF ) : f;
+}
+
+static float round_up( real_t value )
+{
+    float f = (float) value;
+    return f < value ? nextafterf( f, HUGE_VALF ) : f;
+}
+
+static void set_node_bounds( BVHNode& node, const BoundingBox& box )
+{
+    for ( int i = 0; i < 3; ++i ) {
+        node.lower[i] = round_down( box.lower[i] );
+        node.upper[i] = round_up( box.upper[i] );
+    }
+}
+
+BVHRay::BVHRay( const Vector3& origin, const Vector3& direction )
+    : origin( origin )
+{
+    for ( int i = 0; i < 3; ++i ) {
+        // a huge slope instead of infinity avoids 0 * inf in the slab test
+        real_t d = direction[i];
+        inv_direction[i] = d != 0 ? 1 / d : 1e30;
+        negative[i] = inv_direction[i] < 0;
+    }
+}
+
+BVH::BVH()
+    : node_data( 0 ), index_data( 0 ), node_count( 0 ), index_count( 0 ), built_area( 0 ) { }
+
+BVH::BVH( const BVH& other )
+    : nodes( other.nodes ), indices( other.indices ), built_area( other.built_area )
+{
+    if ( other.nodes.empty() ) {
+        view( other.node_data, other.node_count, other.index_data, other.index_count );
+    } else {
+        use_own_storage();
+    }
+}
+
+BVH& BVH::operator=( const BVH& other )
+{
+    if ( this != &other ) {
+        nodes = other.nodes;
+        indices = other.indices;
+        built_area = other.built_area;
+        if ( other.nodes.empty() ) {
+            view( other.node_data, other.node_count, other.index_data, other.index_count );
+        } else {
+            use_own_storage();
+        }
+    }
+    return *this;
+}
+
+void BVH::view( const BVHNode* nodes, size_t num_nodes, const unsigned int* indices, size_t num_indices )
+{
+    this->nodes.clear();
+    this->indices.clear();
+    built_area = 0;
+    node_data = num_nodes ? nodes : 0;
+    index_data = num_indices ? indices : 0;
+    node_count = num_nodes;
+    index_count = num_indices;
+}
+
+void BVH::use_own_storage()
+{
+    node_data = nodes.empty() ? 0 : &nodes[0];
+    index_data = indices.empty() ? 0 : &indices[0];
+    node_count = nodes.size();
+    index_count = indices.size();
+}
+
+void BVH::clear()
+{
+    nodes.clear();
+    indices.clear();
+    built_area = 0;
+    use_own_storage();
+}
+
+real_t BVH::total_area() const
+{
+    real_t area = 0;
+    for ( size_t i = 0; i < nodes.size(); ++i ) {
+        const BVHNode& node = nodes[i];
+        real_t x = node.upper[0] - node.lower[0];
+        real_t y = node.upper[1] - node.lower[1];
+        real_t z = node.upper[2] - node.lower[2];
+        area += 2 * ( x * y + y * z + z * x );
+    }
+    return area;
+}
+
+BoundingBox BVH::get_bounds() const
+{
+    BoundingBox box;
+    if ( node_count > 0 ) {
+        const BVHNode& root = node_data[0];
+        box.include( Vector3( root.lower[0], root.lower[1], root.lower[2] ) );
+        box.include( Vector3( root.upper[0], root.upper[1], root.upper[2] ) );
+    }
+    return box;
+}
+
+void BVH::build( const BoundingBox* bounds, size_t count )
+{
+    clear();
+
+    std::vector< BVHBuildEntry > entries;
+    entries.reserve( count );
+    for ( size_t i = 0; i < count; ++i ) {
+        if ( bounds[i].empty() )
+            continue;
+        BVHBuildEntry entry;
+        entry.bounds = bounds[i];
+        entry.center = bounds[i].center();
+        entry.index = (unsigned int) i;
+        entries.push_back( entry );
+    }
+
+    if ( entries.empty() )
+        return;
+
+    nodes.reserve( 2 * entries.size() );
+    indices.reserve( entries.size() );
+    build_recursive( entries, 0, entries.size(), 0 );
+    use_own_storage();
+    built_area = total_area();
+}
+
+bool BVH::refit( const BoundingBox* bounds, size_t count )
+{
+    if ( nodes.empty() )
+        return false;
+
+    // the tree must hold exactly the primitives with non-empty boxes
+    size_t num_bounded = 0;
+    for ( size_t i = 0; i < count; ++i ) {
+        if ( !bounds[i].empty() ) {
+            ++num_bounded;
+        }
+    }
+    if ( num_bounded != indices.size() )
+        return false;
+    for ( size_t i = 0; i < indices.size(); ++i ) {
+        if ( indices[i] >= count || bounds[indices[i]].empty() )
+            return false;
+    }
+
+    // children are stored after their parent, so sweeping backwards fits
+    // both children of a node before the node itself
+    for ( size_t n = nodes.size(); n-- > 0; ) {
+        BVHNode& node = nodes[n];
+        if ( node.count > 0 ) {
+            BoundingBox box;
+            for ( unsigned int i = 0; i < node.count; ++i ) {
+                box.include( bounds[indices[node.offset + i]] );
+            }
+            set_node_bounds( node, box );
+        } else {
+            const BVHNode& first = nodes[n + 1];
+            const BVHNode& second = nodes[node.offset];
+            for ( int i = 0; i < 3; ++i ) {
+                node.lower[i] = std::min( first.lower[i], second.lower[i] );
+                node.upper[i] = std::max( first.upper[i], second.upper[i] );
+            }
+        }
+    }
+
+    return total_area() <= MAX_REFIT_GROWTH * built_area;
+}
+
+namespace {
+
+struct BinPredicate
+{
+    int axis;
+    real_t lower, scale;
+    size_t split;
+
+    size_t bin( const Vector3& center ) const
+    {
+        size_t b = (size_t) ( ( center[axis] - lower ) * scale );
+        return std::min( b, NUM_BINS - 1 );
+    }
+
+    bool operator()( const BVHBuildEntry& entry ) const
+    {
+        return bin( entry.center ) <= split;
+    }
+};
+
+struct CenterLess
+{
+    int axis;
+
+    bool operator()( const BVHBuildEntry& a, const BVHBuildEntry& b ) const
+    {
+        return a.center[axis] < b.center[axis];
+    }
+};
+
+}
+
+size_t BVH::build_recursive( std::vector< BVHBuildEntry >& entries, size_t begin, size_t end, size_t depth )
+{
+    size_t index = nodes.size();
+    nodes.push_back( BVHNode() );
+
+    BoundingBox box, centers;
+    for ( size_t i = begin; i < end; ++i ) {
+        box.include( entries[i].bounds );
+        centers.include( entries[i].center );
+    }
+
+    set_node_bounds( nodes[index], box );
+
+    size_t count = end - begin;
+    real_t best_cost = (real_t) count;
+    BinPredicate best;
+    best.axis = -1;
+
+    // binned SAH over every axis the centers are spread along
+    real_t area = box.surface_area();
+    for ( int axis = 0; count > 1 && depth < MAX_SAH_DEPTH && axis < 3; ++axis ) {
+        real_t extent = centers.upper[axis] - centers.lower[axis];
+        if ( extent <= 0 )
+            continue;
+
+        BinPredicate pred;
+        pred.axis = axis;
+        pred.lower = centers.lower[axis];
+        pred.scale = NUM_BINS / extent;
+
+        BoundingBox bin_bounds[NUM_BINS];
+        size_t bin_counts[NUM_BINS] = { 0 };
+        for ( size_t i = begin; i < end; ++i ) {
+            size_t b = pred.bin( entries[i].center );
+            bin_bounds[b].include( entries[i].bounds );
+            ++bin_counts[b];
+        }
+
+        // area and count to the right of each split, swept from the right
+        real_t right_area[NUM_BINS];
+        size_t right_count[NUM_BINS];
+        BoundingBox acc;
+        size_t n = 0;
+        for ( size_t b = NUM_BINS - 1; b > 0; --b ) {
+            acc.include( bin_bounds[b] );
+            n += bin_counts[b];
+            right_area[b] = acc.surface_area();
+            right_count[b] = n;
+        }
+
+        acc = BoundingBox();
+        n = 0;
+        for ( size_t b = 0; b + 1 < NUM_BINS; ++b ) {
+            acc.include( bin_bounds[b] );
+            n += bin_counts[b];
+            if ( n == 0 || right_count[b + 1] == 0 )
+                continue;
+            real_t cost = TRAVERSAL_COST
+                + ( acc.surface_area() * n + right_area[b + 1] * right_count[b + 1] ) / area;
+            if ( cost < best_cost ) {
+                best_cost = cost;
+                best = pred;
+                best.split = b;
+            }
+        }
+    }
+
+    if ( best.axis < 0 && count <= MAX_LEAF_SIZE ) {
+        nodes[index].offset = (unsigned int) indices.size();
+        nodes[index].count = (unsigned short) count;
+        nodes[index].axis = 0;
+        for ( size_t i = begin; i < end; ++i ) {
+            indices.push_back( entries[i].index );
+        }
+        return index;
+    }
+
+    size_t mid;
+    int axis;
+    if ( best.axis >= 0 ) {
+        axis = best.axis;
+        mid = std::partition( entries.begin() + begin, entries.begin() + end, best ) - entries.begin();
+    } else {
+        // too many to leave in a leaf but no useful split, so halve along
+        // the widest axis
+        Vector3 extent = centers.upper - centers.lower;
+        axis = extent.x > extent.y ? ( extent.x > extent.z ? 0 : 2 ) : ( extent.y > extent.z ? 1 : 2 );
+        CenterLess less;
+        less.axis = axis;
+        mid = ( begin + end ) / 2;
+        std::nth_element( entries.begin() + begin, entries.begin() + mid, entries.begin() + end, less );
+    }
+
+    build_recursive( entries, begin, mid, depth + 1 );
+    size_t right = build_recursive( entries, mid, end, depth + 1 );
+
+    // the vector may have moved, so index again rather than holding a reference
+    nodes[index].offset = (unsigned int) right;
+    nodes[index].count = 0;
+    nodes[index].axis = (unsigned short) axis;
+
+    return index;
+}
+
+} /* _462 */
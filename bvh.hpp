@@ -0,0 +1,218 @@
+#ifndef _462_RAYTRACER_BVH_HPP_
+#define _462_RAYTRACER_BVH_HPP_
+
+#include "bounds.hpp"
+#include <cassert>
+#include <vector>
+
+namespace _462 {
+
+struct BVHBuildEntry;
+
+// traversal stack depth; builds keep the tree shallower than this
+static const size_t BVH_STACK_SIZE = 96;
+
+// one node of a flattened bvh, two to a cache line
+struct BVHNode
+{
+    float lower[3];
+    float upper[3];
+    // interior: index of the second child, the first directly follows.
+    // leaf: index of the first primitive in the index list.
+    unsigned int offset;
+    // number of primitives in a leaf, 0 for interior nodes
+    unsigned short count;
+    // split axis of an interior node
+    unsigned short axis;
+};
+
+// a ray prepared for repeated box tests
+struct BVHRay
+{
+    Vector3 origin;
+    Vector3 inv_direction;
+    int negative[3];
+
+    BVHRay( const Vector3& origin, const Vector3& direction );
+};
+
+/**
+ * Bounding volume hierarchy over an arbitrary set of boxes, built with
+ * binned SAH splits and stored depth-first in a flat node array.
+ *
+ * Queries are templates over an intersector, which is called once per leaf
+ * as isect( primitives, count ) with the leaf's part of the index list and
+ * returns true if it hit any of them, and reports the current far limit of
+ * the ray through isect.limit(). A closest-hit intersector shrinks its
+ * limit as it finds hits. Handing over whole leaves lets an intersector
+ * test neighbouring primitives together.
+ */
+class BVH
+{
+public:
+
+    BVH();
+
+    BVH( const BVH& other );
+
+    BVH& operator=( const BVH& other );
+
+    // builds the hierarchy over count boxes. primitive ids are the box indices.
+    void build( const BoundingBox* bounds, size_t count );
+
+    // fits the existing tree to new boxes for the same primitives, keeping
+    // its shape. far cheaper than a build, but the tree gets worse as its
+    // primitives move apart. returns false, leaving the tree unusable, if
+    // it has degraded too far or a box became empty or non-empty; the
+    // caller must then build.
+    bool refit( const BoundingBox* bounds, size_t count );
+
+    // makes the tree a read only view of nodes and indices stored elsewhere,
+    // such as a mapped cache file, which must outlive it. a view cannot be
+    // refit; building replaces it with a tree of its own.
+    void view( const BVHNode* nodes, size_t num_nodes, const unsigned int* indices, size_t num_indices );
+
+    void clear();
+
+    bool empty() const { return node_count == 0; }
+
+    size_t num_nodes() const { return node_count; }
+
+    size_t num_indices() const { return index_count; }
+
+    // the raw tree, for traversals other than the ones below
+    const BVHNode* get_nodes() const { return node_data; }
+    const unsigned int* get_indices() const { return index_data; }
+
+    // the box around everything in the hierarchy
+    BoundingBox get_bounds() const;
+
+    // visits every primitive the ray might hit, nearest subtrees first
+    template< typename Intersector >
+    bool closest_hit( const BVHRay& ray, real_t tmin, Intersector& isect ) const;
+
+    // stops at the first primitive that reports a hit
+    template< typename Intersector >
+    bool any_hit( const BVHRay& ray, real_t tmin, Intersector& isect ) const;
+
+private:
+
+    size_t build_recursive( std::vector< BVHBuildEntry >& entries, size_t begin, size_t end, size_t depth );
+
+    static bool intersect_box( const BVHNode& node, const BVHRay& ray, real_t tmin, real_t tmax );
+
+    // summed surface area of every node, a measure of traversal cost
+    real_t total_area() const;
+
+    // points the queries at nodes and indices
+    void use_own_storage();
+
+    std::vector< BVHNode > nodes;
+    std::vector< unsigned int > indices;
+
+    // what the queries read: the vectors above, or a view
+    const BVHNode* node_data;
+    const unsigned int* index_data;
+    size_t node_count, index_count;
+
+    // total_area() right after the last build
+    real_t built_area;
+};
+
+inline bool BVH::intersect_box( const BVHNode& node, const BVHRay& ray, real_t tmin, real_t tmax )
+{
+    for ( int i = 0; i < 3; ++i ) {
+        real_t entry = ray.negative[i] ? node.upper[i] : node.lower[i];
+        real_t exit = ray.negative[i] ? node.lower[i] : node.upper[i];
+        real_t t0 = ( entry - ray.origin[i] ) * ray.inv_direction[i];
+        real_t t1 = ( exit - ray.origin[i] ) * ray.inv_direction[i];
+        if ( t0 > tmin ) tmin = t0;
+        if ( t1 < tmax ) tmax = t1;
+        if ( tmin > tmax )
+            return false;
+    }
+    return true;
+}
+
+template< typename Intersector >
+bool BVH::closest_hit( const BVHRay& ray, real_t tmin, Intersector& isect ) const
+{
+    static const size_t STACK_SIZE = BVH_STACK_SIZE;
+
+    if ( node_count == 0 )
+        return false;
+
+    unsigned int stack[STACK_SIZE];
+    size_t top = 0;
+    unsigned int current = 0;
+    bool hit = false;
+
+    while ( true ) {
+        const BVHNode& node = node_data[current];
+
+        if ( intersect_box( node, ray, tmin, isect.limit() ) ) {
+            if ( node.count > 0 ) {
+                if ( isect( index_data + node.offset, node.count ) ) {
+                    hit = true;
+                }
+            } else {
+                // descend into the child on the ray's side of the split first
+                if ( ray.negative[node.axis] ) {
+                    stack[top++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[top++] = node.offset;
+                    current = current + 1;
+                }
+                assert( top < STACK_SIZE );
+                continue;
+            }
+        }
+
+        if ( top == 0 )
+            break;
+        current = stack[--top];
+    }
+
+    return hit;
+}
+
+template< typename Intersector >
+bool BVH::any_hit( const BVHRay& ray, real_t tmin, Intersector& isect ) const
+{
+    static const size_t STACK_SIZE = BVH_STACK_SIZE;
+
+    if ( node_count == 0 )
+        return false;
+
+    unsigned int stack[STACK_SIZE];
+    size_t top = 0;
+    unsigned int current = 0;
+
+    while ( true ) {
+        const BVHNode& node = node_data[current];
+
+        if ( intersect_box( node, ray, tmin, isect.limit() ) ) {
+            if ( node.count > 0 ) {
+                if ( isect( index_data + node.offset, node.count ) )
+                    return true;
+            } else {
+                stack[top++] = node.offset;
+                current = current + 1;
+                assert( top < STACK_SIZE );
+                continue;
+            }
+        }
+
+        if ( top == 0 )
+            break;
+        current = stack[--top];
+    }
+
+    return false;
+}
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_BVH_HPP_ */
+
@@ -0,0 +1,89 @@
+#include "camera_rays.hpp"
+#include "packet.hpp"
+
+#include <cassert>
+
+namespace _462 {
+
+CameraRayGenerator::CameraRayGenerator()
+    : pixel_width( 0 ), pixel_height( 0 ), half_width( 0 ), half_height( 0 ),
+      width( 0 ), height( 0 ) { }
+
+void CameraRayGenerator::setup( const Camera& camera, size_t width, size_t height )
+{
+    this->width = width;
+    this->height = height;
+
+    position = camera.get_position();
+    forward = camera.get_direction();
+    up = camera.get_up();
+    right = normalize( cross( forward, up ) );
+
+    real_t fov = camera.get_fov_radians();
+    real_t ratio = camera.get_aspect_ratio();
+    real_t distance = camera.get_near_clip();
+
+    center = distance * forward;
+    pixel_height = distance * tan( fov / 2 ) / ( height / 2 );
+    pixel_width = distance * tan( fov / 2 ) * ratio / ( width / 2 );
+
+    // integer halves, as the image has always been centered
+    half_width = (real_t) ( width / 2 );
+    half_height = (real_t) ( height / 2 );
+}
+
+bool CameraRayGenerator::same_rays( const CameraRayGenerator& other ) const
+{
+    return width == other.width && height == other.height
+        && position == other.position && forward == other.forward
+        && up == other.up && right == other.right && center == other.center
+        && pixel_width == other.pixel_width && pixel_height == other.pixel_height;
+}
+
+RayInfo CameraRayGenerator::generate( size_t x, size_t y ) const
+{
+    return generate( x, y, 0.5, 0.5 );
+}
+
+RayInfo CameraRayGenerator::generate( size_t x, size_t y, real_t jitter_x, real_t jitter_y ) const
+{
+    assert( x < width && y < height );
+
+    real_t x0 = (real_t) x - half_width + jitter_x;
+    real_t y0 = (real_t) y - half_height + jitter_y;
+
+    RayInfo ray;
+    ray.origin = position;
+    ray.direction = normalize( center + y0 * pixel_height * up + x0 * pixel_width * right );
+    return ray;
+}
+
+void CameraRayGenerator::generate_row( size_t y, size_t x0, size_t x1, RayInfo* rays ) const
+{
+    assert( y < height && x1 <= width );
+
+    real_t v = (real_t) y - half_height + 0.5;
+    Vector3 row = center + v * pixel_height * up;
+
+    // stepping by whole pixels is exact, so this matches generate()
+    real_t u = (real_t) x0 - half_width + 0.5;
+    for ( size_t x = x0; x < x1; ++x, u += 1 ) {
+        rays[x - x0].origin = position;
+        rays[x - x0].direction = normalize( row + u * pixel_width * right );
+    }
+}
+
+void CameraRayGenerator::fill_packet( const Tile& block, const Tile& region, RayPacket* packet ) const
+{
+    size_t block_width = block.x1 - block.x0;
+
+    for ( size_t lane = 0; lane < packet->width; ++lane ) {
+        size_t x = block.x0 + lane % block_width;
+        size_t y = block.y0 + lane / block_width;
+        if ( x < region.x1 && y < region.y1 ) {
+            packet->set_ray( lane, generate( x, y ), 1000000 );
+        }
+    }
+}
+
+} /* _462 */
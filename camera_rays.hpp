@@ -0,0 +1,66 @@
+#ifndef _462_RAYTRACER_CAMERA_RAYS_HPP_
+#define _462_RAYTRACER_CAMERA_RAYS_HPP_
+
+#include "scene/scene.hpp"
+#include "tile_queue.hpp"
+
+namespace _462 {
+
+struct RayPacket;
+
+/**
+ * Produces primary rays for a fixed camera and image size. Everything that
+ * stays the same across a frame is worked out once in setup; the rays of a
+ * row then cost one add and a normalize each.
+ *
+ * Sub-pixel offsets are in [0, 1) across the pixel, with 0.5, 0.5 being the
+ * pixel center.
+ */
+class CameraRayGenerator
+{
+public:
+
+    CameraRayGenerator();
+
+    void setup( const Camera& camera, size_t width, size_t height );
+
+    // whether the other generator produces exactly the same rays
+    bool same_rays( const CameraRayGenerator& other ) const;
+
+    // the angle one pixel spans, by which the footprint of a primary ray
+    // widens per unit of distance
+    real_t get_pixel_spread() const { return pixel_height / length( center ); }
+
+    // the ray through the center of a pixel
+    RayInfo generate( size_t x, size_t y ) const;
+
+    // the ray through the given offset within a pixel
+    RayInfo generate( size_t x, size_t y, real_t jitter_x, real_t jitter_y ) const;
+
+    // the center rays of pixels [x0, x1) of row y, into rays
+    void generate_row( size_t y, size_t x0, size_t x1, RayInfo* rays ) const;
+
+    // the center rays of the pixels of block that lie inside region, one
+    // per lane in row-major order. lanes outside region are left inactive.
+    void fill_packet( const Tile& block, const Tile& region, RayPacket* packet ) const;
+
+private:
+
+    Vector3 position;
+    Vector3 forward, up, right;
+
+    // camera direction scaled out to the image plane
+    Vector3 center;
+
+    // size of a pixel on the image plane
+    real_t pixel_width, pixel_height;
+
+    // offsets that put the image center on the camera axis
+    real_t half_width, half_height;
+
+    size_t width, height;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_CAMERA_RAYS_HPP_ */
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Traces a scene with every thread count and packet width given, in rows,
+# tiles, packets and wavefronts, and checks each image against the per-tile
+# checksums of the first (see -k). Exits with 1 if any of them differ.
+#
+# usage: check_reproducible.sh raytracer scene [threads] [light budget]
+#
+# threads is the largest thread count to try besides 1, 4 by default. with
+# a light budget, lights are sampled, which exercises the per-pixel random
+# numbers as well.
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 raytracer scene [threads] [light budget]"
+    exit 2
+fi
+
+raytracer=$1
+scene=$2
+threads=${3:-4}
+budget=${4:+-l $4}
+
+dir=$(mktemp -d) || exit 2
+trap 'rm -rf "$dir"' EXIT
+checksums=$dir/checksums
+
+# the first trace writes the checksums the rest are checked against
+"$raytracer" -r -d 320 240 -t 1 -p 1 $budget -k "$checksums" "$scene" "$dir/image.ppm" > "$dir/log" \
+    || { cat "$dir/log"; exit 1; }
+
+failed=0
+for t in 1 $threads; do
+    for p in 1 4 8 16 wave; do
+        if [ $p = wave ]; then
+            mode="-p 1 -w"
+        else
+            mode="-p $p"
+        fi
+        if "$raytracer" -r -d 320 240 -t $t $mode $budget -k "$checksums" \
+                "$scene" "$dir/image.ppm" > "$dir/log"; then
+            echo "ok: -t $t $mode"
+        else
+            echo "differs: -t $t $mode"
+            sed -n "/differs/,\$p" "$dir/log"
+            failed=1
+        fi
+    done
+done
+
+exit $failed
@@ -0,0 +1,105 @@
+#include "checksum.hpp"
+#include "mesh_cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace _462 {
+
+// pixels on a side of a checksummed tile
+static const size_t CHECKSUM_TILE_SIZE = 32;
+
+ImageChecksum::ImageChecksum() : width( 0 ), height( 0 ), image_hash( FNV_OFFSET_BASIS ) { }
+
+void ImageChecksum::compute( const unsigned char* buffer, size_t width, size_t height )
+{
+    this->width = width;
+    this->height = height;
+    tiles.clear();
+    hashes.clear();
+    image_hash = FNV_OFFSET_BASIS;
+
+    for ( size_t y0 = 0; y0 < height; y0 += CHECKSUM_TILE_SIZE ) {
+        for ( size_t x0 = 0; x0 < width; x0 += CHECKSUM_TILE_SIZE ) {
+            Tile tile;
+            tile.x0 = x0;
+            tile.y0 = y0;
+            tile.x1 = std::min( x0 + CHECKSUM_TILE_SIZE, width );
+            tile.y1 = std::min( y0 + CHECKSUM_TILE_SIZE, height );
+
+            unsigned long long hash = FNV_OFFSET_BASIS;
+            for ( size_t y = tile.y0; y < tile.y1; ++y ) {
+                hash = fnv_hash( &buffer[4 * ( y * width + tile.x0 )], 4 * ( tile.x1 - tile.x0 ), hash );
+            }
+            tiles.push_back( tile );
+            hashes.push_back( hash );
+            image_hash = fnv_hash( &hash, sizeof hash, image_hash );
+        }
+    }
+}
+
+bool ImageChecksum::save( const char* filename ) const
+{
+    FILE* file = fopen( filename, "w" );
+    if ( !file )
+        return false;
+
+    fprintf( file, "checksum %lu %lu\n", (unsigned long) width, (unsigned long) height );
+    for ( size_t i = 0; i < tiles.size(); ++i ) {
+        fprintf( file, "%lu %lu %lu %lu %016llx\n",
+                 (unsigned long) tiles[i].x0, (unsigned long) tiles[i].y0,
+                 (unsigned long) tiles[i].x1, (unsigned long) tiles[i].y1, hashes[i] );
+    }
+    bool written = !ferror( file );
+    return fclose( file ) == 0 && written;
+}
+
+bool ImageChecksum::load( const char* filename )
+{
+    FILE* file = fopen( filename, "r" );
+    if ( !file )
+        return false;
+
+    unsigned long w = 0, h = 0;
+    bool ok = fscanf( file, "checksum %lu %lu", &w, &h ) == 2;
+    width = w;
+    height = h;
+    tiles.clear();
+    hashes.clear();
+    image_hash = FNV_OFFSET_BASIS;
+
+    unsigned long x0, y0, x1, y1;
+    unsigned long long hash;
+    while ( ok && fscanf( file, "%lu %lu %lu %lu %llx", &x0, &y0, &x1, &y1, &hash ) == 5 ) {
+        Tile tile;
+        tile.x0 = x0;
+        tile.y0 = y0;
+        tile.x1 = x1;
+        tile.y1 = y1;
+        tiles.push_back( tile );
+        hashes.push_back( hash );
+        image_hash = fnv_hash( &hash, sizeof hash, image_hash );
+    }
+    ok = ok && feof( file ) && !ferror( file );
+    fclose( file );
+    return ok;
+}
+
+bool ImageChecksum::compare( const ImageChecksum& expected, std::vector< Tile >* differing ) const
+{
+    differing->clear();
+    if ( width != expected.width || height != expected.height || tiles.size() != expected.tiles.size() ) {
+        *differing = tiles;
+        return false;
+    }
+
+    // both were cut up the same way, so tiles match up by index
+    for ( size_t i = 0; i < tiles.size(); ++i ) {
+        if ( hashes[i] != expected.hashes[i] ) {
+            differing->push_back( tiles[i] );
+        }
+    }
+    return differing->empty();
+}
+
+} /* _462 */
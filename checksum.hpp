@@ -0,0 +1,55 @@
+#ifndef _462_RAYTRACER_CHECKSUM_HPP_
+#define _462_RAYTRACER_CHECKSUM_HPP_
+
+#include "tile_queue.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace _462 {
+
+/**
+ * Hashes of an rgba image cut into a fixed grid of tiles, for checking that
+ * a trace comes out bit for bit the same whatever the thread count, packet
+ * width, tiling or machine. The grid is the checksum's own rather than the
+ * raytracer's, so traces split up differently still line up tile for tile,
+ * and a mismatch points at where in the image the difference is.
+ *
+ * Saved as text: the image size, then one line per tile with its corners
+ * and hash.
+ */
+class ImageChecksum
+{
+public:
+
+    ImageChecksum();
+
+    // hashes buffer, a width x height rgba image
+    void compute( const unsigned char* buffer, size_t width, size_t height );
+
+    // one hash over the whole image
+    unsigned long long total() const { return image_hash; }
+
+    size_t num_tiles() const { return tiles.size(); }
+
+    // returns false if the file could not be written
+    bool save( const char* filename ) const;
+
+    // returns false if the file could not be read or is not a checksum
+    bool load( const char* filename );
+
+    // fills differing with the tiles whose hashes do not match expected's,
+    // or with every tile if the images differ in size. returns whether
+    // everything matched.
+    bool compare( const ImageChecksum& expected, std::vector< Tile >* differing ) const;
+
+private:
+
+    size_t width, height;
+    std::vector< Tile > tiles;
+    std::vector< unsigned long long > hashes;
+    unsigned long long image_hash;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_CHECKSUM_HPP_ */
@@ -0,0 +1,166 @@
+#include "compiled_scene.hpp"
+#include "prepared_scene.hpp"
+#include "scene/model.hpp"
+#include "scene/sphere.hpp"
+#include "scene/triangle.hpp"
+
+namespace _462 {
+
+// copies a world to local matrix into slot of the entry arrays
+static void store_inverse( real_t* const* entries, size_t slot, const Matrix4& inverse )
+{
+    Vector3 columns[3] = {
+        inverse.transform_vector( Vector3::UnitX ),
+        inverse.transform_vector( Vector3::UnitY ),
+        inverse.transform_vector( Vector3::UnitZ )
+    };
+    Vector3 translation = inverse.transform_point( Vector3::Zero );
+
+    for ( int i = 0; i < 3; ++i ) {
+        for ( int j = 0; j < 3; ++j ) {
+            entries[i * 4 + j][slot] = columns[j][i];
+        }
+        entries[i * 4 + 3][slot] = translation[i];
+    }
+}
+
+static void allocate_entries( Arena& arena, real_t** entries, size_t num, size_t count )
+{
+    for ( size_t i = 0; i < num; ++i ) {
+        entries[i] = arena.allocate_array< real_t >( count );
+    }
+}
+
+CompiledScene::CompiledScene()
+    : count( 0 ), kinds( 0 ), slots( 0 )
+{
+    spheres.count = 0;
+    triangles.count = 0;
+    models.count = 0;
+}
+
+void CompiledScene::compile( const PreparedScene& prepared, MeshBVHCache& meshes, TextureStore& textures )
+{
+    Geometry* const* geometries = prepared.get_scene()->get_geometries();
+
+    arena.reset();
+    count = prepared.num_geometries();
+    kinds = arena.allocate_array< unsigned char >( count );
+    slots = arena.allocate_array< unsigned int >( count );
+
+    // bvh order first, then whatever the bvh left out
+    std::vector< unsigned int > order;
+    order.reserve( count );
+    const BVH& bvh = prepared.get_bvh();
+    order.insert( order.end(), bvh.get_indices(), bvh.get_indices() + bvh.num_indices() );
+    order.insert( order.end(), prepared.get_unbounded().begin(), prepared.get_unbounded().end() );
+    if ( order.size() != count ) {
+        std::vector< bool > placed( count, false );
+        for ( size_t i = 0; i < order.size(); ++i ) {
+            placed[order[i]] = true;
+        }
+        for ( size_t i = 0; i < count; ++i ) {
+            if ( !placed[i] ) {
+                order.push_back( (unsigned int) i );
+            }
+        }
+    }
+
+    spheres.count = triangles.count = models.count = 0;
+    for ( size_t i = 0; i < count; ++i ) {
+        const Geometry* geometry = geometries[i];
+        ShapeKind kind = SHAPE_OTHER;
+        if ( const Model* model = dynamic_cast< const Model* >( geometry ) ) {
+            if ( model->mesh ) {
+                kind = SHAPE_MODEL;
+                ++models.count;
+            }
+        } else if ( dynamic_cast< const Sphere* >( geometry ) ) {
+            kind = SHAPE_SPHERE;
+            ++spheres.count;
+        } else if ( dynamic_cast< const Triangle* >( geometry ) ) {
+            kind = SHAPE_TRIANGLE;
+            ++triangles.count;
+        }
+        kinds[i] = (unsigned char) kind;
+    }
+
+    spheres.geometry = arena.allocate_array< unsigned int >( spheres.count );
+    allocate_entries( arena, spheres.inverse, AFFINE_ENTRIES, spheres.count );
+    spheres.radius = arena.allocate_array< real_t >( spheres.count );
+
+    triangles.geometry = arena.allocate_array< unsigned int >( triangles.count );
+    allocate_entries( arena, triangles.inverse, AFFINE_ENTRIES, triangles.count );
+    allocate_entries( arena, triangles.p0, 3, triangles.count );
+    allocate_entries( arena, triangles.e1, 3, triangles.count );
+    allocate_entries( arena, triangles.e2, 3, triangles.count );
+
+    models.geometry = arena.allocate_array< unsigned int >( models.count );
+    models.bvh = arena.allocate_array< const MeshBVH* >( models.count );
+    models.material = arena.allocate_array< const Material* >( models.count );
+    models.texture = arena.allocate_array< const MipTexture* >( models.count );
+
+    size_t num_spheres = 0, num_triangles = 0, num_models = 0;
+    for ( size_t k = 0; k < order.size(); ++k ) {
+        unsigned int i = order[k];
+        const Geometry* geometry = geometries[i];
+        const Matrix4& inverse = prepared.get_transform( i ).inverse;
+
+        switch ( kinds[i] ) {
+        case SHAPE_SPHERE: {
+            size_t s = num_spheres++;
+            spheres.geometry[s] = i;
+            store_inverse( spheres.inverse, s, inverse );
+            spheres.radius[s] = static_cast< const Sphere* >( geometry )->radius;
+            slots[i] = (unsigned int) s;
+            break;
+        }
+        case SHAPE_TRIANGLE: {
+            size_t s = num_triangles++;
+            const Triangle* triangle = static_cast< const Triangle* >( geometry );
+            Vector3 p0 = triangle->vertices[0].position;
+            Vector3 e1 = triangle->vertices[1].position - p0;
+            Vector3 e2 = triangle->vertices[2].position - p0;
+            triangles.geometry[s] = i;
+            store_inverse( triangles.inverse, s, inverse );
+            for ( int j = 0; j < 3; ++j ) {
+                triangles.p0[j][s] = p0[j];
+                triangles.e1[j][s] = e1[j];
+                triangles.e2[j][s] = e2[j];
+            }
+            slots[i] = (unsigned int) s;
+            break;
+        }
+        case SHAPE_MODEL: {
+            size_t s = num_models++;
+            const Model* model = static_cast< const Model* >( geometry );
+            models.geometry[s] = i;
+            models.bvh[s] = meshes.prepare( model->mesh );
+            models.material[s] = model->material;
+            models.texture[s] = textures.prepare( model->material );
+            slots[i] = (unsigned int) s;
+            break;
+        }
+        default:
+            slots[i] = 0;
+            break;
+        }
+    }
+}
+
+size_t CompiledScene::run_length( const unsigned int* geometries, size_t num ) const
+{
+    unsigned char kind = kinds[geometries[0]];
+    if ( kind != SHAPE_SPHERE && kind != SHAPE_TRIANGLE )
+        return 1;
+
+    size_t first = slots[geometries[0]];
+    size_t length = 1;
+    while ( length < num && kinds[geometries[length]] == kind
+            && slots[geometries[length]] == first + length ) {
+        ++length;
+    }
+    return length;
+}
+
+} /* _462 */
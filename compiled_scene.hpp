@@ -0,0 +1,131 @@
+#ifndef _462_RAYTRACER_COMPILED_SCENE_HPP_
+#define _462_RAYTRACER_COMPILED_SCENE_HPP_
+
+#include "arena.hpp"
+#include "mesh_bvh.hpp"
+#include "texture.hpp"
+#include "math/vector.hpp"
+#include "scene/scene.hpp"
+
+namespace _462 {
+
+class PreparedScene;
+
+// the concrete geometry types the raytracer knows how to intersect itself
+enum ShapeKind
+{
+    SHAPE_OTHER,
+    SHAPE_SPHERE,
+    SHAPE_TRIANGLE,
+    SHAPE_MODEL
+};
+
+// entries of an affine world to local matrix; entry ( r, c ) of shape s is
+// inverse[r * 4 + c][s]
+static const size_t AFFINE_ENTRIES = 12;
+
+// every sphere, one array per field
+struct SphereArrays
+{
+    size_t count;
+    // the geometry each sphere is
+    unsigned int* geometry;
+    real_t* inverse[AFFINE_ENTRIES];
+    real_t* radius;
+};
+
+// every triangle, one array per field
+struct TriangleArrays
+{
+    size_t count;
+    unsigned int* geometry;
+    real_t* inverse[AFFINE_ENTRIES];
+    // corner and edges in local space, one array per coordinate
+    real_t* p0[3];
+    real_t* e1[3];
+    real_t* e2[3];
+};
+
+// every model with a mesh
+struct ModelArrays
+{
+    size_t count;
+    unsigned int* geometry;
+    const MeshBVH** bvh;
+    const Material** material;
+    // the material's texture, or null
+    const MipTexture** texture;
+};
+
+/**
+ * The scene laid out for the ray loops rather than for editing. Geometries
+ * are grouped by type, and each type is stored as a structure of arrays in
+ * one arena, so a kernel testing a run of spheres or triangles reads
+ * consecutive memory rather than chasing a pointer and a vtable per object.
+ *
+ * Geometries are placed in the order the scene bvh lists them, so the
+ * shapes of a leaf sit next to each other. Anything without a kernel of its
+ * own is only recorded as SHAPE_OTHER and goes through check_geometry.
+ */
+class CompiledScene
+{
+public:
+
+    CompiledScene();
+
+    // lays out every geometry of prepared's scene from scratch, using its
+    // transforms and bvh, and the mesh bvhs and textures in the stores given
+    void compile( const PreparedScene& prepared, MeshBVHCache& meshes, TextureStore& textures );
+
+    size_t num_geometries() const { return count; }
+
+    ShapeKind get_kind( size_t geometry ) const { return (ShapeKind) kinds[geometry]; }
+
+    // where a geometry sits within the arrays of its type
+    size_t get_slot( size_t geometry ) const { return slots[geometry]; }
+
+    const SphereArrays& get_spheres() const { return spheres; }
+    const TriangleArrays& get_triangles() const { return triangles; }
+
+    // the mesh bvh of a model geometry, or null for anything else
+    const MeshBVH* get_model_bvh( size_t geometry ) const
+    {
+        return get_kind( geometry ) == SHAPE_MODEL ? models.bvh[slots[geometry]] : 0;
+    }
+
+    const Material* get_model_material( size_t geometry ) const
+    {
+        return get_kind( geometry ) == SHAPE_MODEL ? models.material[slots[geometry]] : 0;
+    }
+
+    const MipTexture* get_model_texture( size_t geometry ) const
+    {
+        return get_kind( geometry ) == SHAPE_MODEL ? models.texture[slots[geometry]] : 0;
+    }
+
+    // how many of geometries, from the first, are spheres in consecutive
+    // slots or triangles in consecutive slots, so one batched kernel can
+    // test them all. 1 for anything else.
+    size_t run_length( const unsigned int* geometries, size_t num ) const;
+
+private:
+
+    // no meaningful copy
+    CompiledScene( const CompiledScene& );
+    CompiledScene& operator=( const CompiledScene& );
+
+    Arena arena;
+    size_t count;
+
+    // by geometry index
+    unsigned char* kinds;
+    unsigned int* slots;
+
+    SphereArrays spheres;
+    TriangleArrays triangles;
+    ModelArrays models;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_COMPILED_SCENE_HPP_ */
@@ -0,0 +1,590 @@
+#include "distributed.hpp"
+#include "asset_loader.hpp"
+#include "raytracer.hpp"
+#include "socket.hpp"
+#include "timer.hpp"
+#include "application/scene_loader.hpp"
+#include "scene/scene.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace _462 {
+
+// tiles handed out over the network. bigger than the raytracer's own, so
+// a tile's pixels outweigh its round trip and still split over a worker's
+// threads.
+static const size_t TILE_SIZE = 64;
+
+// tiles a worker holds at once: one to trace and one waiting, so it starts
+// the next as soon as it sends the last
+static const size_t TILES_IN_FLIGHT = 2;
+
+// how often the coordinator looks for dead workers when nothing arrives
+static const double POLL_SECONDS = 0.25;
+
+static const double DEFAULT_WORKER_TIMEOUT = 60;
+
+// anything longer is not a message from a worker or coordinator
+static const size_t MAX_MESSAGE_SIZE = 1 << 24;
+
+static const unsigned int PROTOCOL_MAGIC = 0x52343632; // "R462"
+static const unsigned int PROTOCOL_VERSION = 2;
+
+enum MessageType
+{
+    // worker to coordinator: magic, version, thread count
+    MESSAGE_HELLO = 1,
+    // coordinator to worker: width, height, depth, light budget, frame,
+    // exposure and the scene filename
+    MESSAGE_JOB,
+    // worker to coordinator: loaded, give me tiles
+    MESSAGE_READY,
+    // worker to coordinator: could not load the job, and why
+    MESSAGE_FAILED,
+    // coordinator to worker: the tile to trace
+    MESSAGE_TILE,
+    // worker to coordinator: a tile, then its rgba rows bottom up
+    MESSAGE_PIXELS,
+    // coordinator to worker: the frame is done
+    MESSAGE_DONE
+};
+
+// appends value as four big endian bytes
+static void put_u32( std::vector< unsigned char >& out, unsigned int value )
+{
+    out.push_back( (unsigned char) ( value >> 24 ) );
+    out.push_back( (unsigned char) ( value >> 16 ) );
+    out.push_back( (unsigned char) ( value >> 8 ) );
+    out.push_back( (unsigned char) value );
+}
+
+static unsigned int get_u32( const unsigned char* data )
+{
+    return (unsigned int) data[0] << 24 | (unsigned int) data[1] << 16
+        | (unsigned int) data[2] << 8 | (unsigned int) data[3];
+}
+
+// a length, then the bytes
+static void put_text( std::vector< unsigned char >& out, const std::string& text )
+{
+    put_u32( out, (unsigned int) text.size() );
+    out.insert( out.end(), text.begin(), text.end() );
+}
+
+// reals go as text, which every platform reads back the same
+static void put_real( std::vector< unsigned char >& out, real_t value )
+{
+    char text[32];
+    snprintf( text, sizeof text, "%.17g", (double) value );
+    put_text( out, text );
+}
+
+static void put_tile( std::vector< unsigned char >& out, const Tile& tile )
+{
+    put_u32( out, (unsigned int) tile.x0 );
+    put_u32( out, (unsigned int) tile.y0 );
+    put_u32( out, (unsigned int) tile.x1 );
+    put_u32( out, (unsigned int) tile.y1 );
+}
+
+// reads the fields of a payload in order. reading past the end gives
+// zeros and leaves the reader failed.
+class MessageReader
+{
+public:
+
+    MessageReader( const unsigned char* data, size_t size )
+        : data( data ), size( size ), offset( 0 ), failed( false ) { }
+
+    unsigned int u32()
+    {
+        if ( size - offset < 4 ) {
+            failed = true;
+            return 0;
+        }
+        offset += 4;
+        return get_u32( data + offset - 4 );
+    }
+
+    std::string text()
+    {
+        size_t length = u32();
+        if ( size - offset < length ) {
+            failed = true;
+            return std::string();
+        }
+        offset += length;
+        return std::string( (const char*) data + offset - length, length );
+    }
+
+    real_t real()
+    {
+        std::string word = text();
+        char* end;
+        real_t value = (real_t) strtod( word.c_str(), &end );
+        failed = failed || word.empty() || *end != '\0';
+        return value;
+    }
+
+    Tile tile()
+    {
+        Tile tile;
+        tile.x0 = u32();
+        tile.y0 = u32();
+        tile.x1 = u32();
+        tile.y1 = u32();
+        return tile;
+    }
+
+    // the bytes not read yet
+    const unsigned char* rest() const { return data + offset; }
+    size_t remaining() const { return size - offset; }
+
+    bool ok() const { return !failed; }
+
+private:
+
+    const unsigned char* data;
+    size_t size, offset;
+    bool failed;
+};
+
+// sends a message in one piece
+static bool send_message( Socket* socket, unsigned int type,
+                          const std::vector< unsigned char >& payload )
+{
+    std::vector< unsigned char > message;
+    message.reserve( 8 + payload.size() );
+    put_u32( message, type );
+    put_u32( message, (unsigned int) payload.size() );
+    message.insert( message.end(), payload.begin(), payload.end() );
+    return socket->send( &message[0], message.size() );
+}
+
+// blocks until a whole message is in
+static bool receive_message( Socket* socket, unsigned int* type,
+                             std::vector< unsigned char >* payload )
+{
+    unsigned char header[8];
+    if ( !socket->receive( header, sizeof header ) )
+        return false;
+
+    *type = get_u32( header );
+    size_t size = get_u32( header + 4 );
+    if ( size > MAX_MESSAGE_SIZE )
+        return false;
+
+    payload->resize( size );
+    return size == 0 || socket->receive( &( *payload )[0], size );
+}
+
+// whether a tile is a non-empty part of a width x height image
+static bool tile_fits( const Tile& tile, size_t width, size_t height )
+{
+    return tile.x0 < tile.x1 && tile.x1 <= width && tile.y0 < tile.y1 && tile.y1 <= height;
+}
+
+static bool same_tile( const Tile& a, const Tile& b )
+{
+    return a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1;
+}
+
+RenderCoordinator::Worker::Worker()
+    : socket( new Socket() ), ready( false ), last_heard( 0 ),
+      id( 0 ), num_threads( 0 ), tiles_done( 0 ) { }
+
+RenderCoordinator::Worker::~Worker()
+{
+    delete socket;
+}
+
+RenderCoordinator::RenderCoordinator()
+    : listener_socket( new Socket() ), listener( 0 ),
+      worker_timeout( DEFAULT_WORKER_TIMEOUT ), next_worker_id( 1 ),
+      job( 0 ), buffer( 0 ), tiles_across( 0 ), tiles_left( 0 ) { }
+
+RenderCoordinator::~RenderCoordinator()
+{
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+        delete workers[i];
+    }
+    delete listener_socket;
+}
+
+bool RenderCoordinator::listen( unsigned short port )
+{
+    return listener_socket->listen( port );
+}
+
+bool RenderCoordinator::render( const RenderJob& job, unsigned char* buffer )
+{
+    if ( !listener_socket->is_open() )
+        return false;
+
+    this->job = &job;
+    this->buffer = buffer;
+
+    // scanline order, so the image fills in from the bottom
+    pending.clear();
+    for ( size_t y = 0; y < job.height; y += TILE_SIZE ) {
+        for ( size_t x = 0; x < job.width; x += TILE_SIZE ) {
+            Tile tile = { x, y, std::min( x + TILE_SIZE, job.width ), std::min( y + TILE_SIZE, job.height ) };
+            pending.push_back( tile );
+        }
+    }
+    tiles_across = ( job.width + TILE_SIZE - 1 ) / TILE_SIZE;
+    tiles_left = pending.size();
+    done.assign( pending.size(), 0 );
+
+    // workers left over from an earlier frame were told it was done
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+        delete workers[i];
+    }
+    workers.clear();
+
+    double start = timer_seconds();
+    bool waiting = false;
+    std::vector< Socket* > sockets;
+    std::vector< unsigned char > readable;
+
+    while ( tiles_left > 0 ) {
+        for ( size_t i = workers.size(); i-- > 0; ) {
+            if ( !assign_tiles( workers[i] ) ) {
+                drop_worker( i, "connection lost" );
+            }
+        }
+
+        if ( workers.empty() && !waiting ) {
+            printf( "Waiting for workers (%u of %u tiles left)...\n",
+                    (unsigned int) tiles_left, (unsigned int) done.size() );
+        }
+        waiting = workers.empty();
+
+        sockets.clear();
+        sockets.push_back( listener_socket );
+        for ( size_t i = 0; i < workers.size(); ++i ) {
+            sockets.push_back( workers[i]->socket );
+        }
+        Socket::wait( sockets, POLL_SECONDS, &readable );
+
+        // newcomers go on the end, so the others keep their places
+        if ( readable[0] ) {
+            accept_worker();
+        }
+
+        double now = timer_seconds();
+        for ( size_t i = sockets.size() - 1; i-- > 0; ) {
+            Worker* worker = workers[i];
+            const char* problem = readable[i + 1] ? receive( worker ) : 0;
+            if ( problem ) {
+                drop_worker( i, problem );
+            } else if ( !worker->tiles.empty() && now - worker->last_heard > worker_timeout ) {
+                drop_worker( i, "timed out" );
+            }
+        }
+    }
+
+    std::vector< unsigned char > empty;
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+        // a worker that misses this finds out when the connection closes
+        send_message( workers[i]->socket, MESSAGE_DONE, empty );
+        printf( "Worker %u traced %u tiles\n", (unsigned int) workers[i]->id,
+                (unsigned int) workers[i]->tiles_done );
+        delete workers[i];
+    }
+    workers.clear();
+
+    printf( "Distributed: %u tiles traced in %.3fs\n", (unsigned int) done.size(),
+            timer_seconds() - start );
+
+    this->job = 0;
+    this->buffer = 0;
+    return true;
+}
+
+void RenderCoordinator::accept_worker()
+{
+    Worker* worker = new Worker();
+    if ( !listener_socket->accept( worker->socket ) ) {
+        delete worker;
+        return;
+    }
+
+    // nothing is sent until it says hello
+    worker->id = next_worker_id++;
+    worker->last_heard = timer_seconds();
+    workers.push_back( worker );
+}
+
+const char* RenderCoordinator::receive( Worker* worker )
+{
+    static const size_t CHUNK_SIZE = 1 << 16;
+
+    std::vector< unsigned char >& inbox = worker->inbox;
+    size_t old_size = inbox.size();
+    inbox.resize( old_size + CHUNK_SIZE );
+    long received = worker->socket->receive_some( &inbox[old_size], CHUNK_SIZE );
+    if ( received <= 0 )
+        return "connection lost";
+    inbox.resize( old_size + (size_t) received );
+    worker->last_heard = timer_seconds();
+
+    // act on every whole message, keeping the start of any partial one
+    size_t offset = 0;
+    while ( inbox.size() - offset >= 8 ) {
+        unsigned int type = get_u32( &inbox[offset] );
+        size_t size = get_u32( &inbox[offset + 4] );
+        if ( size > MAX_MESSAGE_SIZE )
+            return "sent garbage";
+        if ( inbox.size() - offset - 8 < size )
+            break;
+
+        const char* problem = handle_message( worker, type, &inbox[offset + 8], size );
+        if ( problem )
+            return problem;
+        offset += 8 + size;
+    }
+    inbox.erase( inbox.begin(), inbox.begin() + offset );
+    return 0;
+}
+
+const char* RenderCoordinator::handle_message( Worker* worker, unsigned int type,
+                                               const unsigned char* payload, size_t size )
+{
+    MessageReader reader( payload, size );
+
+    if ( type == MESSAGE_HELLO ) {
+        unsigned int magic = reader.u32();
+        unsigned int version = reader.u32();
+        worker->num_threads = reader.u32();
+        if ( !reader.ok() || magic != PROTOCOL_MAGIC )
+            return "is not a raytracer worker";
+        if ( version != PROTOCOL_VERSION )
+            return "speaks another protocol version";
+
+        std::vector< unsigned char > message;
+        put_u32( message, (unsigned int) job->width );
+        put_u32( message, (unsigned int) job->height );
+        put_u32( message, (unsigned int) job->max_depth );
+        put_u32( message, (unsigned int) job->light_budget );
+        put_u32( message, job->frame );
+        put_real( message, job->exposure );
+        put_text( message, job->scene_filename );
+        return send_message( worker->socket, MESSAGE_JOB, message ) ? 0 : "connection lost";
+    }
+
+    if ( type == MESSAGE_READY ) {
+        printf( "Worker %u ready with %u threads\n", (unsigned int) worker->id,
+                (unsigned int) worker->num_threads );
+        worker->ready = true;
+        return 0;
+    }
+
+    if ( type == MESSAGE_FAILED ) {
+        std::string reason = reader.text();
+        std::cout << "Worker " << worker->id << " failed: " << reason << "\n";
+        return "could not load the job";
+    }
+
+    if ( type == MESSAGE_PIXELS ) {
+        Tile tile = reader.tile();
+        std::deque< Tile >::iterator given = worker->tiles.begin();
+        while ( given != worker->tiles.end() && !same_tile( *given, tile ) ) {
+            ++given;
+        }
+        if ( !reader.ok() || given == worker->tiles.end() )
+            return "sent a tile it was not given";
+
+        size_t row_size = 4 * ( tile.x1 - tile.x0 );
+        if ( reader.remaining() != row_size * ( tile.y1 - tile.y0 ) )
+            return "sent a tile of the wrong size";
+
+        const unsigned char* pixels = reader.rest();
+        for ( size_t y = tile.y0; y < tile.y1; ++y, pixels += row_size ) {
+            memcpy( buffer + 4 * ( y * job->width + tile.x0 ), pixels, row_size );
+        }
+        worker->tiles.erase( given );
+        ++worker->tiles_done;
+
+        size_t index = tile.y0 / TILE_SIZE * tiles_across + tile.x0 / TILE_SIZE;
+        if ( !done[index] ) {
+            done[index] = 1;
+            --tiles_left;
+            if ( listener ) {
+                listener->region_done( buffer, job->width, job->height, tile );
+            }
+        }
+        return 0;
+    }
+
+    return "sent an unknown message";
+}
+
+bool RenderCoordinator::assign_tiles( Worker* worker )
+{
+    while ( worker->ready && worker->tiles.size() < TILES_IN_FLIGHT && !pending.empty() ) {
+        std::vector< unsigned char > message;
+        put_tile( message, pending.front() );
+        if ( !send_message( worker->socket, MESSAGE_TILE, message ) )
+            return false;
+
+        // a worker that was idle has been quiet for good reason
+        if ( worker->tiles.empty() ) {
+            worker->last_heard = timer_seconds();
+        }
+        worker->tiles.push_back( pending.front() );
+        pending.pop_front();
+    }
+    return true;
+}
+
+void RenderCoordinator::drop_worker( size_t index, const char* reason )
+{
+    Worker* worker = workers[index];
+    printf( "Worker %u %s, reassigning %u tiles\n", (unsigned int) worker->id, reason,
+            (unsigned int) worker->tiles.size() );
+
+    // its tiles are the oldest outstanding, so they go first
+    for ( size_t i = worker->tiles.size(); i-- > 0; ) {
+        pending.push_front( worker->tiles[i] );
+    }
+    delete worker;
+    workers.erase( workers.begin() + index );
+}
+
+RenderWorker::RenderWorker( Raytracer* raytracer ) : raytracer( raytracer ) { }
+
+// loads the job's scene and sets the raytracer up for it. returns why it
+// could not, or null.
+static const char* prepare_job( Raytracer* raytracer, const RenderJob& job,
+                                const std::string& cache_directory, Scene* scene )
+{
+    if ( !load_scene( scene, job.scene_filename.c_str() ) )
+        return "error loading scene";
+
+    AssetLoader loader( raytracer, raytracer->get_num_threads() );
+    loader.set_cache_directory( cache_directory );
+    if ( !loader.load( scene ) )
+        return "error loading meshes or textures";
+
+    scene->camera.aspect = real_t( job.width ) / real_t( job.height );
+
+    raytracer->set_progressive( false, 0, 0 );
+    raytracer->set_incremental( false );
+    raytracer->set_verbose( false );
+    raytracer->set_max_depth( job.max_depth );
+    raytracer->set_light_culling( job.light_budget >= 0,
+                                  job.light_budget > 0 ? job.light_budget : 0 );
+    raytracer->set_frame( job.frame );
+    raytracer->set_hdr( job.exposure > 0 );
+    if ( job.exposure > 0 ) {
+        raytracer->set_exposure( job.exposure );
+    }
+
+    if ( !raytracer->initialize( scene, job.width, job.height ) )
+        return "raytracer initialization failed";
+    return 0;
+}
+
+// says the worker is ready, then traces the tiles it is handed and sends
+// them back until the coordinator says the frame is done. returns false if
+// the connection fails first.
+static bool trace_tiles( Raytracer* raytracer, Socket* socket, const RenderJob& job, double start )
+{
+    std::vector< unsigned char > message;
+    unsigned int type;
+    std::vector< unsigned char > payload;
+
+    std::vector< unsigned char > buffer( 4 * job.width * job.height );
+    size_t num_tiles = 0;
+    bool ok = send_message( socket, MESSAGE_READY, message );
+
+    while ( ok && receive_message( socket, &type, &payload ) ) {
+        if ( type == MESSAGE_DONE ) {
+            printf( "Traced %u tiles in %.3fs\n", (unsigned int) num_tiles, timer_seconds() - start );
+            return true;
+        }
+
+        MessageReader tile_reader( payload.empty() ? 0 : &payload[0], payload.size() );
+        Tile tile = tile_reader.tile();
+        if ( type != MESSAGE_TILE || !tile_reader.ok() || !tile_fits( tile, job.width, job.height ) ) {
+            std::cout << "Malformed tile from the coordinator.\n";
+            return false;
+        }
+
+        raytracer->raytrace_region( &buffer[0], tile );
+        ++num_tiles;
+
+        message.clear();
+        put_tile( message, tile );
+        size_t row_size = 4 * ( tile.x1 - tile.x0 );
+        for ( size_t y = tile.y0; y < tile.y1; ++y ) {
+            const unsigned char* row = &buffer[4 * ( y * job.width + tile.x0 )];
+            message.insert( message.end(), row, row + row_size );
+        }
+        ok = send_message( socket, MESSAGE_PIXELS, message );
+    }
+
+    std::cout << "Lost the coordinator after " << num_tiles << " tiles.\n";
+    return false;
+}
+
+bool RenderWorker::run( const char* host, unsigned short port )
+{
+    Socket socket;
+    if ( !socket.connect( host, port ) ) {
+        std::cout << "Unable to connect to " << host << ":" << port << ".\n";
+        return false;
+    }
+
+    std::vector< unsigned char > message;
+    put_u32( message, PROTOCOL_MAGIC );
+    put_u32( message, PROTOCOL_VERSION );
+    put_u32( message, (unsigned int) raytracer->get_num_threads() );
+    unsigned int type;
+    std::vector< unsigned char > payload;
+    if ( !send_message( &socket, MESSAGE_HELLO, message )
+            || !receive_message( &socket, &type, &payload ) || type != MESSAGE_JOB ) {
+        std::cout << "No job from the coordinator.\n";
+        return false;
+    }
+
+    RenderJob job;
+    MessageReader reader( payload.empty() ? 0 : &payload[0], payload.size() );
+    job.width = reader.u32();
+    job.height = reader.u32();
+    job.max_depth = (int) reader.u32();
+    job.light_budget = (int) reader.u32();
+    job.frame = reader.u32();
+    job.exposure = reader.real();
+    job.scene_filename = reader.text();
+    if ( !reader.ok() || job.width < 1 || job.height < 1 ) {
+        std::cout << "Malformed job from the coordinator.\n";
+        return false;
+    }
+
+    double start = timer_seconds();
+    Scene scene;
+    const char* problem = prepare_job( raytracer, job, cache_directory, &scene );
+    message.clear();
+    if ( problem ) {
+        std::cout << "Unable to render " << job.scene_filename << ": " << problem << ".\n";
+        put_text( message, problem );
+        send_message( &socket, MESSAGE_FAILED, message );
+        raytracer->forget_scene( &scene );
+        return false;
+    }
+    printf( "Loaded '%s' in %.3fs, tracing %ux%u\n", job.scene_filename.c_str(),
+            timer_seconds() - start, (unsigned int) job.width, (unsigned int) job.height );
+
+    bool done = trace_tiles( raytracer, &socket, job, start );
+    // the scene is freed on return, and the raytracer may outlive it
+    raytracer->forget_scene( &scene );
+    return done;
+}
+
+} /* _462 */
@@ -0,0 +1,153 @@
+#ifndef _462_RAYTRACER_DISTRIBUTED_HPP_
+#define _462_RAYTRACER_DISTRIBUTED_HPP_
+
+#include "math/math.hpp"
+#include "tile_queue.hpp"
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace _462 {
+
+class Raytracer;
+class RegionListener;
+class Socket;
+
+// what every worker needs to trace its share of a frame the same way
+struct RenderJob
+{
+    // read by each worker itself, so it must name the same file on every
+    // machine: an absolute path on a shared filesystem, say
+    std::string scene_filename;
+    size_t width, height;
+    int max_depth;
+    // shadow rays per hit with light culling, 0 for no limit; -1 for off
+    int light_budget;
+    // the frame the workers' random numbers are keyed by
+    unsigned int frame;
+    // exposure of the float framebuffer tiles are tone mapped from; 0 for
+    // none
+    real_t exposure;
+};
+
+/**
+ * Renders a frame on worker processes, possibly on other machines, that
+ * connect to it over tcp. Each worker is sent the job, loads the scene
+ * itself, and then is handed tiles one after another and sends back their
+ * pixels. A worker always has a couple of tiles queued, so it never sits
+ * waiting on the network, and faster workers simply come back for more.
+ * A worker whose connection drops, or that says nothing for too long
+ * while it has tiles, is cut off and its tiles go to the others. Workers
+ * may join at any time; with none left, the coordinator waits for more.
+ *
+ * The wire format is a sequence of messages, each a 32 bit type and a 32
+ * bit payload length followed by the payload, with every integer big
+ * endian.
+ */
+class RenderCoordinator
+{
+public:
+
+    RenderCoordinator();
+
+    ~RenderCoordinator();
+
+    // starts accepting workers on port. returns false if it could not.
+    bool listen( unsigned short port );
+
+    // told about each tile as its pixels come in, or nobody if null
+    void set_region_listener( RegionListener* listener ) { this->listener = listener; }
+
+    // seconds a worker holding tiles may go without sending anything
+    // before it is given up on. defaults to a minute.
+    void set_worker_timeout( double seconds ) { worker_timeout = seconds; }
+
+    // renders job into buffer, a width x height rgba image, returning once
+    // every tile is in. returns false if it is not listening.
+    bool render( const RenderJob& job, unsigned char* buffer );
+
+private:
+
+    // a connected worker and what it is working on
+    struct Worker
+    {
+        Worker();
+        ~Worker();
+
+        Socket* socket;
+        // bytes received but not yet a whole message
+        std::vector< unsigned char > inbox;
+        // whether it has loaded the job and can take tiles
+        bool ready;
+        // tiles sent and not yet returned, oldest first
+        std::deque< Tile > tiles;
+        // when anything last arrived from it
+        double last_heard;
+        size_t id, num_threads, tiles_done;
+    };
+
+    void accept_worker();
+
+    // reads what has arrived from a worker and acts on every whole
+    // message. returns why the worker has to be dropped, or null.
+    const char* receive( Worker* worker );
+
+    const char* handle_message( Worker* worker, unsigned int type,
+                                const unsigned char* payload, size_t size );
+
+    // tops a ready worker's queue up from the pending tiles
+    bool assign_tiles( Worker* worker );
+
+    // cuts a worker off and puts its tiles back at the front of the queue
+    void drop_worker( size_t index, const char* reason );
+
+    // no meaningful copy
+    RenderCoordinator( const RenderCoordinator& );
+    RenderCoordinator& operator=( const RenderCoordinator& );
+
+    Socket* listener_socket;
+    RegionListener* listener;
+    double worker_timeout;
+    size_t next_worker_id;
+    std::vector< Worker* > workers;
+
+    // the frame being rendered
+    const RenderJob* job;
+    unsigned char* buffer;
+    // tiles nobody has, and whether each tile of the image is in yet
+    std::deque< Tile > pending;
+    std::vector< unsigned char > done;
+    size_t tiles_across, tiles_left;
+};
+
+/**
+ * The other end of a RenderCoordinator: connects to it, traces the tiles it
+ * is handed with a raytracer configured as the caller left it, and sends
+ * each one back, until the frame is done.
+ */
+class RenderWorker
+{
+public:
+
+    // traces with raytracer, whose threads, packet width and so on are the
+    // worker's own choice. the job decides everything that changes the
+    // image; progressive and incremental tracing are turned off.
+    explicit RenderWorker( Raytracer* raytracer );
+
+    // keeps compiled meshes in directory between runs
+    void set_cache_directory( const std::string& directory ) { cache_directory = directory; }
+
+    // works for the coordinator at host:port until the frame is done.
+    // returns false if it could not connect, could not load the scene, or
+    // the connection dropped part way.
+    bool run( const char* host, unsigned short port );
+
+private:
+
+    Raytracer* raytracer;
+    std::string cache_directory;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_DISTRIBUTED_HPP_ */
@@ -0,0 +1,65 @@
+#include "framebuffer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace _462 {
+
+void HDRFramebuffer::resize( size_t width, size_t height )
+{
+    this->width = width;
+    this->height = height;
+    pixels.assign( 3 * width * height, 0 );
+}
+
+bool HDRFramebuffer::save_pfm( const char* filename ) const
+{
+    FILE* file = fopen( filename, "wb" );
+    if ( !file )
+        return false;
+
+    // a negative scale marks the data little-endian
+    fprintf( file, "PF\n%u %u\n-1.0\n", (unsigned int) width, (unsigned int) height );
+    bool ok = true;
+    std::vector< float > row( 3 * width );
+    for ( size_t y = 0; ok && y < height; ++y ) {
+        const real_t* p = &pixels[3 * y * width];
+        for ( size_t i = 0; i < row.size(); ++i ) {
+            row[i] = (float) p[i];
+        }
+        ok = row.empty() || fwrite( &row[0], sizeof( float ), row.size(), file ) == row.size();
+    }
+    return fclose( file ) == 0 && ok;
+}
+
+// branch free so the loop vectorizes; at an exposure of 1 this is the
+// arithmetic of to_array
+static inline unsigned char quantise( real_t value, real_t exposure )
+{
+    real_t v = value * exposure;
+    v = std::min( std::max( v, (real_t) 0 ), (real_t) 1 );
+    return (unsigned char) ( v * 255 );
+}
+
+void tone_map( const real_t* hdr, size_t count, real_t exposure, unsigned char* rgba )
+{
+    for ( size_t i = 0; i < count; ++i ) {
+        rgba[4 * i + 0] = quantise( hdr[3 * i + 0], exposure );
+        rgba[4 * i + 1] = quantise( hdr[3 * i + 1], exposure );
+        rgba[4 * i + 2] = quantise( hdr[3 * i + 2], exposure );
+        rgba[4 * i + 3] = 255;
+    }
+}
+
+void tone_map_region( const HDRFramebuffer& hdr, const Tile& region, real_t exposure,
+                      unsigned char* rgba )
+{
+    size_t width = hdr.get_width();
+    const real_t* pixels = hdr.get_pixels();
+    for ( size_t y = region.y0; y < region.y1; ++y ) {
+        size_t first = y * width + region.x0;
+        tone_map( pixels + 3 * first, region.x1 - region.x0, exposure, rgba + 4 * first );
+    }
+}
+
+} /* _462 */
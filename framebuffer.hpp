@@ -0,0 +1,79 @@
+#ifndef _462_RAYTRACER_FRAMEBUFFER_HPP_
+#define _462_RAYTRACER_FRAMEBUFFER_HPP_
+
+#include "math/color.hpp"
+#include "tile_queue.hpp"
+#include <vector>
+
+namespace _462 {
+
+/**
+ * Unclamped rgb image, laid out like the rgba buffer with the bottom row
+ * first. Traced colors are kept here at full precision, so the image can be
+ * re-exposed and re-quantised without tracing it again, and at an exposure
+ * of 1 comes out exactly as if it had been quantised as it was traced.
+ */
+class HDRFramebuffer
+{
+public:
+
+    HDRFramebuffer() : width( 0 ), height( 0 ) { }
+
+    // resizes and clears to black
+    void resize( size_t width, size_t height );
+
+    void set( size_t x, size_t y, const Color3& color )
+    {
+        real_t* p = &pixels[3 * ( y * width + x )];
+        p[0] = color.r;
+        p[1] = color.g;
+        p[2] = color.b;
+    }
+
+    const real_t* get_pixels() const { return pixels.empty() ? 0 : &pixels[0]; }
+
+    size_t get_width() const { return width; }
+    size_t get_height() const { return height; }
+
+    // writes the image as a little-endian float pfm, rows bottom first as
+    // pfm expects. returns false on failure.
+    bool save_pfm( const char* filename ) const;
+
+private:
+
+    size_t width, height;
+    std::vector< real_t > pixels;
+};
+
+// quantises count rgb pixels into rgba bytes, scaling by exposure
+// and clamping to [0, 1] first. with an exposure of 1 the result matches
+// Color3::to_array.
+void tone_map( const real_t* hdr, size_t count, real_t exposure, unsigned char* rgba );
+
+// the same, for one region of a whole image
+void tone_map_region( const HDRFramebuffer& hdr, const Tile& region, real_t exposure,
+                      unsigned char* rgba );
+
+/**
+ * Where traced pixels go: straight into the rgba buffer, or into a float
+ * framebuffer that is tone mapped into the rgba buffer afterwards.
+ */
+struct FrameTarget
+{
+    unsigned char* rgba;
+    HDRFramebuffer* hdr;
+    size_t width;
+
+    void store( size_t x, size_t y, const Color3& color ) const
+    {
+        if ( hdr ) {
+            hdr->set( x, y, color );
+        } else {
+            color.to_array( &rgba[4 * ( y * width + x )] );
+        }
+    }
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_FRAMEBUFFER_HPP_ */
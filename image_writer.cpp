@@ -0,0 +1,125 @@
+#include "image_writer.hpp"
+#include "application/imageio.hpp"
+
+#include <SDL/SDL_mutex.h>
+#include <SDL/SDL_thread.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+namespace _462 {
+
+// images waiting to be saved before write blocks
+static const size_t MAX_QUEUED_IMAGES = 2;
+
+ImageWriter::ImageWriter()
+    : thread( 0 ), stopping( false ), failures( 0 )
+{
+    lock = SDL_CreateMutex();
+    changed = SDL_CreateCond();
+}
+
+ImageWriter::~ImageWriter()
+{
+    finish();
+    SDL_DestroyCond( changed );
+    SDL_DestroyMutex( lock );
+}
+
+void ImageWriter::write( const char* filename, const unsigned char* buffer, int width, int height )
+{
+    size_t size = 4 * (size_t) width * (size_t) height;
+
+    Job job;
+    job.filename = filename;
+    job.width = width;
+    job.height = height;
+    job.pixels = (unsigned char*) malloc( size );
+    if ( !job.pixels ) {
+        throw std::bad_alloc();
+    }
+    memcpy( job.pixels, buffer, size );
+
+    if ( !thread ) {
+        stopping = false;
+        thread = SDL_CreateThread( thread_main, this );
+    }
+
+    if ( !thread ) {
+        // no thread to hand it to, so save it here
+        if ( !imageio_save_image( job.filename.c_str(), job.pixels, width, height ) ) {
+            std::cout << "Error saving image to '" << job.filename << "'.\n";
+            ++failures;
+        }
+        free( job.pixels );
+        return;
+    }
+
+    SDL_LockMutex( lock );
+    while ( jobs.size() >= MAX_QUEUED_IMAGES ) {
+        SDL_CondWait( changed, lock );
+    }
+    jobs.push_back( job );
+    SDL_CondBroadcast( changed );
+    SDL_UnlockMutex( lock );
+}
+
+bool ImageWriter::finish()
+{
+    if ( thread ) {
+        SDL_LockMutex( lock );
+        stopping = true;
+        SDL_CondBroadcast( changed );
+        SDL_UnlockMutex( lock );
+
+        SDL_WaitThread( thread, 0 );
+        thread = 0;
+    }
+
+    bool ok = failures == 0;
+    failures = 0;
+    return ok;
+}
+
+int ImageWriter::thread_main( void* data )
+{
+    ( (ImageWriter*) data )->run();
+    return 0;
+}
+
+// saves queued images until told to stop and nothing is left
+void ImageWriter::run()
+{
+    SDL_LockMutex( lock );
+
+    while ( true ) {
+        while ( jobs.empty() && !stopping ) {
+            SDL_CondWait( changed, lock );
+        }
+        if ( jobs.empty() )
+            break;
+
+        Job job = jobs.front();
+        jobs.pop_front();
+        SDL_CondBroadcast( changed );
+        SDL_UnlockMutex( lock );
+
+        bool saved = imageio_save_image( job.filename.c_str(), job.pixels, job.width, job.height );
+        if ( saved ) {
+            std::cout << "Saved raytraced image to '" << job.filename << "'.\n";
+        } else {
+            std::cout << "Error saving raytraced image to '" << job.filename << "'.\n";
+        }
+        free( job.pixels );
+
+        SDL_LockMutex( lock );
+        if ( !saved ) {
+            ++failures;
+        }
+    }
+
+    SDL_UnlockMutex( lock );
+}
+
+} /* _462 */
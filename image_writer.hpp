@@ -0,0 +1,65 @@
+#ifndef _462_RAYTRACER_IMAGE_WRITER_HPP_
+#define _462_RAYTRACER_IMAGE_WRITER_HPP_
+
+#include <deque>
+#include <string>
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+namespace _462 {
+
+/**
+ * Saves images on a background thread, so encoding one frame overlaps
+ * tracing the next. Each image is copied when queued, leaving the caller
+ * free to reuse its buffer straight away.
+ */
+class ImageWriter
+{
+public:
+
+    ImageWriter();
+
+    // waits for anything still queued
+    ~ImageWriter();
+
+    // queues an rgba image to be saved. blocks while too many images are
+    // already waiting, so memory stays bounded when encoding is the
+    // bottleneck.
+    void write( const char* filename, const unsigned char* buffer, int width, int height );
+
+    // waits until every queued image is saved. returns false if any of
+    // them failed since the last call.
+    bool finish();
+
+private:
+
+    struct Job
+    {
+        std::string filename;
+        unsigned char* pixels;
+        int width, height;
+    };
+
+    static int thread_main( void* data );
+
+    void run();
+
+    // no meaningful copy
+    ImageWriter( const ImageWriter& );
+    ImageWriter& operator=( const ImageWriter& );
+
+    SDL_mutex* lock;
+    // signalled whenever a job is queued or taken, or the thread should stop
+    SDL_cond* changed;
+    SDL_Thread* thread;
+
+    std::deque< Job > jobs;
+    bool stopping;
+    size_t failures;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_IMAGE_WRITER_HPP_ */
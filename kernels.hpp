@@ -0,0 +1,146 @@
+#ifndef _462_RAYTRACER_KERNELS_HPP_
+#define _462_RAYTRACER_KERNELS_HPP_
+
+#include "compiled_scene.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace _462 {
+
+// shapes a batched kernel tests before picking among their hits
+static const size_t KERNEL_BATCH = 8;
+
+/**
+ * Intersection of one ray with the shapes of one type, straight from the
+ * compiled arrays. Each type specialises this with its arrays and
+ * intersect( arrays, slot, ray, tmin, tmax ), which returns the nearest
+ * hit at or after tmin and before tmax, or tmax on a miss. The tests
+ * match the packet kernels step for step, so both find the same hits.
+ */
+template< ShapeKind Kind >
+struct ShapeKernel;
+
+// moves a ray into the local space of the shape in slot
+inline void kernel_to_local( real_t* const* inverse, size_t slot, const RayInfo& ray,
+                             real_t* o, real_t* d )
+{
+    real_t m[AFFINE_ENTRIES];
+    for ( size_t k = 0; k < AFFINE_ENTRIES; ++k ) {
+        m[k] = inverse[k][slot];
+    }
+    for ( size_t i = 0; i < 3; ++i ) {
+        const real_t* row = m + 4 * i;
+        o[i] = row[0] * ray.origin.x + row[1] * ray.origin.y + row[2] * ray.origin.z + row[3];
+        d[i] = row[0] * ray.direction.x + row[1] * ray.direction.y + row[2] * ray.direction.z;
+    }
+}
+
+template<>
+struct ShapeKernel< SHAPE_SPHERE >
+{
+    typedef SphereArrays Arrays;
+
+    static const Arrays& arrays( const CompiledScene& compiled ) { return compiled.get_spheres(); }
+
+    static real_t intersect( const Arrays& spheres, size_t slot, const RayInfo& ray, real_t tmin, real_t tmax )
+    {
+        real_t o[3], d[3];
+        kernel_to_local( spheres.inverse, slot, ray, o, d );
+
+        real_t r2 = spheres.radius[slot] * spheres.radius[slot];
+        real_t a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        real_t b = o[0] * d[0] + o[1] * d[1] + o[2] * d[2];
+        real_t c = o[0] * o[0] + o[1] * o[1] + o[2] * o[2] - r2;
+        real_t disc = b * b - a * c;
+        real_t root = sqrt( std::max( disc, (real_t) 0 ) );
+        real_t t = ( -b - root ) / a;
+        real_t t_far = ( -b + root ) / a;
+        t = t < tmin ? t_far : t;
+        bool hit = ( disc >= 0 ) & ( t >= tmin ) & ( t < tmax );
+        return hit ? t : tmax;
+    }
+};
+
+template<>
+struct ShapeKernel< SHAPE_TRIANGLE >
+{
+    typedef TriangleArrays Arrays;
+
+    static const Arrays& arrays( const CompiledScene& compiled ) { return compiled.get_triangles(); }
+
+    static real_t intersect( const Arrays& triangles, size_t slot, const RayInfo& ray, real_t tmin, real_t tmax )
+    {
+        real_t o[3], d[3];
+        kernel_to_local( triangles.inverse, slot, ray, o, d );
+
+        real_t e1x = triangles.e1[0][slot], e1y = triangles.e1[1][slot], e1z = triangles.e1[2][slot];
+        real_t e2x = triangles.e2[0][slot], e2y = triangles.e2[1][slot], e2z = triangles.e2[2][slot];
+        real_t px = d[1] * e2z - d[2] * e2y;
+        real_t py = d[2] * e2x - d[0] * e2z;
+        real_t pz = d[0] * e2y - d[1] * e2x;
+        real_t det = e1x * px + e1y * py + e1z * pz;
+        real_t inv = 1 / det;
+        real_t sx = o[0] - triangles.p0[0][slot];
+        real_t sy = o[1] - triangles.p0[1][slot];
+        real_t sz = o[2] - triangles.p0[2][slot];
+        real_t u = ( sx * px + sy * py + sz * pz ) * inv;
+        real_t qx = sy * e1z - sz * e1y;
+        real_t qy = sz * e1x - sx * e1z;
+        real_t qz = sx * e1y - sy * e1x;
+        real_t v = ( d[0] * qx + d[1] * qy + d[2] * qz ) * inv;
+        real_t t = ( e2x * qx + e2y * qy + e2z * qz ) * inv;
+        bool hit = ( fabs( det ) >= 1e-12 ) & ( u >= 0 ) & ( u <= 1 )
+            & ( v >= 0 ) & ( u + v <= 1 ) & ( t >= tmin ) & ( t < tmax );
+        return hit ? t : tmax;
+    }
+};
+
+// the nearest hit among the shapes in slots [begin, end), before *tmax.
+// lowers *tmax to it and returns its slot, or end on a miss. shapes are
+// tested a batch at a time with no branches between them, so the compiler
+// can run the batch across simd lanes.
+template< ShapeKind Kind >
+inline size_t closest_in_run( const typename ShapeKernel< Kind >::Arrays& arrays, size_t begin, size_t end,
+                              const RayInfo& ray, real_t tmin, real_t* tmax )
+{
+    size_t best = end;
+    for ( size_t first = begin; first < end; first += KERNEL_BATCH ) {
+        size_t num = std::min( end - first, KERNEL_BATCH );
+        real_t t[KERNEL_BATCH];
+        for ( size_t i = 0; i < num; ++i ) {
+            t[i] = ShapeKernel< Kind >::intersect( arrays, first + i, ray, tmin, *tmax );
+        }
+        // strictly nearer only, so ties go to the first shape as they would
+        // one at a time
+        for ( size_t i = 0; i < num; ++i ) {
+            if ( t[i] < *tmax ) {
+                *tmax = t[i];
+                best = first + i;
+            }
+        }
+    }
+    return best;
+}
+
+// the first shape in slots [begin, end) hit between tmin and tmax, or end
+template< ShapeKind Kind >
+inline size_t any_in_run( const typename ShapeKernel< Kind >::Arrays& arrays, size_t begin, size_t end,
+                          const RayInfo& ray, real_t tmin, real_t tmax )
+{
+    for ( size_t first = begin; first < end; first += KERNEL_BATCH ) {
+        size_t num = std::min( end - first, KERNEL_BATCH );
+        real_t t[KERNEL_BATCH];
+        for ( size_t i = 0; i < num; ++i ) {
+            t[i] = ShapeKernel< Kind >::intersect( arrays, first + i, ray, tmin, tmax );
+        }
+        for ( size_t i = 0; i < num; ++i ) {
+            if ( t[i] < tmax )
+                return first + i;
+        }
+    }
+    return end;
+}
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_KERNELS_HPP_ */
@@ -0,0 +1,177 @@
+#include "light_tree.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace _462 {
+
+real_t light_attenuation( const PointLight& light, real_t distance )
+{
+    real_t falloff = light.attenuation.constant + light.attenuation.linear * distance
+        + light.attenuation.quadratic * distance * distance;
+    return falloff > 0 ? 1 / falloff : 1;
+}
+
+real_t light_influence_radius( const PointLight& light, real_t cutoff )
+{
+    real_t brightest = std::max( light.color.r, std::max( light.color.g, light.color.b ) );
+    if ( brightest <= 0 )
+        return 0;
+
+    real_t c = std::max( light.attenuation.constant, (real_t) 0 );
+    real_t l = std::max( light.attenuation.linear, (real_t) 0 );
+    real_t q = std::max( light.attenuation.quadratic, (real_t) 0 );
+    if ( l <= 0 && q <= 0 ) {
+        // no falloff; either always or never bright enough
+        return c > 0 && brightest / c < cutoff ? 0 : std::numeric_limits< real_t >::infinity();
+    }
+
+    // solve c + l * d + q * d^2 = brightest / cutoff for d
+    real_t k = brightest / cutoff - c;
+    if ( k <= 0 )
+        return 0;
+    if ( q <= 0 )
+        return k / l;
+    return ( -l + sqrt( l * l + 4 * q * k ) ) / ( 2 * q );
+}
+
+LightTree::LightTree()
+    : lights( 0 ), count( 0 ), built( false ) { }
+
+void LightTree::build( const PointLight* lights, size_t count, real_t cutoff )
+{
+    this->lights = lights;
+    this->count = count;
+    built = true;
+
+    radii.resize( count );
+    unbounded.clear();
+    std::vector< BoundingBox > bounds( count );
+    for ( size_t i = 0; i < count; ++i ) {
+        real_t radius = light_influence_radius( lights[i], cutoff );
+        radii[i] = radius;
+        if ( radius == std::numeric_limits< real_t >::infinity() ) {
+            unbounded.push_back( (unsigned int) i );
+        } else if ( radius > 0 ) {
+            Vector3 extent( radius, radius, radius );
+            bounds[i].include( lights[i].position - extent );
+            bounds[i].include( lights[i].position + extent );
+        }
+    }
+    bvh.build( count ? &bounds[0] : 0, count );
+}
+
+void LightTree::clear()
+{
+    lights = 0;
+    count = 0;
+    built = false;
+    radii.clear();
+    unbounded.clear();
+    bvh.clear();
+}
+
+void LightTree::gather( const Vector3& point, std::vector< LightChoice >& found ) const
+{
+    for ( size_t k = 0; k < unbounded.size(); ++k ) {
+        LightChoice choice = { unbounded[k], 1 };
+        found.push_back( choice );
+    }
+    if ( bvh.empty() )
+        return;
+
+    const BVHNode* nodes = bvh.get_nodes();
+    const unsigned int* indices = bvh.get_indices();
+    unsigned int stack[BVH_STACK_SIZE];
+    size_t top = 0;
+    unsigned int current = 0;
+
+    while ( true ) {
+        const BVHNode& node = nodes[current];
+        bool inside = true;
+        for ( int i = 0; i < 3; ++i ) {
+            inside = inside && point[i] >= node.lower[i] && point[i] <= node.upper[i];
+        }
+
+        if ( inside ) {
+            if ( node.count > 0 ) {
+                for ( unsigned int k = 0; k < node.count; ++k ) {
+                    unsigned int light = indices[node.offset + k];
+                    if ( squared_length( point - lights[light].position ) < radii[light] * radii[light] ) {
+                        LightChoice choice = { light, 1 };
+                        found.push_back( choice );
+                    }
+                }
+            } else {
+                stack[top++] = node.offset;
+                current = current + 1;
+                assert( top < BVH_STACK_SIZE );
+                continue;
+            }
+        }
+
+        if ( top == 0 )
+            break;
+        current = stack[--top];
+    }
+}
+
+size_t LightTree::choose( const Vector3& position, const Vector3& normal, size_t budget, real_t offset,
+                          std::vector< LightChoice >& candidates, std::vector< LightChoice >& choices ) const
+{
+    choices.clear();
+    candidates.clear();
+    gather( position, candidates );
+
+    // keep the lights in front, each weighted by what it would add to a
+    // white surface if unshadowed
+    size_t kept = 0;
+    real_t total = 0;
+    for ( size_t k = 0; k < candidates.size(); ++k ) {
+        const PointLight& light = lights[candidates[k].light];
+        Vector3 to_light = light.position - position;
+        real_t distance = length( to_light );
+        real_t facing = dot( normal, to_light ) / distance;
+        if ( !( facing > 0 ) )
+            continue;
+
+        LightChoice& candidate = candidates[kept++];
+        candidate.light = candidates[k].light;
+        candidate.weight = ( light.color.r + light.color.g + light.color.b )
+            * light_attenuation( light, distance ) * facing;
+        total += candidate.weight;
+    }
+    size_t behind = candidates.size() - kept;
+    candidates.resize( kept );
+
+    if ( budget == 0 || candidates.size() <= budget || !( total > 0 ) ) {
+        for ( size_t k = 0; k < candidates.size(); ++k ) {
+            LightChoice choice = { candidates[k].light, 1 };
+            choices.push_back( choice );
+        }
+        return behind;
+    }
+
+    // budget evenly spaced draws along the running sum of the estimates,
+    // from the random offset. a light is drawn about budget * estimate /
+    // total times, and never less often than that rounds down to.
+    real_t spacing = total / budget;
+    real_t next = offset * spacing;
+    real_t sum = 0;
+    for ( size_t k = 0; k < candidates.size() && next < total; ++k ) {
+        sum += candidates[k].weight;
+        size_t draws = 0;
+        while ( next < sum && draws < budget ) {
+            ++draws;
+            next += spacing;
+        }
+        if ( draws > 0 ) {
+            LightChoice choice = { candidates[k].light, draws * spacing / candidates[k].weight };
+            choices.push_back( choice );
+        }
+    }
+    return behind;
+}
+
+} /* _462 */
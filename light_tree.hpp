@@ -0,0 +1,77 @@
+#ifndef _462_RAYTRACER_LIGHT_TREE_HPP_
+#define _462_RAYTRACER_LIGHT_TREE_HPP_
+
+#include "bvh.hpp"
+#include "scene/scene.hpp"
+#include <vector>
+
+namespace _462 {
+
+// a light chosen to shade a hit, and what its contribution is scaled by
+struct LightChoice
+{
+    unsigned int light;
+    real_t weight;
+};
+
+// how much of a light is left at distance: 1 / ( constant + linear * d +
+// quadratic * d^2 ), or 1 if the terms describe no falloff at all
+real_t light_attenuation( const PointLight& light, real_t distance );
+
+// the distance past which a light's attenuated color is below cutoff in
+// every channel. infinite for a light that does not fall off, 0 for one
+// that is never bright enough.
+real_t light_influence_radius( const PointLight& light, real_t cutoff );
+
+/**
+ * Finds the lights that matter at a point. Each light reaches as far as its
+ * attenuation leaves it brighter than a cutoff, and a bvh over those
+ * spheres finds the ones containing a point without visiting the rest.
+ * Lights that never fall off are kept aside and always reach.
+ *
+ * When more lights reach a hit than it may fire shadow rays at, a fixed
+ * number are drawn in proportion to their estimated contribution, and each
+ * is weighted by the inverse of how likely it was to be drawn, so the sum
+ * is right on average however many lights there are.
+ */
+class LightTree
+{
+public:
+
+    LightTree();
+
+    // builds over the lights, which must outlive the tree
+    void build( const PointLight* lights, size_t count, real_t cutoff );
+
+    void clear();
+
+    bool is_built() const { return built; }
+
+    // appends every light reaching point to found, with a weight of 1
+    void gather( const Vector3& point, std::vector< LightChoice >& found ) const;
+
+    // fills choices with the lights to shade at a surface point: every
+    // light reaching it from in front of the surface or, with more of them
+    // than budget (0 for no limit), budget draws among them, placed by
+    // offset, a random number in [0, 1). candidates is scratch space.
+    // returns how many reaching lights were left out for being behind the
+    // surface.
+    size_t choose( const Vector3& position, const Vector3& normal, size_t budget, real_t offset,
+                   std::vector< LightChoice >& candidates, std::vector< LightChoice >& choices ) const;
+
+private:
+
+    const PointLight* lights;
+    size_t count;
+    bool built;
+
+    std::vector< real_t > radii;
+    // over the lights with a finite radius
+    BVH bvh;
+    // lights that reach everywhere
+    std::vector< unsigned int > unbounded;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_LIGHT_TREE_HPP_ */
@@ -5,10 +5,19 @@
 #include "application/scene_loader.hpp"
 #include "application/opengl.hpp"
 #include "scene/scene.hpp"
+#include "raytracer/asset_loader.hpp"
 #include "raytracer/raytracer.hpp"
+#include "raytracer/batch.hpp"
+#include "raytracer/checksum.hpp"
+#include "raytracer/distributed.hpp"
+#include "raytracer/preview.hpp"
+#include "raytracer/stream_writer.hpp"
 
 #include <iostream>
+#include <cstdio>
 #include <cstring>
+#include <string>
+#include <vector>
 
 namespace _462 {
 
@@ -19,6 +28,8 @@ namespace _462 {
 
 #define KEY_RAYTRACE SDLK_r
 #define KEY_SCREENSHOT SDLK_f
+#define KEY_EXPOSURE_UP SDLK_EQUALS
+#define KEY_EXPOSURE_DOWN SDLK_MINUS
 
 static const GLenum LightConstants[] = {
     GL_LIGHT0, GL_LIGHT1, GL_LIGHT2, GL_LIGHT3,
@@ -32,17 +43,79 @@ static void render_scene( const Scene& scene );
 struct Options
 {
     bool open_window;
+    // manifest of frames to render in batch mode, or null
+    const char* manifest_filename;
+    // port to hand out tiles to workers on, or 0
+    int coordinator_port;
+    // coordinator to work for, or null
+    const char* worker_host;
+    int worker_port;
     const char* input_filename;
     const char* output_filename;
     int width, height;
+    int num_threads;
+    int packet_width;
+    int max_depth;
+    bool wavefront;
+    // noise threshold and time budget of progressive rendering; a
+    // threshold of 0 renders one sample per pixel
+    float noise_threshold, time_budget;
+    // most samples a pixel gets when progressive, or 0 for the default
+    int max_samples;
+    // exposure of the float framebuffer; 0 leaves it off
+    float exposure;
+    // whether to profile the trace and save a cost heatmap
+    bool profiling;
+    // whether traces only redo what changed since the last one
+    bool incremental;
+    // whether to show a raytraced preview while roaming
+    bool preview;
+    // where compiled meshes are kept between runs, or null
+    const char* cache_directory;
+    // shadow rays per hit when culling faint lights, 0 for no limit; -1
+    // shades every light
+    int light_budget;
+    // per-tile checksums to check the image against, or to save if the
+    // file does not exist yet; null for neither
+    const char* checksum_filename;
 };
 
+// applies the options that decide how each pixel is traced, which are all
+// a raytraced preview honours
+static void configure_tracing( Raytracer* raytracer, const Options& options )
+{
+    raytracer->set_num_threads( options.num_threads );
+    raytracer->set_packet_width( options.packet_width );
+    raytracer->set_max_depth( options.max_depth );
+    raytracer->set_wavefront( options.wavefront );
+    raytracer->set_light_culling( options.light_budget >= 0,
+                                  options.light_budget > 0 ? options.light_budget : 0 );
+}
+
+// applies the tracing options that do not depend on the scene
+static void configure_raytracer( Raytracer* raytracer, const Options& options )
+{
+    configure_tracing( raytracer, options );
+    raytracer->set_progressive( options.noise_threshold > 0,
+                                options.noise_threshold, options.time_budget );
+    if ( options.max_samples > 0 ) {
+        raytracer->set_max_samples( options.max_samples );
+    }
+    raytracer->set_profiling( options.profiling );
+    raytracer->set_incremental( options.incremental );
+    raytracer->set_hdr( options.exposure > 0 );
+    if ( options.exposure > 0 ) {
+        raytracer->set_exposure( options.exposure );
+    }
+}
+
 class RaytracerApplication : public Application
 {
 public:
 
     RaytracerApplication( const Options& opt )
-        : options( opt ), buffer( 0 ), buf_width( 0 ), buf_height( 0 ), raytracing( false ) { }
+        : options( opt ), buffer( 0 ), buf_width( 0 ), buf_height( 0 ), raytracing( false ),
+          preview( &preview_tracer ) { }
     virtual ~RaytracerApplication() { free( buffer ); }
 
     virtual bool initialize();
@@ -55,6 +128,12 @@ public:
     void toggle_raytracing( int width, int height );
     // writes the current raytrace buffer to the output file
     void output_image();
+    // saves the profiled per-pixel trace cost next to the given image
+    void output_heatmap( const char* filename );
+    // rescales the exposure of a float framebuffer trace and requantises it
+    void change_exposure( real_t factor );
+    // traces the preview for the camera as it is now
+    void update_preview( real_t delta_time );
 
     Raytracer raytracer;
 
@@ -68,6 +147,12 @@ public:
     int buf_width, buf_height;
     bool raytracing;
     bool raytrace_finished;
+
+    // the raytraced view shown while roaming, if enabled, and the camera it
+    // was last traced from
+    Raytracer preview_tracer;
+    PreviewRenderer preview;
+    Camera preview_camera;
 };
 
 bool RaytracerApplication::initialize()
@@ -75,24 +160,37 @@ bool RaytracerApplication::initialize()
     camera_control.camera = scene.camera;
     bool load_gl = options.open_window;
 
+    if ( options.preview ) {
+        configure_tracing( &preview_tracer, options );
+    }
+
     try {
 
-        Material* const* materials = scene.get_materials();
-        Mesh* const* meshes = scene.get_meshes();
+        // load all textures and meshes, building mesh bvhs as they come in
+        AssetLoader loader( &raytracer, raytracer.get_num_threads() );
+        if ( options.cache_directory ) {
+            loader.set_cache_directory( options.cache_directory );
+        }
+        if ( !loader.load( &scene ) ) {
+            return false;
+        }
 
-        // load all textures
-        for ( size_t i = 0; i < scene.num_materials(); ++i ) {
-            if ( !materials[i]->load() || ( load_gl && !materials[i]->create_gl_data() ) ) {
-                std::cout << "Error loading texture, aborting.\n";
-                return false;
+        // gl data has to be made on this thread
+        if ( load_gl ) {
+            Material* const* materials = scene.get_materials();
+            for ( size_t i = 0; i < scene.num_materials(); ++i ) {
+                if ( !materials[i]->create_gl_data() ) {
+                    std::cout << "Error loading texture, aborting.\n";
+                    return false;
+                }
             }
-        }
 
-        // load all meshes
-        for ( size_t i = 0; i < scene.num_meshes(); ++i ) {
-            if ( !meshes[i]->load() || ( load_gl && !meshes[i]->create_gl_data() ) ) {
-                std::cout << "Error loading mesh, aborting.\n";
-                return false;
+            Mesh* const* meshes = scene.get_meshes();
+            for ( size_t i = 0; i < scene.num_meshes(); ++i ) {
+                if ( !meshes[i]->create_gl_data() ) {
+                    std::cout << "Error loading mesh, aborting.\n";
+                    return false;
+                }
             }
         }
 
@@ -151,9 +249,27 @@ void RaytracerApplication::update( real_t delta_time )
         // copy camera over from camera control (if not raytracing)
         camera_control.update( delta_time );
         scene.camera = camera_control.camera;
+
+        if ( options.preview ) {
+            update_preview( delta_time );
+        }
     }
 }
 
+void RaytracerApplication::update_preview( real_t delta_time )
+{
+    int width, height;
+    get_dimension( &width, &height );
+    scene.camera.aspect = real_t( width ) / real_t( height );
+
+    bool moving = !( scene.camera.position == preview_camera.position )
+        || !( scene.camera.orientation == preview_camera.orientation )
+        || scene.camera.aspect != preview_camera.aspect;
+    preview_camera = scene.camera;
+
+    preview.update( &scene, width, height, delta_time, moving );
+}
+
 void RaytracerApplication::render()
 {
     int width, height;
@@ -177,6 +293,16 @@ void RaytracerApplication::render()
         glRasterPos2f( -1.0f, -1.0f );
         glDrawPixels( buf_width, buf_height, GL_RGBA, GL_UNSIGNED_BYTE, &buffer[0] );
 
+    } else if ( options.preview && preview.get_image() ) {
+        // blown up to fill the window
+        GLfloat scale = (GLfloat) preview.get_scale();
+        glColor4d( 1.0, 1.0, 1.0, 1.0 );
+        glRasterPos2f( -1.0f, -1.0f );
+        glPixelZoom( scale, scale );
+        glDrawPixels( preview.get_image_width(), preview.get_image_height(),
+                      GL_RGBA, GL_UNSIGNED_BYTE, preview.get_image() );
+        glPixelZoom( 1.0f, 1.0f );
+
     } else {
         glPushAttrib( GL_ALL_ATTRIB_BITS );
         render_scene( scene );
@@ -204,6 +330,12 @@ void RaytracerApplication::handle_event( const SDL_Event& event )
         case KEY_SCREENSHOT:
             output_image();
             break;
+        case KEY_EXPOSURE_UP:
+            change_exposure( 1.25 );
+            break;
+        case KEY_EXPOSURE_DOWN:
+            change_exposure( 0.8 );
+            break;
         default:
             break;
         }
@@ -231,6 +363,7 @@ void RaytracerApplication::toggle_raytracing( int width, int height )
 
         scene.camera.aspect = real_t( width ) / real_t( height );
 
+        configure_raytracer( &raytracer, options );
         if ( !raytracer.initialize( &scene, width, height ) ) {
             std::cout << "Raytracer initialization failed.\n";
             return; 
@@ -267,6 +400,51 @@ void RaytracerApplication::output_image()
     } else {
         std::cout << "Error saving raytraced image to '" << filename << "'.\n";
     }
+
+    // the unclamped colors go next to it, for compositing
+    const HDRFramebuffer* hdr = raytracer.get_hdr();
+    if ( hdr ) {
+        std::string pfm_filename = std::string( filename ) + ".pfm";
+        if ( hdr->save_pfm( pfm_filename.c_str() ) ) {
+            std::cout << "Saved float image to '" << pfm_filename << "'.\n";
+        } else {
+            std::cout << "Error saving float image to '" << pfm_filename << "'.\n";
+        }
+    }
+
+    output_heatmap( filename );
+}
+
+void RaytracerApplication::output_heatmap( const char* filename )
+{
+    if ( !raytracer.is_profiling() )
+        return;
+
+    // image.png becomes image_heat.png
+    std::string heat_filename( filename );
+    size_t dot = heat_filename.rfind( '.' );
+    if ( dot == std::string::npos ) {
+        dot = heat_filename.size();
+    }
+    heat_filename.insert( dot, "_heat" );
+
+    std::vector< unsigned char > heatmap( 4 * buf_width * buf_height );
+    raytracer.make_heatmap( &heatmap[0] );
+    if ( imageio_save_image( heat_filename.c_str(), &heatmap[0], buf_width, buf_height ) ) {
+        std::cout << "Saved cost heatmap to '" << heat_filename << "'.\n";
+    } else {
+        std::cout << "Error saving cost heatmap to '" << heat_filename << "'.\n";
+    }
+}
+
+void RaytracerApplication::change_exposure( real_t factor )
+{
+    if ( !raytracing || !raytracer.get_hdr() )
+        return;
+
+    raytracer.set_exposure( raytracer.get_exposure() * factor );
+    raytracer.tone_map( buffer );
+    std::cout << "Exposure " << raytracer.get_exposure() << ".\n";
 }
 
 
@@ -354,6 +532,140 @@ static void render_scene( const Scene& scene )
 }
 
 } 
+static void print_usage( const char* progname )
+{
+    std::cout << "Usage: " << progname << " [-r] [options] input_scene [output_file]\n"
+              << "       " << progname << " -m manifest [options]\n"
+              << "       " << progname << " -D port [options] input_scene [output_file]\n"
+              << "       " << progname << " -W host port [options]\n"
+              << "\n"
+              << "  -r                  render without opening a window\n"
+              << "  -m manifest         render the frames a manifest lists, without a window\n"
+              << "  -D port             render on the workers that connect to port, without a\n"
+              << "                      window. they read input_scene themselves, so give a\n"
+              << "                      path that is the same for all of them\n"
+              << "  -W host port        trace tiles for the coordinator at host:port until its\n"
+              << "                      frame is done. its options decide the image; -t, -p\n"
+              << "                      and -w are the worker's own\n"
+              << "\n"
+              << "options, in this order:\n"
+              << "  -d width height     image size\n"
+              << "  -t threads          tracing threads\n"
+              << "  -p width            rays per packet: 1, 4, 8, 16, or 0 for the widest\n"
+              << "  -b bounces          reflection/refraction depth\n"
+              << "  -w                  trace in wavefronts\n"
+              << "  -s noise seconds    progressive rendering to a noise threshold or time budget\n"
+              << "  -n samples          most samples per pixel when progressive, 256 by default\n"
+              << "  -e exposure         keep a float framebuffer, tone mapped at this exposure;\n"
+              << "                      +/- re-expose it and screenshots also save a .pfm\n"
+              << "  -i                  profile the trace and save a cost heatmap with the image\n"
+              << "  -u                  retrace only what changed since the last trace\n"
+              << "  -v                  show a raytraced preview while moving the camera, traced\n"
+              << "                      with -t, -p, -b, -w and -l only\n"
+              << "  -c directory        keep compiled meshes in directory and reuse them\n"
+              << "  -l budget           skip lights too faint to matter after attenuation and\n"
+              << "                      shade at most budget of the rest per hit, 0 for all\n"
+              << "  -k file             with -r or -D, check the image tile by tile against the\n"
+              << "                      checksums in file, or save them there if it is absent\n";
+}
+
+// checksums a finished image, then saves the checksums to filename if there
+// are none yet, or else checks the image against them. returns false on a
+// mismatch or if the file cannot be read or written.
+static bool check_image( const char* filename, const unsigned char* buffer, int width, int height )
+{
+    ImageChecksum checksum;
+    checksum.compute( buffer, width, height );
+    printf( "Image checksum %016llx\n", checksum.total() );
+
+    FILE* existing = fopen( filename, "r" );
+    if ( !existing ) {
+        if ( !checksum.save( filename ) ) {
+            std::cout << "Error saving checksums to '" << filename << "'.\n";
+            return false;
+        }
+        std::cout << "Saved checksums to '" << filename << "'.\n";
+        return true;
+    }
+    fclose( existing );
+
+    ImageChecksum expected;
+    if ( !expected.load( filename ) ) {
+        std::cout << "Error reading checksums from '" << filename << "'.\n";
+        return false;
+    }
+    std::vector< Tile > differing;
+    if ( checksum.compare( expected, &differing ) ) {
+        std::cout << "Image matches the checksums in '" << filename << "'.\n";
+        return true;
+    }
+
+    printf( "Image differs from the checksums in '%s' in %u of %u tiles:\n",
+            filename, (unsigned int) differing.size(), (unsigned int) checksum.num_tiles() );
+    for ( size_t i = 0; i < differing.size(); ++i ) {
+        printf( "  %u,%u to %u,%u\n", (unsigned int) differing[i].x0, (unsigned int) differing[i].y0,
+                (unsigned int) differing[i].x1, (unsigned int) differing[i].y1 );
+    }
+    return false;
+}
+
+// renders the input scene on whatever workers connect, and saves it
+static bool run_coordinator( const Options& opt )
+{
+    // a scene that does not parse here would fail on every worker
+    Scene scene;
+    if ( !load_scene( &scene, opt.input_filename ) ) {
+        std::cout << "Error loading scene " << opt.input_filename << ". Aborting.\n";
+        return false;
+    }
+
+    RenderJob job;
+    job.scene_filename = opt.input_filename;
+    job.width = opt.width;
+    job.height = opt.height;
+    job.max_depth = opt.max_depth;
+    job.light_budget = opt.light_budget;
+    job.frame = 0;
+    job.exposure = opt.exposure;
+
+    RenderCoordinator coordinator;
+    if ( !coordinator.listen( (unsigned short) opt.coordinator_port ) ) {
+        std::cout << "Unable to listen on port " << opt.coordinator_port << ".\n";
+        return false;
+    }
+
+    // ppm output is written as tiles come in, as in -r
+    StreamingImageWriter stream;
+    const char* output = opt.output_filename;
+    size_t length = output ? strlen( output ) : 0;
+    bool streaming = length > 4 && strcmp( output + length - 4, ".ppm" ) == 0
+        && stream.open( output, opt.width, opt.height );
+    if ( streaming ) {
+        coordinator.set_region_listener( &stream );
+    }
+
+    std::vector< unsigned char > buffer( BUFFER_SIZE( opt.width, opt.height ) );
+    coordinator.render( job, &buffer[0] );
+
+    char name[256];
+    if ( !output ) {
+        imageio_gen_name( name, sizeof name );
+        output = name;
+    }
+    bool saved = streaming ? stream.finish()
+        : imageio_save_image( output, &buffer[0], opt.width, opt.height );
+    if ( saved ) {
+        std::cout << "Saved raytraced image to '" << output << "'.\n";
+    } else {
+        std::cout << "Error saving raytraced image to '" << output << "'.\n";
+    }
+    if ( opt.checksum_filename
+            && !check_image( opt.checksum_filename, &buffer[0], opt.width, opt.height ) ) {
+        return false;
+    }
+    return saved;
+}
+
 static bool parse_args( Options* opt, int argc, char* argv[] )
 {
     int input_index = 1;
@@ -363,19 +675,59 @@ static bool parse_args( Options* opt, int argc, char* argv[] )
         return false;
     }
 
+    opt->manifest_filename = 0;
+    opt->coordinator_port = 0;
+    opt->worker_host = 0;
+    opt->worker_port = 0;
+
     if ( strcmp( argv[1], "-r" ) == 0 ) {
         opt->open_window = false;
         ++input_index;
+    } else if ( strcmp( argv[1], "-m" ) == 0 ) {
+        if ( argc < 3 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+        opt->open_window = false;
+        opt->manifest_filename = argv[2];
+        input_index += 2;
+    } else if ( strcmp( argv[1], "-D" ) == 0 ) {
+        if ( argc < 3 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+        opt->open_window = false;
+        sscanf( argv[2], "%d", &opt->coordinator_port );
+        if ( opt->coordinator_port < 1 || opt->coordinator_port > 65535 ) {
+            std::cout << "Invalid port\n";
+            return false;
+        }
+        input_index += 2;
+    } else if ( strcmp( argv[1], "-W" ) == 0 ) {
+        if ( argc < 4 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+        opt->open_window = false;
+        opt->worker_host = argv[2];
+        sscanf( argv[3], "%d", &opt->worker_port );
+        if ( opt->worker_port < 1 || opt->worker_port > 65535 ) {
+            std::cout << "Invalid port\n";
+            return false;
+        }
+        input_index += 3;
     } else {
         opt->open_window = true;
     }
 
-    if ( argc <= input_index ) {
+    // only batches and workers get by without a scene
+    bool needs_input = !opt->manifest_filename && !opt->worker_host;
+    if ( argc <= input_index && needs_input ) {
         print_usage( argv[0] );
         return false;
     }
 
-    if ( strcmp( argv[input_index], "-d" ) == 0 ) {
+    if ( argc > input_index && strcmp( argv[input_index], "-d" ) == 0 ) {
         if ( argc <= input_index + 3 ) {
             print_usage( argv[0] );
             return false;
@@ -398,6 +750,209 @@ static bool parse_args( Options* opt, int argc, char* argv[] )
         opt->height = DEFAULT_HEIGHT;
     }
 
+    if ( argc > input_index && strcmp( argv[input_index], "-t" ) == 0 ) {
+        if ( argc <= input_index + 2 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+
+        // parse thread count
+        opt->num_threads = -1;
+        sscanf( argv[input_index + 1], "%d", &opt->num_threads );
+        if ( opt->num_threads < 1 ) {
+            std::cout << "Invalid thread count\n";
+            return false;
+        }
+
+        input_index += 2;
+    } else {
+        opt->num_threads = 1;
+    }
+
+    if ( argc > input_index && strcmp( argv[input_index], "-p" ) == 0 ) {
+        if ( argc <= input_index + 2 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+
+        // parse packet width, 0 meaning the widest the cpu supports
+        opt->packet_width = -1;
+        sscanf( argv[input_index + 1], "%d", &opt->packet_width );
+        if ( opt->packet_width < 0 ) {
+            std::cout << "Invalid packet width\n";
+            return false;
+        }
+
+        input_index += 2;
+    } else {
+        opt->packet_width = 1;
+    }
+
+    if ( argc > input_index && strcmp( argv[input_index], "-b" ) == 0 ) {
+        if ( argc <= input_index + 2 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+
+        // parse reflection/refraction bounce limit
+        opt->max_depth = -1;
+        sscanf( argv[input_index + 1], "%d", &opt->max_depth );
+        if ( opt->max_depth < 0 ) {
+            std::cout << "Invalid bounce limit\n";
+            return false;
+        }
+
+        input_index += 2;
+    } else {
+        opt->max_depth = MAXNUMBER;
+    }
+
+    // trace in wavefronts rather than pixel by pixel
+    if ( argc > input_index && strcmp( argv[input_index], "-w" ) == 0 ) {
+        opt->wavefront = true;
+        ++input_index;
+    } else {
+        opt->wavefront = false;
+    }
+
+    if ( argc > input_index && strcmp( argv[input_index], "-s" ) == 0 ) {
+        if ( argc <= input_index + 3 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+
+        // parse progressive noise threshold and time budget
+        opt->noise_threshold = -1;
+        opt->time_budget = -1;
+        sscanf( argv[input_index + 1], "%f", &opt->noise_threshold );
+        sscanf( argv[input_index + 2], "%f", &opt->time_budget );
+        if ( opt->noise_threshold <= 0 || opt->time_budget < 0 ) {
+            std::cout << "Invalid noise threshold or time budget\n";
+            return false;
+        }
+
+        input_index += 3;
+    } else {
+        opt->noise_threshold = 0;
+        opt->time_budget = 0;
+    }
+
+    if ( argc > input_index && strcmp( argv[input_index], "-n" ) == 0 ) {
+        if ( argc <= input_index + 1 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+
+        // parse the progressive sample cap
+        opt->max_samples = -1;
+        sscanf( argv[input_index + 1], "%d", &opt->max_samples );
+        if ( opt->max_samples < 1 ) {
+            std::cout << "Invalid sample count\n";
+            return false;
+        }
+
+        input_index += 2;
+    } else {
+        opt->max_samples = 0;
+    }
+
+    if ( argc > input_index && strcmp( argv[input_index], "-e" ) == 0 ) {
+        if ( argc <= input_index + 2 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+
+        // parse exposure of the float framebuffer
+        opt->exposure = -1;
+        sscanf( argv[input_index + 1], "%f", &opt->exposure );
+        if ( opt->exposure <= 0 ) {
+            std::cout << "Invalid exposure\n";
+            return false;
+        }
+
+        input_index += 2;
+    } else {
+        opt->exposure = 0;
+    }
+
+    // count tests and time pixels while tracing
+    if ( argc > input_index && strcmp( argv[input_index], "-i" ) == 0 ) {
+        opt->profiling = true;
+        ++input_index;
+    } else {
+        opt->profiling = false;
+    }
+
+    // keep what the last trace hit and redo only what changed
+    if ( argc > input_index && strcmp( argv[input_index], "-u" ) == 0 ) {
+        opt->incremental = true;
+        ++input_index;
+    } else {
+        opt->incremental = false;
+    }
+
+    // raytrace while roaming instead of drawing with opengl
+    if ( argc > input_index && strcmp( argv[input_index], "-v" ) == 0 ) {
+        opt->preview = true;
+        ++input_index;
+    } else {
+        opt->preview = false;
+    }
+
+    // reuse meshes compiled by earlier runs
+    if ( argc > input_index && strcmp( argv[input_index], "-c" ) == 0 ) {
+        if ( argc <= input_index + 1 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+        opt->cache_directory = argv[input_index + 1];
+        input_index += 2;
+    } else {
+        opt->cache_directory = 0;
+    }
+
+    // cull lights by attenuation, sampling the rest past a budget
+    if ( argc > input_index && strcmp( argv[input_index], "-l" ) == 0 ) {
+        if ( argc <= input_index + 1 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+
+        opt->light_budget = -1;
+        sscanf( argv[input_index + 1], "%d", &opt->light_budget );
+        if ( opt->light_budget < 0 ) {
+            std::cout << "Invalid light budget\n";
+            return false;
+        }
+
+        input_index += 2;
+    } else {
+        opt->light_budget = -1;
+    }
+
+    // checksum the image, to check traces reproduce it exactly
+    if ( argc > input_index && strcmp( argv[input_index], "-k" ) == 0 ) {
+        if ( argc <= input_index + 1 ) {
+            print_usage( argv[0] );
+            return false;
+        }
+        opt->checksum_filename = argv[input_index + 1];
+        input_index += 2;
+    } else {
+        opt->checksum_filename = 0;
+    }
+
+    if ( !needs_input ) {
+        // the manifest or the coordinator names the scenes and outputs
+        opt->input_filename = 0;
+        opt->output_filename = 0;
+        if ( argc > input_index ) {
+            std::cout << "Too many arguments.\n";
+            return false;
+        }
+        return true;
+    }
+
     opt->input_filename = argv[input_index];
 
     if ( argc > input_index + 1 ) {
@@ -428,6 +983,30 @@ int main( int argc, char* argv[] )
         return 1;
     }
 
+    if ( opt.manifest_filename ) {
+        Raytracer raytracer;
+        configure_raytracer( &raytracer, opt );
+        BatchRenderer batch( &raytracer, opt.width, opt.height );
+        if ( opt.cache_directory ) {
+            batch.set_cache_directory( opt.cache_directory );
+        }
+        return batch.run( opt.manifest_filename ) ? 0 : 1;
+    }
+
+    if ( opt.worker_host ) {
+        Raytracer raytracer;
+        configure_raytracer( &raytracer, opt );
+        RenderWorker worker( &raytracer );
+        if ( opt.cache_directory ) {
+            worker.set_cache_directory( opt.cache_directory );
+        }
+        return worker.run( opt.worker_host, (unsigned short) opt.worker_port ) ? 0 : 1;
+    }
+
+    if ( opt.coordinator_port ) {
+        return run_coordinator( opt ) ? 0 : 1;
+    }
+
     RaytracerApplication app( opt );
 
     // load the given scene
@@ -451,10 +1030,34 @@ int main( int argc, char* argv[] )
             return 1; 
         }
         assert( app.buffer );
+
+        // ppm output is written as the trace goes, everything else at the end
+        StreamingImageWriter stream;
+        const char* output = opt.output_filename;
+        size_t length = output ? strlen( output ) : 0;
+        bool streaming = length > 4 && strcmp( output + length - 4, ".ppm" ) == 0
+            && stream.open( output, opt.width, opt.height );
+        if ( streaming ) {
+            app.raytracer.set_region_listener( &stream );
+        }
+
         // raytrace until done
         app.raytracer.raytrace( app.buffer, 0 );
+
         // output result
-        app.output_image();
+        if ( !streaming ) {
+            app.output_image();
+        } else if ( stream.finish() ) {
+            std::cout << "Saved raytraced image to '" << output << "'.\n";
+            app.output_heatmap( output );
+        } else {
+            std::cout << "Error saving raytraced image to '" << output << "'.\n";
+            return 1;
+        }
+        if ( opt.checksum_filename
+                && !check_image( opt.checksum_filename, app.buffer, opt.width, opt.height ) ) {
+            return 1;
+        }
         return 0;
 
     }
@@ -0,0 +1,82 @@
+#include "mapped_file.hpp"
+
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace _462 {
+
+MappedFile::MappedFile()
+    : contents( 0 ), length( 0 ), mapped( false ) { }
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open( const char* filename )
+{
+    close();
+
+#ifndef _WIN32
+    int fd = ::open( filename, O_RDONLY );
+    if ( fd < 0 )
+        return false;
+
+    struct stat info;
+    if ( fstat( fd, &info ) == 0 && info.st_size > 0 ) {
+        void* address = mmap( 0, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( address != MAP_FAILED ) {
+            // parsers read front to back
+            madvise( address, (size_t) info.st_size, MADV_SEQUENTIAL );
+            contents = (const char*) address;
+            length = (size_t) info.st_size;
+            mapped = true;
+        }
+    }
+    ::close( fd );
+    if ( mapped )
+        return true;
+#endif
+
+    // empty, or not something we can map
+    FILE* file = fopen( filename, "rb" );
+    if ( !file )
+        return false;
+
+    char chunk[64 * 1024];
+    size_t read;
+    while ( ( read = fread( chunk, 1, sizeof chunk, file ) ) > 0 ) {
+        buffer.insert( buffer.end(), chunk, chunk + read );
+    }
+    bool ok = !ferror( file );
+    fclose( file );
+    if ( !ok ) {
+        buffer.clear();
+        return false;
+    }
+
+    contents = buffer.empty() ? 0 : &buffer[0];
+    length = buffer.size();
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+    if ( mapped ) {
+        munmap( (void*) contents, length );
+    }
+#endif
+    contents = 0;
+    length = 0;
+    mapped = false;
+    std::vector< char >().swap( buffer );
+}
+
+} /* _462 */
@@ -0,0 +1,47 @@
+#ifndef _462_RAYTRACER_MAPPED_FILE_HPP_
+#define _462_RAYTRACER_MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <vector>
+
+namespace _462 {
+
+/**
+ * A whole file mapped read only into memory, so a parser can walk it in
+ * place without copying it through stdio buffers first. Pages are read in
+ * by the os as they are touched. Where mapping is unavailable, the file is
+ * read into a buffer instead and nothing else changes.
+ */
+class MappedFile
+{
+public:
+
+    MappedFile();
+
+    ~MappedFile();
+
+    // maps the file, closing whatever was open. returns false if it could
+    // not be opened.
+    bool open( const char* filename );
+
+    void close();
+
+    const char* data() const { return contents; }
+    size_t size() const { return length; }
+
+private:
+
+    // no meaningful copy
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+
+    const char* contents;
+    size_t length;
+    // whether contents is a mapping rather than buffer's storage
+    bool mapped;
+    std::vector< char > buffer;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_MAPPED_FILE_HPP_ */
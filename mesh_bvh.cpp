@@ -0,0 +1,279 @@
+#include "mesh_bvh.hpp"
+#include "mapped_file.hpp"
+#include "scene/mesh.hpp"
+#include "scene/material.hpp"
+
+#include <cmath>
+
+namespace _462 {
+
+MeshBVH::MeshBVH()
+    : mesh( 0 ), source( 0 ), num_vertices( 0 ), num_triangles( 0 ),
+      triangle_data( 0 ), scale_data( 0 ), backing( 0 ) { }
+
+MeshBVH::~MeshBVH()
+{
+    delete backing;
+}
+
+void MeshBVH::build( const Mesh* mesh )
+{
+    delete backing;
+    backing = 0;
+
+    this->mesh = mesh;
+    num_vertices = mesh->num_vertices();
+    num_triangles = mesh->num_triangles();
+    source = num_vertices ? mesh->get_vertices() : 0;
+
+    const MeshVertex* vertices = num_vertices ? mesh->get_vertices() : 0;
+    const MeshTriangle* tris = num_triangles ? mesh->get_triangles() : 0;
+
+    triangles.resize( num_triangles );
+    tex_scales.resize( num_triangles );
+    std::vector< BoundingBox > bounds( num_triangles );
+
+    for ( size_t i = 0; i < num_triangles; ++i ) {
+        const Vector3& a = vertices[tris[i].vertices[0]].position;
+        const Vector3& b = vertices[tris[i].vertices[1]].position;
+        const Vector3& c = vertices[tris[i].vertices[2]].position;
+        triangles[i].p0 = a;
+        triangles[i].e1 = b - a;
+        triangles[i].e2 = c - a;
+        bounds[i].include( a );
+        bounds[i].include( b );
+        bounds[i].include( c );
+        bounds[i].pad();
+
+        const Vector2& ta = vertices[tris[i].vertices[0]].tex_coord;
+        const Vector2& tb = vertices[tris[i].vertices[1]].tex_coord;
+        const Vector2& tc = vertices[tris[i].vertices[2]].tex_coord;
+        real_t tex_area = fabs( ( tb.x - ta.x ) * ( tc.y - ta.y ) - ( tc.x - ta.x ) * ( tb.y - ta.y ) );
+        real_t area = length( cross( triangles[i].e1, triangles[i].e2 ) );
+        tex_scales[i] = area > 0 ? sqrt( tex_area / area ) : 0;
+    }
+
+    bvh.build( num_triangles ? &bounds[0] : 0, num_triangles );
+    triangle_data = num_triangles ? &triangles[0] : 0;
+    scale_data = num_triangles ? &tex_scales[0] : 0;
+}
+
+void MeshBVH::view( const Mesh* mesh, MappedFile* backing, const TriangleEdges* edges,
+                    const real_t* scales, const BVH& tree )
+{
+    if ( this->backing != backing ) {
+        delete this->backing;
+        this->backing = backing;
+    }
+
+    this->mesh = mesh;
+    num_vertices = mesh->num_vertices();
+    num_triangles = mesh->num_triangles();
+    source = num_vertices ? mesh->get_vertices() : 0;
+
+    std::vector< TriangleEdges >().swap( triangles );
+    std::vector< real_t >().swap( tex_scales );
+    triangle_data = num_triangles ? edges : 0;
+    scale_data = num_triangles ? scales : 0;
+    bvh = tree;
+}
+
+bool MeshBVH::is_built_from( const Mesh* mesh ) const
+{
+    return this->mesh == mesh
+        && num_vertices == mesh->num_vertices()
+        && num_triangles == mesh->num_triangles()
+        && source == ( num_vertices ? (const void*) mesh->get_vertices() : 0 );
+}
+
+bool intersect_triangle( const MeshBVH::TriangleEdges& tri, const RayInfo& ray,
+                         real_t t0, real_t t1, real_t* t, real_t* beta, real_t* gamma )
+{
+    Vector3 p = cross( ray.direction, tri.e2 );
+    real_t det = dot( tri.e1, p );
+    if ( fabs( det ) < 1e-12 )
+        return false;
+
+    real_t inv = 1 / det;
+    Vector3 s = ray.origin - tri.p0;
+    real_t u = dot( s, p ) * inv;
+    if ( u < 0 || u > 1 )
+        return false;
+
+    Vector3 q = cross( s, tri.e1 );
+    real_t v = dot( ray.direction, q ) * inv;
+    if ( v < 0 || u + v > 1 )
+        return false;
+
+    real_t tt = dot( tri.e2, q ) * inv;
+    if ( tt < t0 || tt >= t1 )
+        return false;
+
+    *t = tt;
+    *beta = u;
+    *gamma = v;
+    return true;
+}
+
+namespace {
+
+// bvh intersector keeping the nearest triangle
+struct TriangleClosestTest
+{
+    const MeshBVH::TriangleEdges* triangles;
+    const RayInfo* ray;
+    real_t t0;
+    MeshHit* hit;
+
+    real_t limit() const { return hit->t; }
+
+    bool operator()( const unsigned int* leaf, unsigned int count )
+    {
+        bool found = false;
+        for ( unsigned int k = 0; k < count; ++k ) {
+            unsigned int i = leaf[k];
+            real_t t, beta, gamma;
+            if ( intersect_triangle( triangles[i], *ray, t0, hit->t, &t, &beta, &gamma ) ) {
+                hit->t = t;
+                hit->triangle = i;
+                hit->beta = beta;
+                hit->gamma = gamma;
+                found = true;
+            }
+        }
+        return found;
+    }
+};
+
+// bvh intersector stopping at any triangle
+struct TriangleAnyTest
+{
+    const MeshBVH::TriangleEdges* triangles;
+    const RayInfo* ray;
+    real_t t0, t1;
+
+    real_t limit() const { return t1; }
+
+    bool operator()( const unsigned int* leaf, unsigned int count )
+    {
+        for ( unsigned int k = 0; k < count; ++k ) {
+            real_t t, beta, gamma;
+            if ( intersect_triangle( triangles[leaf[k]], *ray, t0, t1, &t, &beta, &gamma ) )
+                return true;
+        }
+        return false;
+    }
+};
+
+}
+
+bool MeshBVH::closest_hit( const RayInfo& ray, real_t t0, real_t t1, MeshHit* hit ) const
+{
+    if ( !triangle_data )
+        return false;
+
+    TriangleClosestTest test;
+    test.triangles = triangle_data;
+    test.ray = &ray;
+    test.t0 = t0;
+    test.hit = hit;
+    hit->t = t1;
+
+    return bvh.closest_hit( BVHRay( ray.origin, ray.direction ), t0, test );
+}
+
+bool MeshBVH::any_hit( const RayInfo& ray, real_t t0, real_t t1 ) const
+{
+    if ( !triangle_data )
+        return false;
+
+    TriangleAnyTest test;
+    test.triangles = triangle_data;
+    test.ray = &ray;
+    test.t0 = t0;
+    test.t1 = t1;
+
+    return bvh.any_hit( BVHRay( ray.origin, ray.direction ), t0, test );
+}
+
+void MeshBVH::fill_intersection( const RayInfo& ray, const MeshHit& hit,
+                                 const Material* material, IntersectionInfo& intersection ) const
+{
+    const MeshVertex* vertices = mesh->get_vertices();
+    const MeshTriangle& tri = mesh->get_triangles()[hit.triangle];
+    real_t alpha = 1 - hit.beta - hit.gamma;
+
+    intersection.t1 = hit.t;
+    intersection.localposition = ray.origin + hit.t * ray.direction;
+    intersection.localnormal = normalize(
+        alpha * vertices[tri.vertices[0]].normal
+        + hit.beta * vertices[tri.vertices[1]].normal
+        + hit.gamma * vertices[tri.vertices[2]].normal );
+    intersection.material.ambient = material->ambient;
+    intersection.material.diffuse = material->diffuse;
+    intersection.material.specular = material->specular;
+    intersection.material.refractive_index = material->refractive_index;
+}
+
+Vector2 MeshBVH::tex_coord( const MeshHit& hit ) const
+{
+    const MeshVertex* vertices = mesh->get_vertices();
+    const MeshTriangle& tri = mesh->get_triangles()[hit.triangle];
+    real_t alpha = 1 - hit.beta - hit.gamma;
+    const Vector2& a = vertices[tri.vertices[0]].tex_coord;
+    const Vector2& b = vertices[tri.vertices[1]].tex_coord;
+    const Vector2& c = vertices[tri.vertices[2]].tex_coord;
+    return Vector2( alpha * a.x + hit.beta * b.x + hit.gamma * c.x,
+                    alpha * a.y + hit.beta * b.y + hit.gamma * c.y );
+}
+
+MeshBVHCache::~MeshBVHCache()
+{
+    clear();
+}
+
+const MeshBVH* MeshBVHCache::prepare( const Mesh* mesh )
+{
+    MeshBVH*& bvh = bvhs[mesh];
+    if ( !bvh ) {
+        bvh = new MeshBVH();
+    }
+    if ( !bvh->is_built_from( mesh ) ) {
+        bvh->build( mesh );
+    }
+    return bvh;
+}
+
+const MeshBVH* MeshBVHCache::find( const Mesh* mesh ) const
+{
+    MeshBVHMap::const_iterator it = bvhs.find( mesh );
+    return it == bvhs.end() ? 0 : it->second;
+}
+
+void MeshBVHCache::adopt( MeshBVH* bvh )
+{
+    MeshBVH*& slot = bvhs[bvh->get_mesh()];
+    if ( slot != bvh ) {
+        delete slot;
+        slot = bvh;
+    }
+}
+
+void MeshBVHCache::forget( const Mesh* mesh )
+{
+    MeshBVHMap::iterator it = bvhs.find( mesh );
+    if ( it != bvhs.end() ) {
+        delete it->second;
+        bvhs.erase( it );
+    }
+}
+
+void MeshBVHCache::clear()
+{
+    for ( MeshBVHMap::iterator it = bvhs.begin(); it != bvhs.end(); ++it ) {
+        delete it->second;
+    }
+    bvhs.clear();
+}
+
+} /* _462 */
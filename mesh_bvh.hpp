@@ -0,0 +1,144 @@
+#ifndef _462_RAYTRACER_MESH_BVH_HPP_
+#define _462_RAYTRACER_MESH_BVH_HPP_
+
+#include "bvh.hpp"
+#include "scene/scene.hpp"
+#include <map>
+#include <vector>
+
+namespace _462 {
+
+class Mesh;
+class Material;
+class MappedFile;
+
+// where a ray hit a mesh, in the mesh's local space
+struct MeshHit
+{
+    real_t t;
+    unsigned int triangle;
+    // barycentric weights of the second and third vertex
+    real_t beta, gamma;
+};
+
+/**
+ * Bottom-level bvh over the triangles of one mesh. Traversal happens in the
+ * mesh's local space, so every model instancing the mesh shares it.
+ */
+class MeshBVH
+{
+public:
+
+    MeshBVH();
+
+    ~MeshBVH();
+
+    // a triangle stored as a corner and two edges, ready for testing
+    struct TriangleEdges
+    {
+        Vector3 p0, e1, e2;
+    };
+
+    void build( const Mesh* mesh );
+
+    // makes this a read only view of data built from mesh earlier and
+    // stored elsewhere: the edges and texture scales of every triangle, and
+    // a tree viewing its nodes. takes ownership of backing, the file they
+    // are mapped from.
+    void view( const Mesh* mesh, MappedFile* backing, const TriangleEdges* edges,
+               const real_t* scales, const BVH& tree );
+
+    // whether this was built from the mesh's current data
+    bool is_built_from( const Mesh* mesh ) const;
+
+    // nearest triangle hit within [t0, t1). returns false on a miss.
+    bool closest_hit( const RayInfo& ray, real_t t0, real_t t1, MeshHit* hit ) const;
+
+    // whether any triangle is hit within [t0, t1)
+    bool any_hit( const RayInfo& ray, real_t t0, real_t t1 ) const;
+
+    // fills in the intersection the way a model's check_geometry would
+    void fill_intersection( const RayInfo& ray, const MeshHit& hit,
+                            const Material* material, IntersectionInfo& intersection ) const;
+
+    // the texture coordinates at a hit
+    Vector2 tex_coord( const MeshHit& hit ) const;
+
+    // texture units per local unit across a triangle: the square root of
+    // its area in texture space over its area in local space
+    real_t get_tex_scale( unsigned int triangle ) const { return scale_data[triangle]; }
+
+    const Mesh* get_mesh() const { return mesh; }
+
+    // what was built, for saving
+    size_t get_num_triangles() const { return num_triangles; }
+    const TriangleEdges* get_triangle_edges() const { return triangle_data; }
+    const real_t* get_tex_scales() const { return scale_data; }
+    const BVH& get_bvh() const { return bvh; }
+
+private:
+
+    // no meaningful copy
+    MeshBVH( const MeshBVH& );
+    MeshBVH& operator=( const MeshBVH& );
+
+    const Mesh* mesh;
+    const void* source;
+    size_t num_vertices, num_triangles;
+
+    BVH bvh;
+    std::vector< TriangleEdges > triangles;
+    std::vector< real_t > tex_scales;
+
+    // what queries read: the vectors above, or a view into backing
+    const TriangleEdges* triangle_data;
+    const real_t* scale_data;
+    MappedFile* backing;
+};
+
+// tests a ray against one prepared triangle, Moller-Trumbore style
+bool intersect_triangle( const MeshBVH::TriangleEdges& tri, const RayInfo& ray,
+                         real_t t0, real_t t1, real_t* t, real_t* beta, real_t* gamma );
+
+/**
+ * The bvhs of every mesh the raytracer has seen, keyed by mesh, so that
+ * models sharing a mesh share its bvh.
+ */
+class MeshBVHCache
+{
+public:
+
+    MeshBVHCache() { }
+
+    ~MeshBVHCache();
+
+    // builds the mesh's bvh if it is missing or out of date
+    const MeshBVH* prepare( const Mesh* mesh );
+
+    // the mesh's bvh, or null if it has not been prepared
+    const MeshBVH* find( const Mesh* mesh ) const;
+
+    // takes ownership of a bvh built elsewhere, replacing any its mesh had
+    void adopt( MeshBVH* bvh );
+
+    // drops the mesh's bvh, if it has one. bvhs are found by the mesh's
+    // address, so a mesh must be forgotten before it is freed, or one
+    // allocated in its place later could be handed its bvh.
+    void forget( const Mesh* mesh );
+
+    void clear();
+
+private:
+
+    // no meaningful copy
+    MeshBVHCache( const MeshBVHCache& );
+    MeshBVHCache& operator=( const MeshBVHCache& );
+
+    typedef std::map< const Mesh*, MeshBVH* > MeshBVHMap;
+    MeshBVHMap bvhs;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_MESH_BVH_HPP_ */
+
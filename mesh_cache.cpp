@@ -0,0 +1,272 @@
+#include "mesh_cache.hpp"
+#include "mapped_file.hpp"
+#include "mesh_bvh.hpp"
+#include "scene/mesh.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace _462 {
+
+static const char MESH_CACHE_MAGIC[8] = { '4', '6', '2', 'M', 'E', 'S', 'H', '\0' };
+
+// bump whenever the layout, or how anything stored is built, changes
+static const unsigned int MESH_CACHE_VERSION = 1;
+
+// every section starts on a cache line
+static const size_t SECTION_ALIGNMENT = 64;
+
+enum MeshCacheSection
+{
+    SECTION_VERTICES,
+    SECTION_TRIANGLES,
+    SECTION_EDGES,
+    SECTION_SCALES,
+    SECTION_NODES,
+    SECTION_INDICES,
+    NUM_SECTIONS
+};
+
+struct MeshCacheHeader
+{
+    char magic[8];
+    unsigned int version;
+    // bytes per element of each section, as this build lays them out
+    unsigned int layout[NUM_SECTIONS];
+    unsigned int has_tcoords, has_normals;
+    unsigned long long source_hash;
+    unsigned long long source_size;
+    unsigned long long count[NUM_SECTIONS];
+    unsigned long long offset[NUM_SECTIONS];
+};
+
+static void fill_layout( unsigned int* layout )
+{
+    layout[SECTION_VERTICES] = sizeof( MeshVertex );
+    layout[SECTION_TRIANGLES] = sizeof( MeshTriangle );
+    layout[SECTION_EDGES] = sizeof( MeshBVH::TriangleEdges );
+    layout[SECTION_SCALES] = sizeof( real_t );
+    layout[SECTION_NODES] = sizeof( BVHNode );
+    layout[SECTION_INDICES] = sizeof( unsigned int );
+}
+
+static size_t align_section( size_t offset )
+{
+    return ( offset + SECTION_ALIGNMENT - 1 ) & ~( SECTION_ALIGNMENT - 1 );
+}
+
+static int process_id()
+{
+#ifdef _WIN32
+    return _getpid();
+#else
+    return (int) getpid();
+#endif
+}
+
+unsigned long long fnv_hash( const void* data, size_t size, unsigned long long hash )
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    for ( size_t i = 0; i < size; ++i ) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+MeshCache::MeshCache( const std::string& directory )
+    : directory( directory ) { }
+
+std::string MeshCache::filename_for( unsigned long long hash ) const
+{
+    char name[32];
+    sprintf( name, "%016llx.mesh", hash );
+    if ( directory.empty() )
+        return name;
+    char last = directory[directory.size() - 1];
+    return last == '/' || last == '\\' ? directory + name : directory + "/" + name;
+}
+
+// whether the header belongs to this build and a source of this hash, and
+// every section lies within the file
+static bool check_header( const MeshCacheHeader& header, unsigned long long hash,
+                          size_t source_size, size_t file_size )
+{
+    unsigned int layout[NUM_SECTIONS];
+    fill_layout( layout );
+    if ( memcmp( header.magic, MESH_CACHE_MAGIC, sizeof MESH_CACHE_MAGIC ) != 0
+         || header.version != MESH_CACHE_VERSION
+         || memcmp( header.layout, layout, sizeof layout ) != 0
+         || header.source_hash != hash || header.source_size != source_size )
+        return false;
+
+    for ( int i = 0; i < NUM_SECTIONS; ++i ) {
+        unsigned long long offset = header.offset[i];
+        if ( offset % SECTION_ALIGNMENT != 0 || offset > file_size
+             || header.count[i] > ( file_size - offset ) / layout[i] )
+            return false;
+    }
+
+    unsigned long long num_triangles = header.count[SECTION_TRIANGLES];
+    return header.count[SECTION_EDGES] == num_triangles
+        && header.count[SECTION_SCALES] == num_triangles
+        && header.count[SECTION_INDICES] <= num_triangles;
+}
+
+// whether every index in the mesh and tree points inside it, and the tree
+// is shallow enough for the traversal stack, so a damaged file cannot send
+// a ray outside its arrays
+static bool check_indices( const MeshTriangle* triangles, size_t num_triangles, size_t num_vertices,
+                           const BVHNode* nodes, size_t num_nodes,
+                           const unsigned int* indices, size_t num_indices )
+{
+    for ( size_t i = 0; i < num_triangles; ++i ) {
+        for ( int j = 0; j < 3; ++j ) {
+            if ( triangles[i].vertices[j] >= num_vertices )
+                return false;
+        }
+    }
+    for ( size_t i = 0; i < num_indices; ++i ) {
+        if ( indices[i] >= num_triangles )
+            return false;
+    }
+    // children come after their parents, so a node's depth is final by the
+    // time it is reached. traversal stacks one entry per interior node on
+    // the way down.
+    std::vector< size_t > depths( num_nodes, 0 );
+    for ( size_t i = 0; i < num_nodes; ++i ) {
+        const BVHNode& node = nodes[i];
+        if ( node.count > 0 ) {
+            if ( node.offset + (size_t) node.count > num_indices )
+                return false;
+            continue;
+        }
+        if ( node.offset <= i || node.offset >= num_nodes || i + 1 >= num_nodes
+                || depths[i] + 1 >= BVH_STACK_SIZE )
+            return false;
+        depths[i + 1] = std::max( depths[i + 1], depths[i] + 1 );
+        depths[node.offset] = std::max( depths[node.offset], depths[i] + 1 );
+    }
+    return true;
+}
+
+MeshBVH* MeshCache::load( unsigned long long hash, size_t source_size, Mesh* mesh ) const
+{
+    MappedFile* file = new MappedFile();
+    MeshCacheHeader header;
+    if ( !file->open( filename_for( hash ).c_str() ) || file->size() < sizeof header ) {
+        delete file;
+        return 0;
+    }
+
+    memcpy( &header, file->data(), sizeof header );
+    if ( !check_header( header, hash, source_size, file->size() ) ) {
+        delete file;
+        return 0;
+    }
+
+    const char* data = file->data();
+    const MeshVertex* vertices = (const MeshVertex*) ( data + header.offset[SECTION_VERTICES] );
+    const MeshTriangle* triangles = (const MeshTriangle*) ( data + header.offset[SECTION_TRIANGLES] );
+    const BVHNode* nodes = (const BVHNode*) ( data + header.offset[SECTION_NODES] );
+    const unsigned int* indices = (const unsigned int*) ( data + header.offset[SECTION_INDICES] );
+    size_t num_vertices = (size_t) header.count[SECTION_VERTICES];
+    size_t num_triangles = (size_t) header.count[SECTION_TRIANGLES];
+    size_t num_nodes = (size_t) header.count[SECTION_NODES];
+    size_t num_indices = (size_t) header.count[SECTION_INDICES];
+
+    if ( !check_indices( triangles, num_triangles, num_vertices, nodes, num_nodes, indices, num_indices ) ) {
+        delete file;
+        return 0;
+    }
+
+    mesh->vertices.assign( vertices, vertices + num_vertices );
+    mesh->triangles.assign( triangles, triangles + num_triangles );
+    mesh->has_tcoords = header.has_tcoords != 0;
+    mesh->has_normals = header.has_normals != 0;
+
+    BVH tree;
+    tree.view( nodes, num_nodes, indices, num_indices );
+    MeshBVH* bvh = new MeshBVH();
+    bvh->view( mesh, file,
+               (const MeshBVH::TriangleEdges*) ( data + header.offset[SECTION_EDGES] ),
+               (const real_t*) ( data + header.offset[SECTION_SCALES] ), tree );
+    return bvh;
+}
+
+bool MeshCache::save( unsigned long long hash, size_t source_size, const Mesh* mesh, const MeshBVH* bvh ) const
+{
+    const BVH& tree = bvh->get_bvh();
+    const void* sections[NUM_SECTIONS] = {
+        mesh->num_vertices() ? mesh->get_vertices() : 0,
+        mesh->num_triangles() ? mesh->get_triangles() : 0,
+        bvh->get_triangle_edges(),
+        bvh->get_tex_scales(),
+        tree.get_nodes(),
+        tree.get_indices()
+    };
+
+    MeshCacheHeader header;
+    memset( &header, 0, sizeof header );
+    memcpy( header.magic, MESH_CACHE_MAGIC, sizeof MESH_CACHE_MAGIC );
+    header.version = MESH_CACHE_VERSION;
+    fill_layout( header.layout );
+    header.has_tcoords = mesh->has_tcoords;
+    header.has_normals = mesh->has_normals;
+    header.source_hash = hash;
+    header.source_size = source_size;
+    header.count[SECTION_VERTICES] = mesh->num_vertices();
+    header.count[SECTION_TRIANGLES] = mesh->num_triangles();
+    header.count[SECTION_EDGES] = bvh->get_num_triangles();
+    header.count[SECTION_SCALES] = bvh->get_num_triangles();
+    header.count[SECTION_NODES] = tree.num_nodes();
+    header.count[SECTION_INDICES] = tree.num_indices();
+
+    size_t end = sizeof header;
+    for ( int i = 0; i < NUM_SECTIONS; ++i ) {
+        header.offset[i] = align_section( end );
+        end = (size_t) ( header.offset[i] + header.count[i] * header.layout[i] );
+    }
+
+    std::string filename = filename_for( hash );
+    char suffix[32];
+    sprintf( suffix, ".%d.tmp", process_id() );
+    std::string temporary = filename + suffix;
+
+    FILE* file = fopen( temporary.c_str(), "wb" );
+    if ( !file )
+        return false;
+
+    static const char padding[SECTION_ALIGNMENT] = { 0 };
+    bool ok = fwrite( &header, sizeof header, 1, file ) == 1;
+    size_t written = sizeof header;
+    for ( int i = 0; ok && i < NUM_SECTIONS; ++i ) {
+        size_t pad = (size_t) header.offset[i] - written;
+        size_t bytes = (size_t) ( header.count[i] * header.layout[i] );
+        ok = fwrite( padding, 1, pad, file ) == pad
+            && ( bytes == 0 || fwrite( sections[i], 1, bytes, file ) == bytes );
+        written += pad + bytes;
+    }
+    ok = fclose( file ) == 0 && ok;
+
+    // whoever renames last wins, and both wrote the same thing. some
+    // systems will not rename over an existing file.
+    if ( ok && rename( temporary.c_str(), filename.c_str() ) != 0 ) {
+        remove( filename.c_str() );
+        ok = rename( temporary.c_str(), filename.c_str() ) == 0;
+    }
+    if ( !ok ) {
+        remove( temporary.c_str() );
+    }
+    return ok;
+}
+
+} /* _462 */
@@ -0,0 +1,58 @@
+#ifndef _462_RAYTRACER_MESH_CACHE_HPP_
+#define _462_RAYTRACER_MESH_CACHE_HPP_
+
+#include <cstddef>
+#include <string>
+
+namespace _462 {
+
+class Mesh;
+class MeshBVH;
+
+// starting value of a 64 bit fnv-1a hash
+static const unsigned long long FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+// 64 bit fnv-1a hash of size bytes, continuing from hash
+unsigned long long fnv_hash( const void* data, size_t size, unsigned long long hash = FNV_OFFSET_BASIS );
+
+/**
+ * Compiled meshes kept on disk between runs, one file per mesh named by a
+ * hash of the source file's contents, so an edited source simply misses.
+ * Each file holds the mesh's vertices and triangles along with everything
+ * the raytracer builds from them: triangle edges, texture scales and the
+ * bvh. Sections are aligned so that, once the file is mapped, the bvh and
+ * triangle data are used where they lie rather than copied out; only the
+ * vertices and triangles are copied, into the mesh itself.
+ *
+ * Files carry a version and the sizes of everything stored, so one written
+ * by a different build of the raytracer is ignored rather than misread.
+ * Writes go to a temporary file renamed into place, so several processes
+ * may share a directory.
+ */
+class MeshCache
+{
+public:
+
+    // files live in directory, which must already exist
+    explicit MeshCache( const std::string& directory );
+
+    // where the compiled form of a source with this hash is kept
+    std::string filename_for( unsigned long long hash ) const;
+
+    // fills mesh from the entry for a source of this hash and size, and
+    // returns a bvh viewing the mapped entry, or null if there is no
+    // usable entry
+    MeshBVH* load( unsigned long long hash, size_t source_size, Mesh* mesh ) const;
+
+    // stores mesh and the bvh built from it as the entry for a source of
+    // this hash and size. returns false if it could not be written.
+    bool save( unsigned long long hash, size_t source_size, const Mesh* mesh, const MeshBVH* bvh ) const;
+
+private:
+
+    std::string directory;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_MESH_CACHE_HPP_ */
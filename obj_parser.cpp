@@ -0,0 +1,288 @@
+#include "obj_parser.hpp"
+#include "scene/mesh.hpp"
+
+#include <cstdlib>
+#include <vector>
+
+namespace _462 {
+
+// longest number we will parse
+static const size_t MAX_TOKEN = 63;
+
+// the indices one corner of a face refers to, -1 where absent
+struct Corner
+{
+    int position, tex_coord, normal;
+
+    bool operator==( const Corner& other ) const
+    {
+        return position == other.position && tex_coord == other.tex_coord && normal == other.normal;
+    }
+};
+
+/**
+ * Maps each distinct corner to the mesh vertex made for it, by open
+ * addressing into a power of two table that is never more than half full.
+ */
+class CornerTable
+{
+public:
+
+    CornerTable() : slots( 64, -1 ) { }
+
+    // the vertex for corner, or -1 with it added as vertex next if new
+    int find_or_add( const Corner& corner, int next )
+    {
+        if ( 2 * ( corners.size() + 1 ) > slots.size() ) {
+            grow();
+        }
+        size_t slot = find( corner );
+        if ( slots[slot] >= 0 )
+            return slots[slot];
+        slots[slot] = next;
+        corners.push_back( corner );
+        return -1;
+    }
+
+private:
+
+    static size_t hash( const Corner& corner )
+    {
+        return (size_t) corner.position * 73856093u ^ (size_t) corner.tex_coord * 19349663u
+            ^ (size_t) corner.normal * 83492791u;
+    }
+
+    size_t find( const Corner& corner ) const
+    {
+        size_t mask = slots.size() - 1;
+        size_t slot = hash( corner ) & mask;
+        while ( slots[slot] >= 0 && !( corners[slots[slot]] == corner ) ) {
+            slot = ( slot + 1 ) & mask;
+        }
+        return slot;
+    }
+
+    void grow()
+    {
+        slots.assign( slots.size() * 2, -1 );
+        for ( size_t i = 0; i < corners.size(); ++i ) {
+            slots[find( corners[i] )] = (int) i;
+        }
+    }
+
+    // vertex index in each slot, -1 if empty
+    std::vector< int > slots;
+    // by vertex index
+    std::vector< Corner > corners;
+};
+
+static bool is_space( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void skip_spaces( const char*& p, const char* end )
+{
+    while ( p < end && is_space( *p ) ) {
+        ++p;
+    }
+}
+
+// moves p past the end of the line
+static void skip_line( const char*& p, const char* end )
+{
+    while ( p < end && *p != '\n' ) {
+        ++p;
+    }
+    if ( p < end ) {
+        ++p;
+    }
+}
+
+// whether p is at the end of the line, ignoring trailing spaces
+static bool at_line_end( const char*& p, const char* end )
+{
+    skip_spaces( p, end );
+    return p == end || *p == '\n' || *p == '#';
+}
+
+// reads the next number on the line. the file is not null terminated, so
+// each number is copied out before strtod sees it.
+static bool parse_real( const char*& p, const char* end, real_t* value )
+{
+    skip_spaces( p, end );
+    char token[MAX_TOKEN + 1];
+    size_t length = 0;
+    while ( p < end && !is_space( *p ) && *p != '\n' ) {
+        if ( length == MAX_TOKEN )
+            return false;
+        token[length++] = *p++;
+    }
+    if ( length == 0 )
+        return false;
+    token[length] = '\0';
+
+    char* parsed;
+    *value = (real_t) strtod( token, &parsed );
+    return parsed == token + length;
+}
+
+// reads a one-based or negative relative index into a list of count items
+// and turns it into a zero-based one
+static bool parse_index( const char*& p, const char* end, size_t count, int* index )
+{
+    bool negative = p < end && *p == '-';
+    if ( negative ) {
+        ++p;
+    }
+    if ( p == end || *p < '0' || *p > '9' )
+        return false;
+
+    long value = 0;
+    while ( p < end && *p >= '0' && *p <= '9' ) {
+        value = value * 10 + ( *p++ - '0' );
+        if ( value > (long) count )
+            return false;
+    }
+    if ( value == 0 )
+        return false;
+
+    *index = (int) ( negative ? (long) count - value : value - 1 );
+    return true;
+}
+
+// reads one corner of a face: v, v/vt, v//vn or v/vt/vn
+static bool parse_corner( const char*& p, const char* end, size_t num_positions,
+                          size_t num_tex_coords, size_t num_normals, Corner* corner )
+{
+    corner->tex_coord = corner->normal = -1;
+    if ( !parse_index( p, end, num_positions, &corner->position ) )
+        return false;
+    if ( p < end && *p == '/' ) {
+        ++p;
+        if ( p < end && *p != '/' && !parse_index( p, end, num_tex_coords, &corner->tex_coord ) )
+            return false;
+        if ( p < end && *p == '/' ) {
+            ++p;
+            if ( !parse_index( p, end, num_normals, &corner->normal ) )
+                return false;
+        }
+    }
+    return p == end || is_space( *p ) || *p == '\n';
+}
+
+// averages the normals of the faces around each position, weighted by
+// area, so vertices split only by texture coordinates still share one
+static void average_normals( const std::vector< Corner >& corners, size_t num_positions, Mesh* mesh )
+{
+    std::vector< Vector3 > sums( num_positions, Vector3::Zero );
+    for ( size_t i = 0; i < mesh->triangles.size(); ++i ) {
+        const unsigned int* v = mesh->triangles[i].vertices;
+        const Vector3& a = mesh->vertices[v[0]].position;
+        Vector3 normal = cross( mesh->vertices[v[1]].position - a, mesh->vertices[v[2]].position - a );
+        for ( int j = 0; j < 3; ++j ) {
+            sums[corners[v[j]].position] += normal;
+        }
+    }
+
+    for ( size_t i = 0; i < mesh->vertices.size(); ++i ) {
+        const Vector3& sum = sums[corners[i].position];
+        mesh->vertices[i].normal = sum == Vector3::Zero ? Vector3::UnitZ : normalize( sum );
+    }
+}
+
+bool parse_obj( const char* data, size_t size, Mesh* mesh )
+{
+    mesh->vertices.clear();
+    mesh->triangles.clear();
+
+    std::vector< Vector3 > positions;
+    std::vector< Vector2 > tex_coords;
+    std::vector< Vector3 > normals;
+
+    CornerTable table;
+    // the corner each vertex was made from
+    std::vector< Corner > corners;
+    std::vector< unsigned int > face;
+    bool all_tex_coords = true, all_normals = true;
+
+    const char* p = data;
+    const char* end = data + size;
+    bool ok = true;
+
+    while ( ok && p < end ) {
+        skip_spaces( p, end );
+        const char* keyword = p;
+        while ( p < end && !is_space( *p ) && *p != '\n' ) {
+            ++p;
+        }
+        size_t length = p - keyword;
+
+        if ( length == 1 && keyword[0] == 'v' ) {
+            Vector3 position;
+            ok = parse_real( p, end, &position.x ) && parse_real( p, end, &position.y )
+                && parse_real( p, end, &position.z );
+            positions.push_back( position );
+        } else if ( length == 2 && keyword[0] == 'v' && keyword[1] == 't' ) {
+            Vector2 tex_coord;
+            ok = parse_real( p, end, &tex_coord.x ) && parse_real( p, end, &tex_coord.y );
+            tex_coords.push_back( tex_coord );
+        } else if ( length == 2 && keyword[0] == 'v' && keyword[1] == 'n' ) {
+            Vector3 normal;
+            ok = parse_real( p, end, &normal.x ) && parse_real( p, end, &normal.y )
+                && parse_real( p, end, &normal.z );
+            normals.push_back( normal );
+        } else if ( length == 1 && keyword[0] == 'f' ) {
+            face.clear();
+            while ( ok && !at_line_end( p, end ) ) {
+                Corner corner;
+                ok = parse_corner( p, end, positions.size(), tex_coords.size(), normals.size(), &corner );
+                if ( !ok )
+                    break;
+                all_tex_coords = all_tex_coords && corner.tex_coord >= 0;
+                all_normals = all_normals && corner.normal >= 0;
+
+                int next = (int) mesh->vertices.size();
+                int vertex = table.find_or_add( corner, next );
+                if ( vertex < 0 ) {
+                    MeshVertex added;
+                    added.position = positions[corner.position];
+                    added.tex_coord = corner.tex_coord >= 0 ? tex_coords[corner.tex_coord] : Vector2( 0, 0 );
+                    added.normal = corner.normal >= 0 ? normals[corner.normal] : Vector3::Zero;
+                    mesh->vertices.push_back( added );
+                    corners.push_back( corner );
+                    vertex = next;
+                }
+                face.push_back( (unsigned int) vertex );
+            }
+            ok = ok && face.size() >= 3;
+
+            // split into a fan around the first corner
+            for ( size_t i = 2; ok && i < face.size(); ++i ) {
+                MeshTriangle triangle;
+                triangle.vertices[0] = face[0];
+                triangle.vertices[1] = face[i - 1];
+                triangle.vertices[2] = face[i];
+                mesh->triangles.push_back( triangle );
+            }
+        }
+
+        // anything else on the line is of no interest
+        skip_line( p, end );
+    }
+
+    if ( !ok ) {
+        mesh->vertices.clear();
+        mesh->triangles.clear();
+        return false;
+    }
+
+    if ( !all_normals ) {
+        average_normals( corners, positions.size(), mesh );
+    }
+    mesh->has_tcoords = all_tex_coords && !mesh->vertices.empty();
+    mesh->has_normals = true;
+    return true;
+}
+
+} /* _462 */
@@ -0,0 +1,25 @@
+#ifndef _462_RAYTRACER_OBJ_PARSER_HPP_
+#define _462_RAYTRACER_OBJ_PARSER_HPP_
+
+#include <cstddef>
+
+namespace _462 {
+
+class Mesh;
+
+/**
+ * Parses the text of an obj file, already in memory, into the vertices and
+ * triangles of mesh. Positions, texture coordinates, normals and faces are
+ * read; polygons are split into fans, and each distinct combination of
+ * indices becomes one vertex. Everything else (groups, materials,
+ * smoothing) is skipped. Normals missing from the file are averaged from
+ * the faces around each vertex.
+ *
+ * Returns false, leaving mesh empty, on anything malformed, so the caller
+ * can fall back to Mesh::load.
+ */
+bool parse_obj( const char* data, size_t size, Mesh* mesh );
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_OBJ_PARSER_HPP_ */
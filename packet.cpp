@@ -0,0 +1,364 @@
+#include "packet.hpp"
+
+#include <algorithm>
+
+// the per-width entry points are compiled for the isa that width is meant
+// for, with everything beneath them inlined so the lane loops vectorise
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define PACKET_X86 1
+#define PACKET_TARGET( isa ) __attribute__(( target( isa ), flatten ))
+#else
+#define PACKET_X86 0
+#define PACKET_TARGET( isa )
+#endif
+
+namespace _462 {
+
+RayPacket::RayPacket( size_t width )
+    : width( width )
+{
+    assert( width <= MAX_PACKET_WIDTH );
+
+    // idle lanes still go through the kernels, so give them a harmless ray
+    for ( size_t i = 0; i < MAX_PACKET_WIDTH; ++i ) {
+        ox[i] = oy[i] = oz[i] = 0;
+        dx[i] = dy[i] = 0;
+        dz[i] = 1;
+        tmax[i] = 0;
+        hit[i] = -1;
+        active[i] = 0;
+    }
+}
+
+void RayPacket::set_ray( size_t lane, const RayInfo& ray, real_t tmax )
+{
+    ox[lane] = ray.origin.x;
+    oy[lane] = ray.origin.y;
+    oz[lane] = ray.origin.z;
+    dx[lane] = ray.direction.x;
+    dy[lane] = ray.direction.y;
+    dz[lane] = ray.direction.z;
+    this->tmax[lane] = tmax;
+    hit[lane] = -1;
+    active[lane] = 1;
+}
+
+RayInfo RayPacket::get_ray( size_t lane ) const
+{
+    RayInfo ray;
+    ray.origin = Vector3( ox[lane], oy[lane], oz[lane] );
+    ray.direction = Vector3( dx[lane], dy[lane], dz[lane] );
+    return ray;
+}
+
+size_t detect_packet_width()
+{
+#if PACKET_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx512f" ) )
+        return 16;
+    if ( __builtin_cpu_supports( "avx2" ) )
+        return 8;
+#endif
+    return 4;
+}
+
+namespace {
+
+// slopes of every lane, with the same huge-value trick as BVHRay
+template< size_t N >
+struct PacketSlopes
+{
+    real_t ix[N], iy[N], iz[N];
+
+    explicit PacketSlopes( const RayPacket& p )
+    {
+        for ( size_t i = 0; i < N; ++i ) {
+            ix[i] = p.dx[i] != 0 ? 1 / p.dx[i] : 1e30;
+            iy[i] = p.dy[i] != 0 ? 1 / p.dy[i] : 1e30;
+            iz[i] = p.dz[i] != 0 ? 1 / p.dz[i] : 1e30;
+        }
+    }
+};
+
+// sets mask for the active lanes passing through the node's box
+template< size_t N >
+inline bool packet_box( const BVHNode& node, const RayPacket& p, const PacketSlopes< N >& slopes,
+                        real_t tmin, const unsigned char* active, unsigned char* mask )
+{
+    unsigned char any = 0;
+    for ( size_t i = 0; i < N; ++i ) {
+        real_t x0 = ( node.lower[0] - p.ox[i] ) * slopes.ix[i];
+        real_t x1 = ( node.upper[0] - p.ox[i] ) * slopes.ix[i];
+        real_t y0 = ( node.lower[1] - p.oy[i] ) * slopes.iy[i];
+        real_t y1 = ( node.upper[1] - p.oy[i] ) * slopes.iy[i];
+        real_t z0 = ( node.lower[2] - p.oz[i] ) * slopes.iz[i];
+        real_t z1 = ( node.upper[2] - p.oz[i] ) * slopes.iz[i];
+        real_t tnear = std::max( std::max( tmin, std::min( x0, x1 ) ),
+                                 std::max( std::min( y0, y1 ), std::min( z0, z1 ) ) );
+        real_t tfar = std::min( std::min( p.tmax[i], std::max( x0, x1 ) ),
+                                std::min( std::max( y0, y1 ), std::max( z0, z1 ) ) );
+        mask[i] = active[i] & ( tnear <= tfar );
+        any |= mask[i];
+    }
+    return any != 0;
+}
+
+// moves every lane into the local space of a shape, given its matrix
+template< size_t N >
+inline void to_local( real_t* const* inverse, size_t slot, const RayPacket& p,
+                      real_t* ox, real_t* oy, real_t* oz, real_t* dx, real_t* dy, real_t* dz )
+{
+    real_t m[AFFINE_ENTRIES];
+    for ( size_t k = 0; k < AFFINE_ENTRIES; ++k ) {
+        m[k] = inverse[k][slot];
+    }
+    for ( size_t i = 0; i < N; ++i ) {
+        ox[i] = m[0] * p.ox[i] + m[1] * p.oy[i] + m[2] * p.oz[i] + m[3];
+        oy[i] = m[4] * p.ox[i] + m[5] * p.oy[i] + m[6] * p.oz[i] + m[7];
+        oz[i] = m[8] * p.ox[i] + m[9] * p.oy[i] + m[10] * p.oz[i] + m[11];
+        dx[i] = m[0] * p.dx[i] + m[1] * p.dy[i] + m[2] * p.dz[i];
+        dy[i] = m[4] * p.dx[i] + m[5] * p.dy[i] + m[6] * p.dz[i];
+        dz[i] = m[8] * p.dx[i] + m[9] * p.dy[i] + m[10] * p.dz[i];
+    }
+}
+
+template< size_t N >
+inline void packet_sphere( const SphereArrays& spheres, size_t slot, int prim, RayPacket& p, real_t tmin,
+                           const unsigned char* mask )
+{
+    real_t ox[N], oy[N], oz[N], dx[N], dy[N], dz[N];
+    to_local< N >( spheres.inverse, slot, p, ox, oy, oz, dx, dy, dz );
+
+    real_t r2 = spheres.radius[slot] * spheres.radius[slot];
+    for ( size_t i = 0; i < N; ++i ) {
+        real_t a = dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i];
+        real_t b = ox[i] * dx[i] + oy[i] * dy[i] + oz[i] * dz[i];
+        real_t c = ox[i] * ox[i] + oy[i] * oy[i] + oz[i] * oz[i] - r2;
+        real_t disc = b * b - a * c;
+        real_t root = sqrt( std::max( disc, (real_t) 0 ) );
+        real_t t = ( -b - root ) / a;
+        real_t t_far = ( -b + root ) / a;
+        t = t < tmin ? t_far : t;
+        int hit = mask[i] & ( disc >= 0 ) & ( t >= tmin ) & ( t < p.tmax[i] );
+        p.tmax[i] = hit ? t : p.tmax[i];
+        p.hit[i] = hit ? prim : p.hit[i];
+    }
+}
+
+template< size_t N >
+inline void packet_triangle( const TriangleArrays& triangles, size_t slot, int prim, RayPacket& p, real_t tmin,
+                             const unsigned char* mask )
+{
+    real_t ox[N], oy[N], oz[N], dx[N], dy[N], dz[N];
+    to_local< N >( triangles.inverse, slot, p, ox, oy, oz, dx, dy, dz );
+
+    Vector3 p0( triangles.p0[0][slot], triangles.p0[1][slot], triangles.p0[2][slot] );
+    Vector3 e1( triangles.e1[0][slot], triangles.e1[1][slot], triangles.e1[2][slot] );
+    Vector3 e2( triangles.e2[0][slot], triangles.e2[1][slot], triangles.e2[2][slot] );
+    for ( size_t i = 0; i < N; ++i ) {
+        real_t px = dy[i] * e2.z - dz[i] * e2.y;
+        real_t py = dz[i] * e2.x - dx[i] * e2.z;
+        real_t pz = dx[i] * e2.y - dy[i] * e2.x;
+        real_t det = e1.x * px + e1.y * py + e1.z * pz;
+        real_t inv = 1 / det;
+        real_t sx = ox[i] - p0.x;
+        real_t sy = oy[i] - p0.y;
+        real_t sz = oz[i] - p0.z;
+        real_t u = ( sx * px + sy * py + sz * pz ) * inv;
+        real_t qx = sy * e1.z - sz * e1.y;
+        real_t qy = sz * e1.x - sx * e1.z;
+        real_t qz = sx * e1.y - sy * e1.x;
+        real_t v = ( dx[i] * qx + dy[i] * qy + dz[i] * qz ) * inv;
+        real_t t = ( e2.x * qx + e2.y * qy + e2.z * qz ) * inv;
+        int hit = mask[i] & ( fabs( det ) >= 1e-12 ) & ( u >= 0 ) & ( u <= 1 )
+            & ( v >= 0 ) & ( u + v <= 1 ) & ( t >= tmin ) & ( t < p.tmax[i] );
+        p.tmax[i] = hit ? t : p.tmax[i];
+        p.hit[i] = hit ? prim : p.hit[i];
+    }
+}
+
+// anything without a packet kernel is tested one lane at a time
+template< size_t N >
+inline void packet_scalar( const PreparedScene& prepared, int prim, RayPacket& p, real_t tmin,
+                           const unsigned char* mask, bool occlusion )
+{
+    for ( size_t i = 0; i < N; ++i ) {
+        if ( !mask[i] )
+            continue;
+        RayInfo ray = p.get_ray( i );
+        if ( occlusion ) {
+            if ( prepared.occluded_by( prim, ray, tmin, p.tmax[i] ) ) {
+                p.hit[i] = prim;
+            }
+        } else {
+            // hits are filled in again once the packet is done, so only
+            // the distance matters here
+            real_t t = prepared.hit_distance( prim, ray, tmin, p.tmax[i] );
+            if ( t < p.tmax[i] ) {
+                p.tmax[i] = t;
+                p.hit[i] = prim;
+            }
+        }
+    }
+}
+
+template< size_t N >
+inline void packet_primitive( const PreparedScene& prepared, int prim, RayPacket& p, real_t tmin,
+                              const unsigned char* mask, bool occlusion )
+{
+    const CompiledScene& compiled = prepared.get_compiled();
+    switch ( compiled.get_kind( prim ) ) {
+    case SHAPE_SPHERE:
+        packet_sphere< N >( compiled.get_spheres(), compiled.get_slot( prim ), prim, p, tmin, mask );
+        break;
+    case SHAPE_TRIANGLE:
+        packet_triangle< N >( compiled.get_triangles(), compiled.get_slot( prim ), prim, p, tmin, mask );
+        break;
+    default:
+        packet_scalar< N >( prepared, prim, p, tmin, mask, occlusion );
+        break;
+    }
+}
+
+// retires lanes that found a blocker. returns whether any are left.
+template< size_t N >
+inline bool retire_blocked( const RayPacket& p, unsigned char* active, unsigned char* blocked )
+{
+    unsigned char any = 0;
+    for ( size_t i = 0; i < N; ++i ) {
+        unsigned char hit = active[i] & ( p.hit[i] >= 0 );
+        blocked[i] |= hit;
+        active[i] &= !hit;
+        any |= active[i];
+    }
+    return any != 0;
+}
+
+// walks the scene bvh once for the whole packet. a node is entered if any
+// active lane passes through its box, and only those lanes test its leaves.
+template< size_t N >
+void traverse( const PreparedScene& prepared, RayPacket& p, real_t tmin, unsigned char* blocked )
+{
+    bool occlusion = blocked != 0;
+    unsigned char active[N];
+    unsigned char mask[N];
+    int first = -1;
+
+    for ( size_t i = 0; i < N; ++i ) {
+        active[i] = p.active[i];
+        if ( active[i] && first < 0 ) {
+            first = (int) i;
+        }
+    }
+    if ( first < 0 )
+        return;
+
+    // with the bvh off, as the scalar queries do, every geometry is tested
+    if ( !prepared.uses_bvh() ) {
+        for ( size_t i = 0; i < prepared.num_geometries(); ++i ) {
+            packet_primitive< N >( prepared, (int) i, p, tmin, active, occlusion );
+            if ( occlusion && !retire_blocked< N >( p, active, blocked ) )
+                return;
+        }
+        return;
+    }
+
+    const std::vector< unsigned int >& unbounded = prepared.get_unbounded();
+    for ( size_t i = 0; i < unbounded.size(); ++i ) {
+        packet_primitive< N >( prepared, unbounded[i], p, tmin, active, occlusion );
+    }
+    if ( occlusion && !retire_blocked< N >( p, active, blocked ) )
+        return;
+
+    const BVH& bvh = prepared.get_bvh();
+    if ( bvh.empty() )
+        return;
+
+    const BVHNode* nodes = bvh.get_nodes();
+    const unsigned int* indices = bvh.get_indices();
+    PacketSlopes< N > slopes( p );
+
+    // children are visited in the order that suits the first live lane
+    const real_t* directions[3] = { p.dx, p.dy, p.dz };
+
+    unsigned int stack[BVH_STACK_SIZE];
+    size_t top = 0;
+    unsigned int current = 0;
+
+    while ( true ) {
+        const BVHNode& node = nodes[current];
+
+        if ( packet_box< N >( node, p, slopes, tmin, active, mask ) ) {
+            if ( node.count > 0 ) {
+                for ( unsigned int i = 0; i < node.count; ++i ) {
+                    packet_primitive< N >( prepared, indices[node.offset + i], p, tmin, mask, occlusion );
+                }
+                if ( occlusion && !retire_blocked< N >( p, active, blocked ) )
+                    return;
+            } else {
+                if ( directions[node.axis][first] < 0 ) {
+                    stack[top++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[top++] = node.offset;
+                    current = current + 1;
+                }
+                assert( top < BVH_STACK_SIZE );
+                continue;
+            }
+        }
+
+        if ( top == 0 )
+            break;
+        current = stack[--top];
+    }
+}
+
+PACKET_TARGET( "sse2" )
+void traverse_4( const PreparedScene& prepared, RayPacket& p, real_t tmin, unsigned char* blocked )
+{
+    traverse< 4 >( prepared, p, tmin, blocked );
+}
+
+PACKET_TARGET( "avx2" )
+void traverse_8( const PreparedScene& prepared, RayPacket& p, real_t tmin, unsigned char* blocked )
+{
+    traverse< 8 >( prepared, p, tmin, blocked );
+}
+
+PACKET_TARGET( "avx512f" )
+void traverse_16( const PreparedScene& prepared, RayPacket& p, real_t tmin, unsigned char* blocked )
+{
+    traverse< 16 >( prepared, p, tmin, blocked );
+}
+
+void traverse_packet( const PreparedScene& prepared, RayPacket& p, real_t tmin, unsigned char* blocked )
+{
+    switch ( p.width ) {
+    case 16:
+        traverse_16( prepared, p, tmin, blocked );
+        break;
+    case 8:
+        traverse_8( prepared, p, tmin, blocked );
+        break;
+    default:
+        assert( p.width == 4 );
+        traverse_4( prepared, p, tmin, blocked );
+        break;
+    }
+}
+
+}
+
+void packet_closest_hit( const PreparedScene& prepared, RayPacket& packet, real_t tmin )
+{
+    traverse_packet( prepared, packet, tmin, 0 );
+}
+
+void packet_occluded( const PreparedScene& prepared, RayPacket& packet, real_t tmin, unsigned char* blocked )
+{
+    traverse_packet( prepared, packet, tmin, blocked );
+}
+
+} /* _462 */
@@ -0,0 +1,51 @@
+#ifndef _462_RAYTRACER_PACKET_HPP_
+#define _462_RAYTRACER_PACKET_HPP_
+
+#include "prepared_scene.hpp"
+
+namespace _462 {
+
+static const size_t MAX_PACKET_WIDTH = 16;
+
+/**
+ * A bundle of up to MAX_PACKET_WIDTH rays in structure-of-arrays form, so
+ * the kernels can run one ray per simd lane.
+ */
+struct RayPacket
+{
+    // number of lanes in use: 4, 8 or 16
+    size_t width;
+
+    real_t ox[MAX_PACKET_WIDTH], oy[MAX_PACKET_WIDTH], oz[MAX_PACKET_WIDTH];
+    real_t dx[MAX_PACKET_WIDTH], dy[MAX_PACKET_WIDTH], dz[MAX_PACKET_WIDTH];
+
+    // far limit of each ray; closest-hit queries shrink it
+    real_t tmax[MAX_PACKET_WIDTH];
+
+    // closest geometry hit, or -1
+    int hit[MAX_PACKET_WIDTH];
+
+    // lanes taking part in the query
+    unsigned char active[MAX_PACKET_WIDTH];
+
+    explicit RayPacket( size_t width );
+
+    void set_ray( size_t lane, const RayInfo& ray, real_t tmax );
+
+    RayInfo get_ray( size_t lane ) const;
+};
+
+// the widest packet this cpu runs natively: 16 with avx-512, 8 with avx2,
+// otherwise 4
+size_t detect_packet_width();
+
+// finds the closest hit of every active lane between tmin and its tmax
+void packet_closest_hit( const PreparedScene& prepared, RayPacket& packet, real_t tmin );
+
+// sets blocked[lane] for every active lane that something blocks between
+// tmin and its tmax
+void packet_occluded( const PreparedScene& prepared, RayPacket& packet, real_t tmin, unsigned char* blocked );
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_PACKET_HPP_ */
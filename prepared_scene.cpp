@@ -0,0 +1,545 @@
+#include "prepared_scene.hpp"
+#include "bounds.hpp"
+#include "kernels.hpp"
+#include "scene/model.hpp"
+#include "scene/sphere.hpp"
+#include "scene/triangle.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+namespace _462 {
+
+static const size_t CACHE_LINE = 64;
+
+// with light culling, lights are ignored where they would add less than
+// this to every channel: a quarter of one step of an 8-bit channel
+static const real_t LIGHT_CUTOFF = 1.0 / 1024;
+
+PreparedScene::PreparedScene()
+    : scene( 0 ), storage( 0 ), allocation( 0 ), count( 0 ), capacity( 0 ), rebuild( true ),
+      use_bvh( true ), light_culling( false )
+{
+    stride = ( sizeof( GeometryTransform ) + CACHE_LINE - 1 ) / CACHE_LINE * CACHE_LINE;
+}
+
+PreparedScene::~PreparedScene()
+{
+    free( allocation );
+}
+
+void PreparedScene::reserve( size_t num )
+{
+    if ( num <= capacity )
+        return;
+
+    free( allocation );
+    allocation = (char*) malloc( num * stride + CACHE_LINE );
+    if ( !allocation ) {
+        throw std::bad_alloc();
+    }
+
+    size_t misalign = (size_t) allocation % CACHE_LINE;
+    storage = misalign ? allocation + ( CACHE_LINE - misalign ) : allocation;
+    for ( size_t i = 0; i < num; ++i ) {
+        new ( storage + i * stride ) GeometryTransform();
+    }
+    capacity = num;
+}
+
+void PreparedScene::prepare( const Scene* scene )
+{
+    size_t num = scene->num_geometries();
+
+    // a different scene or a different set of geometries invalidates it all
+    if ( scene != this->scene || num != count ) {
+        reserve( num );
+        this->scene = scene;
+        count = num;
+        keys.resize( num );
+        dirty.assign( num, true );
+        rebuild = true;
+    }
+
+    Geometry* const* geometries = scene->get_geometries();
+    bool changed = rebuild;
+    moved.clear();
+
+    for ( size_t i = 0; i < count; ++i ) {
+        const Geometry& geom = *geometries[i];
+        GeometryKey current;
+        current.read( geom );
+
+        if ( !dirty[i] && keys[i] == current ) {
+            continue;
+        }
+        keys[i] = current;
+
+        GeometryTransform& xform = transform_at( i );
+        make_transformation_matrix( &xform.transform, geom.position, geom.orientation, geom.scale );
+        make_inverse_transformation_matrix( &xform.inverse, geom.position, geom.orientation, geom.scale );
+        make_normal_matrix( &xform.normal, xform.transform );
+
+        dirty[i] = false;
+        moved.push_back( (unsigned int) i );
+        changed = true;
+    }
+
+    if ( changed ) {
+        update_bvh( rebuild );
+        rebuild = false;
+    }
+
+    // materials can change without anything moving
+    compiled.compile( *this, mesh_bvhs, textures );
+
+    // lights are few next to geometry, so the tree is simply rebuilt
+    if ( light_culling ) {
+        lights.build( scene->get_lights(), scene->num_lights(), LIGHT_CUTOFF );
+    } else {
+        lights.clear();
+    }
+}
+
+const MeshBVH* PreparedScene::prepare_mesh( const Mesh* mesh )
+{
+    return mesh_bvhs.prepare( mesh );
+}
+
+void PreparedScene::adopt_mesh_bvh( MeshBVH* bvh )
+{
+    mesh_bvhs.adopt( bvh );
+}
+
+void PreparedScene::forget_scene( const Scene* scene )
+{
+    Mesh* const* meshes = scene->get_meshes();
+    for ( size_t i = 0; i < scene->num_meshes(); ++i ) {
+        mesh_bvhs.forget( meshes[i] );
+    }
+    Geometry* const* geometries = scene->get_geometries();
+    for ( size_t i = 0; i < scene->num_geometries(); ++i ) {
+        if ( const Model* model = dynamic_cast< const Model* >( geometries[i] ) ) {
+            mesh_bvhs.forget( model->mesh );
+        }
+    }
+
+    if ( scene == this->scene ) {
+        this->scene = 0;
+    }
+}
+
+void PreparedScene::update_bvh( bool rebuild )
+{
+    Geometry* const* geometries = scene->get_geometries();
+    size_t num_unbounded = unbounded.size();
+
+    world_bounds.assign( count, BoundingBox() );
+    unbounded.clear();
+    for ( size_t i = 0; i < count; ++i ) {
+        BoundingBox local;
+        if ( get_local_bounds( *geometries[i], &local ) ) {
+            world_bounds[i] = transform_bounds( local, get_transform( i ).transform );
+            world_bounds[i].pad();
+        } else {
+            unbounded.push_back( (unsigned int) i );
+        }
+    }
+
+    const BoundingBox* bounds = count ? &world_bounds[0] : 0;
+    if ( rebuild || unbounded.size() != num_unbounded || !bvh.refit( bounds, count ) ) {
+        bvh.build( bounds, count );
+    }
+}
+
+void PreparedScene::GeometryKey::read( const Geometry& geometry )
+{
+    position = geometry.position;
+    orientation = geometry.orientation;
+    scale = geometry.scale;
+
+    radius = 0;
+    corners[0] = corners[1] = corners[2] = Vector3::Zero;
+    mesh = 0;
+    if ( const Sphere* sphere = dynamic_cast< const Sphere* >( &geometry ) ) {
+        radius = sphere->radius;
+    } else if ( const Triangle* triangle = dynamic_cast< const Triangle* >( &geometry ) ) {
+        for ( int j = 0; j < 3; ++j ) {
+            corners[j] = triangle->vertices[j].position;
+        }
+    } else if ( const Model* model = dynamic_cast< const Model* >( &geometry ) ) {
+        mesh = model->mesh;
+    }
+}
+
+bool PreparedScene::GeometryKey::operator==( const GeometryKey& other ) const
+{
+    return position == other.position
+        && orientation == other.orientation
+        && scale == other.scale
+        && radius == other.radius
+        && corners[0] == other.corners[0]
+        && corners[1] == other.corners[1]
+        && corners[2] == other.corners[2]
+        && mesh == other.mesh;
+}
+
+void PreparedScene::mark_dirty( size_t index )
+{
+    if ( index < dirty.size() ) {
+        dirty[index] = true;
+    }
+}
+
+// below this, a surface is taken to face the ray at this angle, so grazing
+// hits do not blur a texture down to its last level
+static const real_t MIN_FOOTPRINT_COSINE = 0.1;
+
+// modulates the colors of a model hit by its texture, at the level where
+// the cone's footprint covers about one texel
+static void apply_texture( const MeshBVH& bvh, const MipTexture& texture, const RayInfo& ray,
+                           const RayInfo& local, const MeshHit& hit, const RayCone* cone,
+                           IntersectionInfo& intersection )
+{
+    real_t level = 0;
+    if ( cone ) {
+        // the footprint in local units, stretched across a tilted surface
+        real_t scale = length( local.direction ) / length( ray.direction );
+        real_t cosine = fabs( dot( normalize( local.direction ), intersection.localnormal ) );
+        real_t width = cone->width_at( ray, hit.t ) * scale / std::max( cosine, MIN_FOOTPRINT_COSINE );
+        real_t resolution = sqrt( (real_t) texture.get_width() * texture.get_height() );
+        level = MipTexture::level_for( width * bvh.get_tex_scale( hit.triangle ) * resolution );
+    }
+
+    Vector2 coord = bvh.tex_coord( hit );
+    Color3 color = texture.sample( coord.x, coord.y, level );
+    intersection.material.ambient = intersection.material.ambient * color;
+    intersection.material.diffuse = intersection.material.diffuse * color;
+}
+
+bool PreparedScene::check_geometry( size_t index, const RayInfo& ray, IntersectionInfo& intersection,
+                                    const RayCone* cone ) const
+{
+    const Matrix4& inverse = get_transform( index ).inverse;
+    RayInfo local;
+    local.origin = inverse.transform_point( ray.origin );
+    local.direction = inverse.transform_vector( ray.direction );
+
+    if ( const MeshBVH* bvh = compiled.get_model_bvh( index ) ) {
+        MeshHit hit;
+        if ( !bvh->closest_hit( local, intersection.t0, intersection.t1, &hit ) )
+            return false;
+        bvh->fill_intersection( local, hit, compiled.get_model_material( index ), intersection );
+        if ( const MipTexture* texture = compiled.get_model_texture( index ) ) {
+            apply_texture( *bvh, *texture, ray, local, hit, cone, intersection );
+        }
+        return true;
+    }
+
+    return scene->get_geometries()[index]->check_geometry( local, intersection );
+}
+
+namespace {
+
+// bvh intersector that keeps the nearest hit. runs of spheres or triangles
+// go through the batched kernels, which only find how far away the hit is,
+// so the intersection is left for closest_hit to fill in once the
+// traversal is over.
+struct ClosestHitTest
+{
+    const PreparedScene* prepared;
+    const CompiledScene* compiled;
+    const RayInfo* ray;
+    IntersectionInfo* intersection;
+    const RayCone* cone;
+    real_t t0, t1;
+    int index;
+    bool kernels;
+    size_t* tests;
+
+    real_t limit() const { return t1; }
+
+    template< ShapeKind Kind >
+    bool test_run( size_t slot, size_t length )
+    {
+        const typename ShapeKernel< Kind >::Arrays& arrays = ShapeKernel< Kind >::arrays( *compiled );
+        size_t hit = closest_in_run< Kind >( arrays, slot, slot + length, *ray, t0, &t1 );
+        if ( hit == slot + length )
+            return false;
+        index = (int) arrays.geometry[hit];
+        return true;
+    }
+
+    bool test_one( unsigned int i )
+    {
+        intersection->t1 = t1;
+        if ( prepared->check_geometry( i, *ray, *intersection, cone ) ) {
+            t1 = intersection->t1;
+            index = (int) i;
+            return true;
+        }
+        return false;
+    }
+
+    bool operator()( const unsigned int* geometries, size_t count )
+    {
+        bool hit = false;
+        size_t length;
+        for ( size_t i = 0; i < count; i += length ) {
+            length = kernels ? compiled->run_length( geometries + i, count - i ) : 1;
+            if ( tests ) {
+                for ( size_t k = 0; k < length; ++k ) {
+                    ++tests[geometries[i + k]];
+                }
+            }
+
+            size_t slot = compiled->get_slot( geometries[i] );
+            switch ( kernels ? compiled->get_kind( geometries[i] ) : SHAPE_OTHER ) {
+            case SHAPE_SPHERE:
+                hit |= test_run< SHAPE_SPHERE >( slot, length );
+                break;
+            case SHAPE_TRIANGLE:
+                hit |= test_run< SHAPE_TRIANGLE >( slot, length );
+                break;
+            default:
+                hit |= test_one( geometries[i] );
+                break;
+            }
+        }
+        return hit;
+    }
+};
+
+// bvh intersector that stops at the first blocker and remembers it
+struct OcclusionTest
+{
+    const PreparedScene* prepared;
+    const CompiledScene* compiled;
+    const RayInfo* ray;
+    real_t t0, t1;
+    int blocker;
+    size_t* tests;
+
+    real_t limit() const { return t1; }
+
+    template< ShapeKind Kind >
+    bool test_run( size_t slot, size_t length )
+    {
+        const typename ShapeKernel< Kind >::Arrays& arrays = ShapeKernel< Kind >::arrays( *compiled );
+        size_t hit = any_in_run< Kind >( arrays, slot, slot + length, *ray, t0, t1 );
+        if ( hit == slot + length )
+            return false;
+        blocker = (int) arrays.geometry[hit];
+        return true;
+    }
+
+    bool operator()( const unsigned int* geometries, size_t count )
+    {
+        size_t length;
+        for ( size_t i = 0; i < count; i += length ) {
+            length = compiled->run_length( geometries + i, count - i );
+            if ( tests ) {
+                for ( size_t k = 0; k < length; ++k ) {
+                    ++tests[geometries[i + k]];
+                }
+            }
+
+            size_t slot = compiled->get_slot( geometries[i] );
+            bool blocked;
+            switch ( compiled->get_kind( geometries[i] ) ) {
+            case SHAPE_SPHERE:
+                blocked = test_run< SHAPE_SPHERE >( slot, length );
+                break;
+            case SHAPE_TRIANGLE:
+                blocked = test_run< SHAPE_TRIANGLE >( slot, length );
+                break;
+            default:
+                blocked = prepared->occluded_by( geometries[i], *ray, t0, t1 );
+                if ( blocked ) {
+                    blocker = (int) geometries[i];
+                }
+                break;
+            }
+            if ( blocked )
+                return true;
+        }
+        return false;
+    }
+};
+
+}
+
+int PreparedScene::closest_hit( const RayInfo& ray, IntersectionInfo& intersection, size_t* tests,
+                                const RayCone* cone ) const
+{
+    if ( !use_bvh ) {
+        return closest_hit_brute( ray, intersection, tests, cone );
+    }
+
+    real_t t1 = intersection.t1;
+    int index = closest_hit_bvh( ray, intersection, tests, cone, true );
+    if ( index < 0 )
+        return -1;
+
+    // a kernel hit only has its distance, so the geometry's own test fills
+    // in the rest. should the two ever disagree, the geometry's test has
+    // the final say.
+    if ( compiled.get_kind( index ) == SHAPE_SPHERE || compiled.get_kind( index ) == SHAPE_TRIANGLE ) {
+        intersection.t1 = t1;
+        if ( !check_geometry( index, ray, intersection, cone ) ) {
+            intersection.t1 = t1;
+            index = closest_hit_bvh( ray, intersection, tests, cone, false );
+        }
+    }
+    return index;
+}
+
+int PreparedScene::closest_hit_bvh( const RayInfo& ray, IntersectionInfo& intersection, size_t* tests,
+                                    const RayCone* cone, bool kernels ) const
+{
+    ClosestHitTest test;
+    test.prepared = this;
+    test.compiled = &compiled;
+    test.ray = &ray;
+    test.intersection = &intersection;
+    test.cone = cone;
+    test.t0 = intersection.t0;
+    test.t1 = intersection.t1;
+    test.index = -1;
+    test.kernels = kernels;
+    test.tests = tests;
+
+    if ( !unbounded.empty() ) {
+        test( &unbounded[0], unbounded.size() );
+    }
+    bvh.closest_hit( BVHRay( ray.origin, ray.direction ), intersection.t0, test );
+
+    intersection.t1 = test.t1;
+    return test.index;
+}
+
+bool PreparedScene::occluded( const RayInfo& ray, real_t t0, real_t t1, int* last_occluder,
+                              size_t* tests ) const
+{
+    if ( !use_bvh ) {
+        return occluded_brute( ray, t0, t1, tests, last_occluder );
+    }
+
+    if ( last_occluder && *last_occluder >= 0 && (size_t) *last_occluder < count ) {
+        if ( tests ) {
+            ++tests[*last_occluder];
+        }
+        if ( occluded_by( *last_occluder, ray, t0, t1 ) )
+            return true;
+    }
+
+    OcclusionTest test;
+    test.prepared = this;
+    test.compiled = &compiled;
+    test.ray = &ray;
+    test.t0 = t0;
+    test.t1 = t1;
+    test.blocker = -1;
+    test.tests = tests;
+
+    bool blocked = !unbounded.empty() && test( &unbounded[0], unbounded.size() );
+    if ( !blocked ) {
+        blocked = bvh.any_hit( BVHRay( ray.origin, ray.direction ), t0, test );
+    }
+
+    if ( blocked && last_occluder ) {
+        *last_occluder = test.blocker;
+    }
+    return blocked;
+}
+
+int PreparedScene::closest_hit_brute( const RayInfo& ray, IntersectionInfo& intersection, size_t* tests,
+                                      const RayCone* cone ) const
+{
+    int index = -1;
+    for ( size_t i = 0; i < count; ++i ) {
+        if ( tests ) {
+            ++tests[i];
+        }
+        if ( check_geometry( i, ray, intersection, cone ) ) {
+            index = (int) i;
+        }
+    }
+    return index;
+}
+
+bool PreparedScene::occluded_brute( const RayInfo& ray, real_t t0, real_t t1, size_t* tests,
+                                    int* blocker ) const
+{
+    IntersectionInfo intersection;
+    intersection.t0 = t0;
+    intersection.t1 = t1;
+    for ( size_t i = 0; i < count; ++i ) {
+        if ( tests ) {
+            ++tests[i];
+        }
+        if ( check_geometry( i, ray, intersection ) ) {
+            if ( blocker ) {
+                *blocker = (int) i;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PreparedScene::occluded_by( size_t index, const RayInfo& ray, real_t t0, real_t t1 ) const
+{
+    size_t slot = compiled.get_slot( index );
+    switch ( compiled.get_kind( index ) ) {
+    case SHAPE_SPHERE:
+        return ShapeKernel< SHAPE_SPHERE >::intersect( compiled.get_spheres(), slot, ray, t0, t1 ) < t1;
+    case SHAPE_TRIANGLE:
+        return ShapeKernel< SHAPE_TRIANGLE >::intersect( compiled.get_triangles(), slot, ray, t0, t1 ) < t1;
+    case SHAPE_MODEL: {
+        const Matrix4& inverse = get_transform( index ).inverse;
+        RayInfo local;
+        local.origin = inverse.transform_point( ray.origin );
+        local.direction = inverse.transform_vector( ray.direction );
+        return compiled.get_model_bvh( index )->any_hit( local, t0, t1 );
+    }
+    default:
+        break;
+    }
+
+    IntersectionInfo intersection;
+    intersection.t0 = t0;
+    intersection.t1 = t1;
+    return check_geometry( index, ray, intersection );
+}
+
+real_t PreparedScene::hit_distance( size_t index, const RayInfo& ray, real_t t0, real_t t1 ) const
+{
+    size_t slot = compiled.get_slot( index );
+    switch ( compiled.get_kind( index ) ) {
+    case SHAPE_SPHERE:
+        return ShapeKernel< SHAPE_SPHERE >::intersect( compiled.get_spheres(), slot, ray, t0, t1 );
+    case SHAPE_TRIANGLE:
+        return ShapeKernel< SHAPE_TRIANGLE >::intersect( compiled.get_triangles(), slot, ray, t0, t1 );
+    case SHAPE_MODEL: {
+        const Matrix4& inverse = get_transform( index ).inverse;
+        RayInfo local;
+        local.origin = inverse.transform_point( ray.origin );
+        local.direction = inverse.transform_vector( ray.direction );
+        MeshHit hit;
+        return compiled.get_model_bvh( index )->closest_hit( local, t0, t1, &hit ) ? hit.t : t1;
+    }
+    default:
+        break;
+    }
+
+    // only models are textured, so the geometry's own test costs no more
+    IntersectionInfo intersection;
+    intersection.t0 = t0;
+    intersection.t1 = t1;
+    return check_geometry( index, ray, intersection ) ? intersection.t1 : t1;
+}
+
+} /* _462 */
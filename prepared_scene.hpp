@@ -0,0 +1,213 @@
+#ifndef _462_RAYTRACER_PREPARED_SCENE_HPP_
+#define _462_RAYTRACER_PREPARED_SCENE_HPP_
+
+#include "bvh.hpp"
+#include "compiled_scene.hpp"
+#include "light_tree.hpp"
+#include "mesh_bvh.hpp"
+#include "texture.hpp"
+#include "math/matrix.hpp"
+#include "math/quaternion.hpp"
+#include "math/vector.hpp"
+#include "scene/scene.hpp"
+#include <vector>
+
+namespace _462 {
+
+// the matrices derived from a geometry's position, orientation and scale
+struct GeometryTransform
+{
+    // local to world
+    Matrix4 transform;
+    // world to local
+    Matrix4 inverse;
+    // local to world, for normals
+    Matrix3 normal;
+};
+
+/**
+ * Per-scene data the raytracer derives once before tracing, so the ray loops
+ * only do lookups. Transforms live in one flat array with each entry starting
+ * on its own cache line. prepare() only recomputes entries whose geometry
+ * moved, changed shape or was marked dirty.
+ *
+ * Ray queries go through a bvh over the world bounds of every geometry, or
+ * through a plain loop over all of them when the bvh is switched off. The
+ * loop is kept as the reference the bvh must agree with. Models are traced
+ * through the shared bvh of their mesh rather than triangle by triangle.
+ * When geometries only move or change shape, the bvh is refitted rather
+ * than rebuilt.
+ * The geometries themselves are compiled into per-type arrays, and the bvh
+ * queries test spheres and triangles through the kernels in kernels.hpp
+ * rather than the virtual check_geometry. Only the geometry a closest-hit
+ * query ends on goes through its own test, to fill in the intersection.
+ * Textured models are colored from mip textures built once per image.
+ */
+class PreparedScene
+{
+public:
+
+    PreparedScene();
+
+    ~PreparedScene();
+
+    // brings all derived data up to date with the scene
+    void prepare( const Scene* scene );
+
+    // builds the triangle bvh for a mesh, ahead of the first prepare
+    const MeshBVH* prepare_mesh( const Mesh* mesh );
+
+    // takes ownership of a bvh built elsewhere for its mesh
+    void adopt_mesh_bvh( MeshBVH* bvh );
+
+    // drops everything built for a scene about to be freed: the bvhs of
+    // its meshes and, if it is the prepared scene, the rest, so that
+    // another scene allocated in its place is prepared from scratch
+    void forget_scene( const Scene* scene );
+
+    // forces the transforms of a geometry to be rebuilt on the next prepare
+    void mark_dirty( size_t index );
+
+    // the geometries that moved or changed shape in the last prepare
+    const std::vector< unsigned int >& get_moved() const { return moved; }
+
+    // the padded world bounds of a geometry, empty if its extent is unknown
+    const BoundingBox& get_world_bounds( size_t index ) const { return world_bounds[index]; }
+
+    const Scene* get_scene() const { return scene; }
+
+    size_t num_geometries() const { return count; }
+
+    const GeometryTransform& get_transform( size_t index ) const
+    {
+        return *(const GeometryTransform*) ( storage + index * stride );
+    }
+
+    const CompiledScene& get_compiled() const { return compiled; }
+
+    // the mesh bvh of a model geometry, or null for anything else
+    const MeshBVH* get_model_bvh( size_t index ) const { return compiled.get_model_bvh( index ); }
+
+    const BVH& get_bvh() const { return bvh; }
+
+    // geometries left out of the bvh because their extent is unknown
+    const std::vector< unsigned int >& get_unbounded() const { return unbounded; }
+
+    // whether queries go through the bvh (the default) or the plain loop
+    void set_use_bvh( bool use_bvh ) { this->use_bvh = use_bvh; }
+
+    bool uses_bvh() const { return use_bvh; }
+
+    // whether prepare builds a light tree, so shading can skip lights too
+    // faint to matter. takes effect on the next prepare.
+    void set_light_culling( bool light_culling ) { this->light_culling = light_culling; }
+
+    // the lights by reach, built only with light culling on
+    const LightTree& get_light_tree() const { return lights; }
+
+    // finds the nearest hit within [intersection.t0, intersection.t1),
+    // filling in intersection. returns the geometry's index, or -1 on a miss.
+    // if tests is given, tests[i] is bumped for every test against
+    // geometry i. cone, if given, picks the mip level of textures.
+    int closest_hit( const RayInfo& ray, IntersectionInfo& intersection, size_t* tests = 0,
+                     const RayCone* cone = 0 ) const;
+
+    // whether anything blocks the ray between t0 and t1, stopping at the
+    // first blocker found. if last_occluder is given, that geometry is tried
+    // first and the pointer is updated with whatever blocked the ray.
+    bool occluded( const RayInfo& ray, real_t t0, real_t t1, int* last_occluder = 0,
+                   size_t* tests = 0 ) const;
+
+    // the same queries, testing every geometry in order
+    int closest_hit_brute( const RayInfo& ray, IntersectionInfo& intersection, size_t* tests = 0,
+                           const RayCone* cone = 0 ) const;
+    bool occluded_brute( const RayInfo& ray, real_t t0, real_t t1, size_t* tests = 0,
+                         int* blocker = 0 ) const;
+
+    // tests the ray against a single geometry in its local space. a
+    // textured model's colors are modulated by its texture, filtered for
+    // the cone's footprint, or at full resolution without a cone.
+    bool check_geometry( size_t index, const RayInfo& ray, IntersectionInfo& intersection,
+                         const RayCone* cone = 0 ) const;
+
+    // whether a single geometry blocks the ray between t0 and t1. cheaper
+    // than check_geometry: spheres and triangles go through their kernels,
+    // and models stop at the first triangle.
+    bool occluded_by( size_t index, const RayInfo& ray, real_t t0, real_t t1 ) const;
+
+    // how far along the ray a single geometry is first hit within [t0, t1),
+    // or t1 on a miss. like check_geometry, but fills in nothing, so no
+    // texture is looked up.
+    real_t hit_distance( size_t index, const RayInfo& ray, real_t t0, real_t t1 ) const;
+
+private:
+
+    // the bvh query behind closest_hit. with kernels, a sphere or triangle
+    // that is hit is returned without filling in intersection.
+    int closest_hit_bvh( const RayInfo& ray, IntersectionInfo& intersection, size_t* tests,
+                         const RayCone* cone, bool kernels ) const;
+
+    // the values a geometry's transform and bounds were built from
+    struct GeometryKey
+    {
+        Vector3 position;
+        Quaternion orientation;
+        Vector3 scale;
+        // the shape, for the kinds compiled from their own fields: a
+        // sphere's radius, a triangle's corners, a model's mesh
+        real_t radius;
+        Vector3 corners[3];
+        const Mesh* mesh;
+
+        // takes the values of geometry
+        void read( const Geometry& geometry );
+
+        bool operator==( const GeometryKey& other ) const;
+    };
+
+    void reserve( size_t num );
+
+    // refits the bvh to the current world bounds, or builds it afresh if
+    // rebuild is set or a refit is not good enough
+    void update_bvh( bool rebuild );
+
+    GeometryTransform& transform_at( size_t index )
+    {
+        return *(GeometryTransform*) ( storage + index * stride );
+    }
+
+    // no meaningful copy
+    PreparedScene( const PreparedScene& );
+    PreparedScene& operator=( const PreparedScene& );
+
+    const Scene* scene;
+
+    // aligned transform array, and the block it was carved from
+    char* storage;
+    char* allocation;
+    size_t stride, count, capacity;
+
+    std::vector< GeometryKey > keys;
+    std::vector< bool > dirty;
+    std::vector< unsigned int > moved;
+
+    // set when the bvh's shape no longer fits the scene
+    bool rebuild;
+
+    bool use_bvh;
+    BVH bvh;
+    bool light_culling;
+    LightTree lights;
+    std::vector< BoundingBox > world_bounds;
+    // geometries of unknown extent, tested by every query
+    std::vector< unsigned int > unbounded;
+
+    MeshBVHCache mesh_bvhs;
+    TextureStore textures;
+    CompiledScene compiled;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_PREPARED_SCENE_HPP_ */
+
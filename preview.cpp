@@ -0,0 +1,105 @@
+#include "preview.hpp"
+#include "raytracer.hpp"
+#include "timer.hpp"
+#include "scene/scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace _462 {
+
+// the coarsest preview, in window pixels per traced pixel
+static const int MAX_PREVIEW_SCALE = 16;
+
+// share of a frame's budget spent tracing, leaving the rest for drawing
+static const double PREVIEW_BUDGET_SHARE = 0.75;
+
+// budgets longer than this are capped, so one slow frame does not make
+// the next even slower
+static const real_t MAX_PREVIEW_FRAME_TIME = 1.0 / 15;
+
+PreviewRenderer::PreviewRenderer( Raytracer* raytracer )
+    : raytracer( raytracer ), width( 0 ), height( 0 ),
+      tracing_scale( 0 ), tracing_width( 0 ), tracing_height( 0 ), tracing_time( 0 ),
+      shown_scale( 0 ), shown_width( 0 ), shown_height( 0 ), pixel_cost( 0 ) { }
+
+bool PreviewRenderer::update( Scene* scene, int width, int height, real_t max_time, bool moving )
+{
+    max_time = std::min( max_time, MAX_PREVIEW_FRAME_TIME );
+
+    // a resized window invalidates everything traced for the old size
+    if ( width != this->width || height != this->height ) {
+        this->width = width;
+        this->height = height;
+        shown_scale = 0;
+        moving = true;
+    }
+
+    if ( moving ) {
+        // the old view is stale, so trace a whole new one right away
+        start_image( scene, pick_scale( max_time ) );
+        double start = timer_seconds();
+        raytracer->raytrace( &tracing[0], 0 );
+        finish_image( timer_seconds() - start );
+        return shown_scale == 1;
+    }
+
+    if ( shown_scale == 1 )
+        return true;
+
+    if ( tracing_scale == 0 ) {
+        start_image( scene, shown_scale / 2 );
+    }
+
+    double start = timer_seconds();
+    real_t budget = (real_t) ( max_time * PREVIEW_BUDGET_SHARE );
+    bool is_done = raytracer->raytrace( &tracing[0], &budget );
+    tracing_time += timer_seconds() - start;
+    if ( is_done ) {
+        finish_image( tracing_time );
+    }
+
+    return shown_scale == 1;
+}
+
+int PreviewRenderer::pick_scale( real_t max_time ) const
+{
+    if ( pixel_cost <= 0 )
+        return MAX_PREVIEW_SCALE;
+
+    // the scale is squared in the pixel count
+    double pixels = max_time * PREVIEW_BUDGET_SHARE / pixel_cost;
+    int scale = (int) ceil( sqrt( width * (double) height / std::max( pixels, 1.0 ) ) );
+    return std::min( std::max( scale, 1 ), MAX_PREVIEW_SCALE );
+}
+
+void PreviewRenderer::start_image( Scene* scene, int scale )
+{
+    tracing_scale = std::max( scale, 1 );
+    tracing_width = ( width + tracing_scale - 1 ) / tracing_scale;
+    tracing_height = ( height + tracing_scale - 1 ) / tracing_scale;
+    tracing_time = 0;
+    tracing.resize( 4 * tracing_width * tracing_height );
+
+    // a preview is traced in one go and thrown away, so nothing that
+    // takes several traces or reports on them applies
+    raytracer->set_verbose( false );
+    raytracer->set_progressive( false, 0, 0 );
+    raytracer->set_incremental( false );
+    raytracer->set_profiling( false );
+    raytracer->initialize( scene, tracing_width, tracing_height );
+}
+
+void PreviewRenderer::finish_image( double seconds )
+{
+    double sample = seconds / ( tracing_width * tracing_height );
+    pixel_cost = pixel_cost > 0 ? ( pixel_cost + sample ) / 2 : sample;
+
+    shown.swap( tracing );
+    shown_scale = tracing_scale;
+    shown_width = tracing_width;
+    shown_height = tracing_height;
+    tracing_scale = 0;
+}
+
+} /* _462 */
@@ -0,0 +1,81 @@
+#ifndef _462_RAYTRACER_PREVIEW_HPP_
+#define _462_RAYTRACER_PREVIEW_HPP_
+
+#include "math/math.hpp"
+#include <vector>
+
+namespace _462 {
+
+class Raytracer;
+class Scene;
+
+/**
+ * Keeps a raytraced view of the scene on screen while the camera moves.
+ * Every frame of movement traces the whole view at a reduced resolution,
+ * coarse enough to fit the frame's time budget going by how long earlier
+ * frames took per pixel. Once the camera stops, the view is refined by
+ * halving the scale, one image at a time, until it is traced at full
+ * resolution.
+ *
+ * The image shown is always the last one finished. A finer image in
+ * progress replaces it once it is complete.
+ */
+class PreviewRenderer
+{
+public:
+
+    // traces with raytracer, as the caller configured it, except that the
+    // preview keeps it quiet and turns off progressive, incremental and
+    // profiled tracing
+    PreviewRenderer( Raytracer* raytracer );
+
+    // spends about max_time seconds bringing the view of scene at the
+    // given window size up to date. moving says whether the camera moved
+    // since the last call. returns true once the view is at full
+    // resolution.
+    bool update( Scene* scene, int width, int height, real_t max_time, bool moving );
+
+    // the last finished image as rgba, or null if there is none yet
+    const unsigned char* get_image() const { return shown_scale ? &shown[0] : 0; }
+
+    int get_image_width() const { return shown_width; }
+    int get_image_height() const { return shown_height; }
+
+    // how many window pixels each image pixel covers, across and down
+    int get_scale() const { return shown_scale; }
+
+private:
+
+    // the scale a whole frame can be traced at within max_time
+    int pick_scale( real_t max_time ) const;
+
+    void start_image( Scene* scene, int scale );
+
+    void finish_image( double seconds );
+
+    Raytracer* raytracer;
+
+    // window size
+    int width, height;
+
+    // the image being traced, its scale, or 0 if none is, and the time
+    // spent on it so far
+    std::vector< unsigned char > tracing;
+    int tracing_scale, tracing_width, tracing_height;
+    double tracing_time;
+
+    // the image on screen and its scale, or 0 if there is none
+    std::vector< unsigned char > shown;
+    int shown_scale, shown_width, shown_height;
+
+    // running estimate of the seconds one pixel takes, 0 until measured
+    double pixel_cost;
+
+    // no meaningful copy
+    PreviewRenderer( const PreviewRenderer& );
+    PreviewRenderer& operator=( const PreviewRenderer& );
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_PREVIEW_HPP_ */
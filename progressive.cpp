@@ -0,0 +1,112 @@
+#include "progressive.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace _462 {
+
+// perceived brightness of a displayed color
+static float luminance( const Color3& color )
+{
+    float r = std::min( std::max( (float) color.r, 0.0f ), 1.0f );
+    float g = std::min( std::max( (float) color.g, 0.0f ), 1.0f );
+    float b = std::min( std::max( (float) color.b, 0.0f ), 1.0f );
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+SampleBuffer::SampleBuffer() { }
+
+void SampleBuffer::reset( size_t width, size_t height )
+{
+    size_t num = width * height;
+    sum.assign( num, Color3::Black );
+    sum_luminance.assign( num, 0 );
+    sum_luminance_sq.assign( num, 0 );
+    count.assign( num, 0 );
+    active.assign( num, 1 );
+}
+
+void SampleBuffer::add( size_t pixel, const Color3& color )
+{
+    float l = luminance( color );
+    sum[pixel] = sum[pixel] + color;
+    sum_luminance[pixel] += l;
+    sum_luminance_sq[pixel] += l * l;
+    ++count[pixel];
+}
+
+Color3 SampleBuffer::mean( size_t pixel ) const
+{
+    if ( count[pixel] == 0 )
+        return Color3::Black;
+    return sum[pixel] * (real_t) ( 1.0 / count[pixel] );
+}
+
+real_t SampleBuffer::noise( size_t pixel ) const
+{
+    real_t n = count[pixel];
+    if ( n < 2 )
+        return 1e30;
+
+    real_t mean = sum_luminance[pixel] / n;
+    real_t variance = ( sum_luminance_sq[pixel] - n * mean * mean ) / ( n - 1 );
+    return sqrt( std::max( variance, (real_t) 0 ) / n );
+}
+
+size_t SampleBuffer::update_active( real_t threshold, size_t min_samples )
+{
+    size_t num_active = 0;
+    for ( size_t i = 0; i < count.size(); ++i ) {
+        if ( active[i] && count[i] >= min_samples && noise( i ) < threshold ) {
+            active[i] = 0;
+        }
+        num_active += active[i];
+    }
+    return num_active;
+}
+
+// radical inverse of index in the given base
+static real_t halton( size_t index, size_t base )
+{
+    real_t result = 0;
+    real_t fraction = 1.0 / base;
+    while ( index > 0 ) {
+        result += fraction * ( index % base );
+        index /= base;
+        fraction /= base;
+    }
+    return result;
+}
+
+// scrambles the bits of x, so nearby pixels get unrelated values
+static unsigned int hash( unsigned int x )
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+void sample_jitter( unsigned int frame, size_t pixel, size_t sample,
+                    real_t* jitter_x, real_t* jitter_y )
+{
+    if ( sample == 0 ) {
+        *jitter_x = 0.5;
+        *jitter_y = 0.5;
+        return;
+    }
+
+    // frame 0 keeps the shifts of a single image
+    unsigned int h = hash( (unsigned int) pixel + ( frame ? hash( frame ) : 0 ) );
+    real_t shift_x = ( h & 0xffff ) / 65536.0;
+    real_t shift_y = ( h >> 16 ) / 65536.0;
+
+    real_t x = halton( sample, 2 ) + shift_x;
+    real_t y = halton( sample, 3 ) + shift_y;
+    *jitter_x = x - floor( x );
+    *jitter_y = y - floor( y );
+}
+
+} /* _462 */
@@ -0,0 +1,63 @@
+#ifndef _462_RAYTRACER_PROGRESSIVE_HPP_
+#define _462_RAYTRACER_PROGRESSIVE_HPP_
+
+#include "math/color.hpp"
+#include <vector>
+
+namespace _462 {
+
+/**
+ * Running per-pixel sums for progressive rendering: the color of every
+ * sample so far, and the brightness and squared brightness the noise
+ * estimate is based on. Pixels stop being sampled once their noise drops
+ * under a threshold.
+ *
+ * Each pixel is only ever touched by the thread tracing it, so no locking
+ * is needed as long as threads work on disjoint regions.
+ */
+class SampleBuffer
+{
+public:
+
+    SampleBuffer();
+
+    // clears everything and makes every pixel active
+    void reset( size_t width, size_t height );
+
+    void add( size_t pixel, const Color3& color );
+
+    // average of the pixel's samples, black if it has none
+    Color3 mean( size_t pixel ) const;
+
+    // standard error of the pixel's mean brightness, or a huge value while
+    // there are too few samples to tell
+    real_t noise( size_t pixel ) const;
+
+    // whether the pixel still wants samples
+    bool is_active( size_t pixel ) const { return active[pixel] != 0; }
+
+    // retires pixels with at least min_samples whose noise is below
+    // threshold. returns the number of pixels still active.
+    size_t update_active( real_t threshold, size_t min_samples );
+
+    size_t size() const { return count.size(); }
+
+private:
+
+    std::vector< Color3 > sum;
+    std::vector< float > sum_luminance, sum_luminance_sq;
+    std::vector< unsigned int > count;
+    std::vector< unsigned char > active;
+};
+
+// the offset within a pixel of one of its samples, in [0, 1). sample 0 is
+// always the pixel center; later samples follow a 2-3 halton sequence,
+// shifted by a hash of the frame and pixel so neither neighbours nor
+// consecutive frames share a pattern. a pure function of its arguments, so
+// any thread may take any sample.
+void sample_jitter( unsigned int frame, size_t pixel, size_t sample,
+                    real_t* jitter_x, real_t* jitter_y );
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_PROGRESSIVE_HPP_ */
@@ -5,16 +5,46 @@
  When the object became a airplane or some other more complicated models, there was no difference.*/
 
 #include "raytracer.hpp"
+#include "camera_rays.hpp"
+#include "framebuffer.hpp"
+#include "packet.hpp"
+#include "progressive.hpp"
+#include "timer.hpp"
 #include "scene/scene.hpp"
 
 #include <SDL/SDL_timer.h>
+#include <SDL/SDL_thread.h>
+#include <algorithm>
+#include <cassert>
+#include <functional>
 #include <iostream>
+#include <vector>
 
 
 namespace _462 {
 
+// edge length of the square tiles handed to worker threads
+static const size_t TILE_SIZE = 32;
+
+// secondary rays weighted below this are not traced; well under one step
+// of an 8-bit channel
+static const real_t DEFAULT_MIN_WEIGHT = 1.0 / 1024;
+
+// progressive rendering: samples a pixel needs before its noise is trusted,
+// and the default cap on samples per pixel
+static const size_t MIN_PROGRESSIVE_SAMPLES = 4;
+static const size_t DEFAULT_MAX_SAMPLES = 256;
+
 Raytracer::Raytracer()
-    : scene( 0 ), width( 0 ), height( 0 ) { }
+    : scene( 0 ), width( 0 ), height( 0 ), num_threads( 1 ), active_threads( 1 ),
+      packet_width( 1 ), wavefront( false ), max_depth( MAXNUMBER ),
+      min_weight( DEFAULT_MIN_WEIGHT ), light_culling( false ), light_budget( 0 ),
+      frame( 0 ),
+      listener( 0 ), incremental( false ),
+      updating( false ), num_updates( 0 ), verbose( true ), profiling( false ),
+      hdr_enabled( false ), exposure( 1 ),
+      progressive( false ), noise_threshold( 0 ), time_budget( 0 ),
+      max_samples( DEFAULT_MAX_SAMPLES ), pass( 0 ), progressive_start( 0 ) { }
 
 Raytracer::~Raytracer() { }
 
@@ -26,9 +56,249 @@ bool Raytracer::initialize( Scene* scene, size_t width, size_t height )
 
     current_row = 0;
 
+    // derive transforms for anything that moved since the last trace
+    prepared.set_light_culling( light_culling );
+    prepared.prepare( scene );
+    camera_rays.setup( scene->camera, width, height );
+
+    active_threads = num_threads;
+    if ( active_threads > 1 ) {
+        tiles.reset( width, height, TILE_SIZE, active_threads );
+    }
+
+    // work out what the last trace left to redo
+    updating = incremental && !progressive;
+    if ( updating ) {
+        num_updates = cache.plan( prepared, camera_rays, width, height );
+    } else {
+        cache.clear();
+    }
+
+    // pixels kept from the last trace keep their float colors too
+    if ( hdr_enabled && !( updating && num_updates < width * height ) ) {
+        hdr.resize( width, height );
+    }
+
+    if ( progressive ) {
+        samples.reset( width, height );
+        pass = 0;
+        progressive_start = timer_seconds();
+    }
+
+    if ( profiling ) {
+        pixel_costs.assign( width * height, 0.0f );
+    }
+
+    states.resize( active_threads );
+    for ( size_t i = 0; i < active_threads; ++i ) {
+        states[i].reset( scene->num_lights() );
+        states[i].profiling = profiling;
+        states[i].profile.reset( profiling ? scene->num_geometries() : 0 );
+        states[i].max_depth = max_depth;
+        states[i].min_weight = min_weight;
+        states[i].light_budget = light_budget;
+        states[i].frame = frame;
+        states[i].image_width = width;
+        states[i].pixel_spread = camera_rays.get_pixel_spread();
+    }
+
     return true;
 }
 
+void Raytracer::set_packet_width( size_t packet_width )
+{
+    size_t widest = detect_packet_width();
+    if ( packet_width == 0 || packet_width > widest ) {
+        packet_width = widest;
+    }
+    if ( packet_width >= 16 ) {
+        this->packet_width = 16;
+    } else if ( packet_width >= 8 ) {
+        this->packet_width = 8;
+    } else if ( packet_width >= 4 ) {
+        this->packet_width = 4;
+    } else {
+        this->packet_width = 1;
+    }
+}
+
+void Raytracer::set_light_culling( bool light_culling, size_t light_budget )
+{
+    if ( light_culling != this->light_culling || light_budget != this->light_budget ) {
+        cache.clear();
+    }
+    this->light_culling = light_culling;
+    this->light_budget = light_budget;
+}
+
+void Raytracer::set_frame( unsigned int frame )
+{
+    // kept pixels sampled their lights with the old frame's numbers
+    if ( frame != this->frame && light_culling && light_budget > 0 ) {
+        cache.clear();
+    }
+    this->frame = frame;
+}
+
+void Raytracer::set_profiling( bool profiling )
+{
+    this->profiling = profiling;
+}
+
+TraceProfile Raytracer::get_profile() const
+{
+    TraceProfile total;
+    for ( size_t i = 0; i < states.size(); ++i ) {
+        total.add( states[i].profile );
+    }
+    return total;
+}
+
+// the geometries tested most often, rays per depth and culled shadow rays
+void Raytracer::print_profile() const
+{
+    static const size_t NUM_WORST = 5;
+
+    TraceProfile profile = get_profile();
+    std::vector< std::pair< size_t, size_t > > tests;
+    for ( size_t i = 0; i < profile.geometry_tests.size(); ++i ) {
+        tests.push_back( std::make_pair( profile.geometry_tests[i], i ) );
+    }
+    size_t num_worst = std::min( NUM_WORST, tests.size() );
+    std::partial_sort( tests.begin(), tests.begin() + num_worst, tests.end(),
+                       std::greater< std::pair< size_t, size_t > >() );
+
+    printf( "Profile: %lu shadow rays culled\n", (unsigned long) profile.shadow_culled );
+    for ( size_t i = 0; i < profile.depth_rays.size(); ++i ) {
+        printf( "  depth %u: %lu rays\n", (unsigned int) i, (unsigned long) profile.depth_rays[i] );
+    }
+    for ( size_t i = 0; i < num_worst; ++i ) {
+        printf( "  geometry %u: %lu tests\n", (unsigned int) tests[i].second, (unsigned long) tests[i].first );
+    }
+}
+
+void Raytracer::set_hdr( bool hdr_enabled )
+{
+    // the float colors of kept pixels would be missing
+    if ( hdr_enabled != this->hdr_enabled ) {
+        cache.clear();
+    }
+    this->hdr_enabled = hdr_enabled;
+}
+
+void Raytracer::set_exposure( real_t exposure )
+{
+    this->exposure = exposure;
+}
+
+void Raytracer::tone_map( unsigned char* buffer ) const
+{
+    if ( hdr_enabled ) {
+        _462::tone_map( hdr.get_pixels(), width * height, exposure, buffer );
+    }
+}
+
+void Raytracer::set_region_listener( RegionListener* listener )
+{
+    this->listener = listener;
+}
+
+void Raytracer::set_wavefront( bool wavefront )
+{
+    this->wavefront = wavefront;
+}
+
+WavefrontStats Raytracer::get_wavefront_stats() const
+{
+    WavefrontStats total;
+    for ( size_t i = 0; i < states.size(); ++i ) {
+        total.add( states[i].wavefront_stats );
+    }
+    return total;
+}
+
+void Raytracer::set_progressive( bool progressive, real_t noise_threshold, real_t time_budget )
+{
+    this->progressive = progressive;
+    this->noise_threshold = noise_threshold;
+    this->time_budget = time_budget;
+}
+
+void Raytracer::set_max_samples( size_t max_samples )
+{
+    this->max_samples = max_samples > 0 ? max_samples : 1;
+}
+
+RayCounts Raytracer::get_ray_counts() const
+{
+    RayCounts total;
+    for ( size_t i = 0; i < states.size(); ++i ) {
+        total.add( states[i].counts );
+    }
+    return total;
+}
+
+void Raytracer::set_max_depth( int max_depth )
+{
+    max_depth = std::max( max_depth, 0 );
+    if ( max_depth != this->max_depth ) {
+        cache.clear();
+    }
+    this->max_depth = max_depth;
+}
+
+void Raytracer::set_min_weight( real_t min_weight )
+{
+    if ( min_weight != this->min_weight ) {
+        cache.clear();
+    }
+    this->min_weight = min_weight;
+}
+
+void Raytracer::set_verbose( bool verbose )
+{
+    this->verbose = verbose;
+}
+
+void Raytracer::set_incremental( bool incremental )
+{
+    this->incremental = incremental;
+}
+
+void Raytracer::set_num_threads( size_t num_threads )
+{
+    this->num_threads = num_threads > 0 ? num_threads : 1;
+}
+
+void Raytracer::geometry_changed( size_t index )
+{
+    prepared.mark_dirty( index );
+}
+
+void Raytracer::prepare_mesh( const Mesh* mesh )
+{
+    prepared.prepare_mesh( mesh );
+}
+
+void Raytracer::adopt_mesh_bvh( MeshBVH* bvh )
+{
+    prepared.adopt_mesh_bvh( bvh );
+}
+
+void Raytracer::forget_scene( const Scene* scene )
+{
+    prepared.forget_scene( scene );
+    if ( scene == this->scene ) {
+        cache.clear();
+        this->scene = 0;
+    }
+}
+
+void Raytracer::set_use_bvh( bool use_bvh )
+{
+    prepared.set_use_bvh( use_bvh );
+}
+
 static bool refract(RayInfo ray, Vector3 normal, real_t refractiveindex, RayInfo &refractionray)
 {
 	real_t sign = 1-refractiveindex*refractiveindex*(1-dot(ray.direction,normal)*dot(ray.direction,normal));
@@ -42,162 +312,381 @@ static bool refract(RayInfo ray, Vector3 normal, real_t refractiveindex, RayInfo
 
 }
 
-static Color3 raycolor(const Scene* scene, RayInfo ray, int n)
+// fills in the world position and normal of a hit found by closest_hit
+static void finish_intersection(const PreparedScene& prepared, IntersectionInfo& intersection, int index)
 {
-	Geometry* const* geometry = scene->get_geometries();
-	const PointLight* light = scene->get_lights();
-	IntersectionInfo intersection;
-	intersection.t0 = EP;
-	intersection.t1 = 1000000;
-	int index;
-	for(int i=0; i<scene->num_geometries();i++)
+	const GeometryTransform& hittransform = prepared.get_transform(index);
+	intersection.worldposition = hittransform.transform.transform_point(intersection.localposition);
+	const Matrix3& normalmatrix = hittransform.normal;
+	intersection.worldnormal = normalize(normalmatrix*intersection.localnormal);
+}
+
+// queues a secondary ray, unless it counts for too little to be worth tracing
+static void queue_ray(TraceState& state, const RayInfo& ray, const Color3& weight, int n)
+{
+	// drawn either way, so a pruned ray does not change its siblings' streams
+	SampleRandom random = state.random.branch();
+	if(std::max(weight.r, std::max(weight.g, weight.b)) < state.min_weight)
+		return;
+
+	PendingRay pending;
+	pending.ray = ray;
+	pending.weight = weight;
+	pending.depth = n;
+	pending.cone_width = state.hit_cone_width;
+	pending.pixel = 0;
+	pending.random = random;
+	state.pending.push_back(pending);
+}
+
+// notes what a ray of the pixel being recorded ran into, given the
+// finished intersection if it hit anything
+static void note_ray(const PreparedScene& prepared, PixelRecord& record, const PendingRay& ray, const IntersectionInfo& intersection, int index)
+{
+	if(index >= 0)
+		record.touch(index);
+	if(ray.depth == 0)
 	{
-		Matrix4 inversematrix;
-		make_inverse_transformation_matrix(&inversematrix, geometry[i]->position, geometry[i]->orientation, geometry[i]->scale );
-		RayInfo rayinformation;
-		rayinformation.origin = inversematrix.transform_point(ray.origin);
-		rayinformation.direction = inversematrix.transform_vector(ray.direction);	
-		bool check = geometry[i]->check_geometry(rayinformation,intersection);
-		
-		if(check)
-		{
-			index = i;
-		}
+		record.geometry = index;
+		if(index >= 0)
+			record.position = intersection.worldposition;
+		return;
 	}
 
-	Color3 color = Color3::Black;
-	if(intersection.t1 != 1000000)
+	record.bounced = true;
+	record.reach(ray.ray.origin);
+	if(index >= 0)
 	{
-			Matrix4 transmatrix;
-		    make_transformation_matrix(&transmatrix, geometry[index]->position, geometry[index]->orientation, geometry[index]->scale );
-		    intersection.worldposition = transmatrix.transform_point(intersection.localposition);
-			Matrix3 normalmatrix;
-			make_normal_matrix(&normalmatrix, transmatrix );
-			intersection.worldnormal = normalize(normalmatrix*intersection.localnormal);
-			color = intersection.material.ambient*scene->ambient_light;
-
-			for(int i=0; i<scene->num_lights();i++)
-			{   
-				RayInfo shadowworldrayinfo;
-				shadowworldrayinfo.origin = intersection.worldposition;
-				shadowworldrayinfo.direction = normalize(light[i].position - intersection.worldposition);
-				bool hit = false;
-				IntersectionInfo shadowintersection;
-				shadowintersection.t0 = EP;
-				shadowintersection.t1 = length(light[i].position - intersection.worldposition);
-				real_t d = dot(intersection.worldnormal,shadowworldrayinfo.direction);
-				if(d > 0)
-				{
-					for(int j=0; j<scene->num_geometries();j++)
-					{
-						Matrix4 shadowinversematrix;
-						make_inverse_transformation_matrix(&shadowinversematrix, geometry[j]->position, geometry[j]->orientation, geometry[j]->scale );
-						RayInfo shadowlocalrayinfo;
-						shadowlocalrayinfo.origin = shadowinversematrix.transform_point(shadowworldrayinfo.origin);
-						shadowlocalrayinfo.direction = shadowinversematrix.transform_vector(shadowworldrayinfo.direction);	
-						bool check = geometry[j]->check_geometry(shadowlocalrayinfo,shadowintersection);
-						if(check == true)
-						{
-								hit = true;
-								break;
-						}
-					 }
-					if(hit == false)
-					{
-						color = color + intersection.material.diffuse*light[i].color*d;
-					}
-				}
-			}
-			RayInfo reflectionworldrayinfo;
-			reflectionworldrayinfo.origin = intersection.worldposition;
-			Vector3 r = ray.direction - 2*dot(ray.direction,intersection.worldnormal)*intersection.worldnormal;
-			reflectionworldrayinfo.direction = normalize(r);
-			n++;
-			
-			if(intersection.material.refractive_index != 0)
-			{
-				real_t judge = dot(ray.direction,intersection.worldnormal);
-				real_t c;
-				RayInfo refractionworldrayinfo;
-				refractionworldrayinfo.origin = intersection.worldposition;
-				real_t refractiveratio = scene->refractive_index/intersection.material.refractive_index;
+		record.reach(intersection.worldposition);
+	}
+	else
+	{
+		record.escaped = true;
+		record.reach(exit_point(ray.ray.origin, ray.ray.direction, prepared.get_bvh().get_bounds()));
+	}
+}
+
+// the direct light at a hit from the lights the light tree chooses for it,
+// attenuated and scaled by the weight each choice carries. n is the depth
+// of the ray that hit, as in shade.
+static Color3 shade_chosen_lights( const PreparedScene& prepared, TraceState& state,
+                                   const IntersectionInfo& intersection, int n )
+{
+    const PointLight* light = prepared.get_scene()->get_lights();
+    std::vector< LightChoice >& choices = state.light_choices;
+    size_t behind = prepared.get_light_tree().choose( intersection.worldposition, intersection.worldnormal,
+                                                      state.light_budget, state.random.next(),
+                                                      state.light_candidates, choices );
+    if ( state.profiling ) {
+        state.profile.shadow_culled += behind;
+    }
+
+    Color3 color = Color3::Black;
+    for ( size_t k = 0; k < choices.size(); ++k ) {
+        unsigned int i = choices[k].light;
+        RayInfo shadowray;
+        shadowray.origin = intersection.worldposition;
+        shadowray.direction = normalize( light[i].position - intersection.worldposition );
+        real_t distance = length( light[i].position - intersection.worldposition );
+        real_t d = dot( intersection.worldnormal, shadowray.direction );
+
+        if ( state.record && n > 0 ) {
+            state.record->reach( light[i].position );
+        }
+        bool blocked = prepared.occluded( shadowray, EP, distance, &state.last_occluder[i],
+                                          state.geometry_tests() );
+        state.counts.shadow++;
+        if ( blocked ) {
+            if ( state.record ) {
+                state.record->touch( state.last_occluder[i] );
+            }
+            continue;
+        }
+
+        real_t scale = d * light_attenuation( light[i], distance ) * choices[k].weight;
+        color = color + intersection.material.diffuse * light[i].color * scale;
+    }
+    return color;
+}
 
-				if(judge<0)
+// colors a finished intersection reached with the given weight. returns
+// what the hit adds to the pixel itself and queues its reflection and
+// refraction rays on state.pending. if lightvisible is given, it holds the
+// outcome of each light's shadow ray, already traced by the caller. with
+// light culling the light tree picks the lights instead.
+static Color3 shade(const PreparedScene& prepared, TraceState& state, const RayInfo& ray, const IntersectionInfo& intersection, int n, const Color3& weight, const unsigned char* lightvisible)
+{
+	const Scene* scene = prepared.get_scene();
+	const PointLight* light = scene->get_lights();
+	Color3 color = intersection.material.ambient*scene->ambient_light;
+
+	if(prepared.get_light_tree().is_built())
+	{
+		color = color + shade_chosen_lights(prepared, state, intersection, n);
+	}
+	else
+	{
+		for(int i=0; i<scene->num_lights();i++)
+		{   
+			RayInfo shadowworldrayinfo;
+			shadowworldrayinfo.origin = intersection.worldposition;
+			shadowworldrayinfo.direction = normalize(light[i].position - intersection.worldposition);
+			real_t lightdistance = length(light[i].position - intersection.worldposition);
+			real_t d = dot(intersection.worldnormal,shadowworldrayinfo.direction);
+			if(d > 0)
+			{
+				if(state.record && n > 0)
+					state.record->reach(light[i].position);
+				bool hit;
+				if(lightvisible)
 				{
-					
-					refract(ray, intersection.worldnormal, refractiveratio,refractionworldrayinfo);
-					c = -dot(ray.direction,intersection.worldnormal);
+					hit = !lightvisible[i];
 				}
 				else
 				{
-					if(refract(ray, -intersection.worldnormal, 1/refractiveratio,refractionworldrayinfo))
-					{
-						c = dot(refractionworldrayinfo.direction,intersection.worldnormal);
-					}
-					else
-					{
-						if(n<=MAXNUMBER)
-						{
-							return intersection.material.specular*raycolor(scene,reflectionworldrayinfo,n);
-						}
-					}
+					hit = prepared.occluded(shadowworldrayinfo, EP, lightdistance, &state.last_occluder[i], state.geometry_tests());
+					state.counts.shadow++;
+					if(hit && state.record)
+						state.record->touch(state.last_occluder[i]);
+				}
+				if(hit == false)
+				{
+					color = color + intersection.material.diffuse*light[i].color*d;
 				}
-				  real_t R0 = (intersection.material.refractive_index-1)*(intersection.material.refractive_index-1)/(intersection.material.refractive_index+1)/(intersection.material.refractive_index+1);
-			      real_t R = R0 + (1-R0)*pow(1-c,5);
-				  if(n<=MAXNUMBER)
-				  {
-					return intersection.material.specular*(R*raycolor(scene,reflectionworldrayinfo,n) + (1-R)*raycolor(scene,refractionworldrayinfo,n));
-				  }
+			}
+			else if(state.profiling)
+			{
+				state.profile.shadow_culled++;
+			}
+		}
+	}
+	RayInfo reflectionworldrayinfo;
+	reflectionworldrayinfo.origin = intersection.worldposition;
+	Vector3 r = ray.direction - 2*dot(ray.direction,intersection.worldnormal)*intersection.worldnormal;
+	reflectionworldrayinfo.direction = normalize(r);
+	n++;
+	
+	if(intersection.material.refractive_index != 0)
+	{
+		real_t judge = dot(ray.direction,intersection.worldnormal);
+		real_t c;
+		RayInfo refractionworldrayinfo;
+		refractionworldrayinfo.origin = intersection.worldposition;
+		real_t refractiveratio = scene->refractive_index/intersection.material.refractive_index;
+
+		if(judge<0)
+		{
+			
+			refract(ray, intersection.worldnormal, refractiveratio,refractionworldrayinfo);
+			c = -dot(ray.direction,intersection.worldnormal);
+		}
+		else
+		{
+			if(refract(ray, -intersection.worldnormal, 1/refractiveratio,refractionworldrayinfo))
+			{
+				c = dot(refractionworldrayinfo.direction,intersection.worldnormal);
 			}
 			else
 			{
-				if(n<=MAXNUMBER)
+				if(n<=state.max_depth)
 				{
-					color = color + intersection.material.specular*raycolor(scene,reflectionworldrayinfo,n);
+					queue_ray(state, reflectionworldrayinfo, weight*intersection.material.specular, n);
+					return Color3::Black;
 				}
 			}
-			return color;
-			
+		}
+		  real_t R0 = (intersection.material.refractive_index-1)*(intersection.material.refractive_index-1)/(intersection.material.refractive_index+1)/(intersection.material.refractive_index+1);
+	      real_t R = R0 + (1-R0)*pow(1-c,5);
+		  if(n<=state.max_depth)
+		  {
+			queue_ray(state, reflectionworldrayinfo, weight*intersection.material.specular*R, n);
+			queue_ray(state, refractionworldrayinfo, weight*intersection.material.specular*(1-R), n);
+			return Color3::Black;
+		  }
 	}
+	else
+	{
+		if(n<=state.max_depth)
+		{
+			queue_ray(state, reflectionworldrayinfo, weight*intersection.material.specular, n);
+		}
+	}
+	return weight*color;
+}
+
+// traces everything queued on state.pending, and whatever those rays queue
+// in turn, returning the sum of what they add to the pixel
+static Color3 trace_pending(const PreparedScene& prepared, TraceState& state, Color3 color = Color3::Black)
+{
+	while(!state.pending.empty())
+	{
+		PendingRay current = state.pending.back();
+		state.pending.pop_back();
+
+		if(current.depth == 0)
+			state.counts.primary++;
+		else
+			state.counts.secondary++;
+		if(state.profiling)
+			state.profile.count_depth(current.depth);
 
-	return scene->background_color;
+		IntersectionInfo intersection;
+		intersection.t0 = EP;
+		intersection.t1 = 1000000;
+		RayCone cone(current.cone_width, state.pixel_spread);
+		int index = prepared.closest_hit(current.ray, intersection, state.geometry_tests(), &cone);
+		if(index >= 0)
+			finish_intersection(prepared, intersection, index);
 
+		if(state.record)
+			note_ray(prepared, *state.record, current, intersection, index);
+
+		if(index >= 0)
+		{
+			state.hit_cone_width = cone.width_at(current.ray, intersection.t1);
+			state.random = current.random;
+			color = color + shade(prepared, state, current.ray, intersection, current.depth, current.weight, 0);
+		}
+		else
+		{
+			color = color + current.weight*prepared.get_scene()->background_color;
+		}
+	}
+
+	return color;
 }
 
+// random is the stream of the pixel sample the ray belongs to
+static Color3 raycolor(const PreparedScene& prepared, TraceState& state, const RayInfo& ray, const SampleRandom& random)
+{
+	PendingRay primary;
+	primary.ray = ray;
+	primary.weight = Color3::White;
+	primary.depth = 0;
+	primary.cone_width = 0;
+	primary.pixel = 0;
+	primary.random = random;
+	state.pending.push_back(primary);
+	return trace_pending(prepared, state);
+}
 
  // Performs a raytrace on the current scene
-static Color3 trace_pixel( const Scene* scene, size_t x, size_t y, size_t width, size_t height )
+static Color3 trace_pixel( const PreparedScene& prepared, TraceState& state, const RayInfo& eyeray, const SampleRandom& random )
 {
-    assert( 0 <= x && x < width );
-    assert( 0 <= y && y < height );
+	return raycolor(prepared,state, eyeray, random);
+}
 
-	Vector3 camposition = scene->camera.get_position();
-	Vector3 camdirection = scene ->camera.get_direction();
-	Vector3 camup = scene ->camera.get_up();
-	real_t camdegree = scene ->camera.get_fov_radians();
-	real_t camratio = scene->camera.get_aspect_ratio();
-	real_t camdistance = scene ->camera.get_near_clip();
+// traces a pixel afresh, noting what its rays run into in record
+static Color3 retrace_pixel(const PreparedScene& prepared, TraceState& state, const RayInfo& eyeray, const SampleRandom& random, PixelRecord& record)
+{
+	record.clear();
+	state.record = &record;
+	Color3 color = trace_pixel(prepared, state, eyeray, random);
+	state.record = 0;
+	return color;
+}
 
-	Vector3 camright = normalize(cross(camdirection, camup));
-	real_t pixelheight = camdistance*tan(camdegree/2)/(height/2);
-	real_t pixelwidth = camdistance*tan(camdegree/2)*camratio/(width/2);
+// shades a pixel again from the primary hit in record, testing only the
+// geometry it hit. adds up exactly as raycolor does, so the result is the
+// same as tracing the pixel afresh.
+static Color3 reshade_pixel(const PreparedScene& prepared, TraceState& state, const RayInfo& eyeray, const SampleRandom& random, PixelRecord& record)
+{
+	int geometry = record.geometry;
+	IntersectionInfo intersection;
+	intersection.t0 = EP;
+	intersection.t1 = 1000000;
+	RayCone cone(0, state.pixel_spread);
+	if(geometry >= 0 && !prepared.check_geometry(geometry, eyeray, intersection, &cone))
+		return retrace_pixel(prepared, state, eyeray, random, record);
+
+	state.counts.primary++;
+	if(state.profiling)
+		state.profile.count_depth(0);
 
-    real_t x0 = (real_t)x-width/2+0.5;
-	real_t y0 = (real_t)y-height/2+0.5;
-	Vector3 raydirection = normalize(camdistance*camdirection + y0*pixelheight*camup + x0*pixelwidth*camright);
-	RayInfo eyeray;
-	eyeray.origin = camposition;
-	eyeray.direction = raydirection;
-	return raycolor(scene, eyeray, 0);
+	record.clear();
+	if(geometry < 0)
+		return Color3::Black + Color3::White*prepared.get_scene()->background_color;
+
+	if(size_t* tests = state.geometry_tests())
+		tests[geometry]++;
+	finish_intersection(prepared, intersection, geometry);
+	record.geometry = geometry;
+	record.position = intersection.worldposition;
+	record.touch(geometry);
+
+	state.record = &record;
+	state.hit_cone_width = cone.width_at(eyeray, intersection.t1);
+	state.random = random;
+	Color3 color = Color3::Black + shade(prepared, state, eyeray, intersection, 0, Color3::White, 0);
+	color = trace_pending(prepared, state, color);
+	state.record = 0;
+	return color;
 }
 
 //  Raytraces some portion of the scene
 bool Raytracer::raytrace( unsigned char *buffer, real_t* max_time )
+{
+    bool is_done;
+    if ( progressive ) {
+        is_done = raytrace_progressive( buffer, max_time );
+    } else if ( active_threads > 1 ) {
+        is_done = raytrace_tiles( buffer, max_time );
+    } else {
+        is_done = raytrace_rows( buffer, max_time );
+    }
+
+    if ( is_done && updating ) {
+        cache.finish();
+    }
+
+    if ( !is_done || !verbose ) {
+        return is_done;
+    }
+
+    if ( updating ) {
+        printf( "Updated %u of %u pixels\n", (unsigned int) num_updates,
+                (unsigned int) ( width * height ) );
+    }
+
+    if ( profiling ) {
+        print_profile();
+    }
+
+    if ( wavefront && !progressive ) {
+        // times are summed over threads, so they can exceed the wall time
+        WavefrontStats stats = get_wavefront_stats();
+        printf( "Wavefront: %u waves, %u rays, %u shadow rays\n",
+                (unsigned int) stats.waves, (unsigned int) stats.rays,
+                (unsigned int) stats.shadow_rays );
+        printf( "  generate %.3fs, intersect %.3fs, sort %.3fs, shadow %.3fs, shade %.3fs\n",
+                stats.generate, stats.intersect, stats.sort, stats.shadow, stats.shade );
+    }
+
+    return is_done;
+}
+
+void Raytracer::raytrace_region( unsigned char* buffer, const Tile& region )
+{
+    assert( !progressive );
+
+    if ( active_threads > 1 ) {
+        tiles.reset( region, TILE_SIZE, active_threads );
+        raytrace_tiles( buffer, 0 );
+        return;
+    }
+
+    for ( size_t y = region.y0; y < region.y1; ++y ) {
+        Tile row = { region.x0, y, region.x1, y + 1 };
+        render_region( states[0], buffer, row );
+    }
+}
+
+bool Raytracer::raytrace_rows( unsigned char *buffer, real_t* max_time )
 {
     static const size_t PRINT_INTERVAL = 64;
 
     unsigned int end_time = 0;
-    bool is_done;
+    bool is_done = false;
 
     if ( max_time ) {
         // convert duration to milliseconds
@@ -205,10 +694,12 @@ bool Raytracer::raytrace( unsigned char *buffer, real_t* max_time )
         end_time = SDL_GetTicks() + duration;
     }
 
+    TraceState& state = states[0];
+
     // until time is up, run the raytrace. we render an entire row at once
     for ( ; !max_time || end_time > SDL_GetTicks(); ++current_row ) {
 
-        if ( current_row % PRINT_INTERVAL == 0 ) {
+        if ( current_row % PRINT_INTERVAL == 0 && !progressive && verbose ) {
             printf( "Raytracing (row %u)...\n", current_row );
         }
 
@@ -217,19 +708,582 @@ bool Raytracer::raytrace( unsigned char *buffer, real_t* max_time )
         if ( is_done )
             break;
 
-        for ( size_t x = 0; x < width; ++x ) {
-            // trace a pixel
-            Color3 color = trace_pixel( scene, x, current_row, width, height );
-            color.to_array( &buffer[4 * ( current_row * width + x )] );
+        Tile row = { 0, current_row, width, current_row + 1 };
+        render_region( state, buffer, row );
+    }
+
+    if ( is_done && !progressive && verbose ) {
+        printf( "Done raytracing!\n" );
+    }
+
+    return is_done;
+}
+
+// Traces the pixels of block that lie inside region as one packet. Shadow
+// rays stay packed as long as every primary ray hit the same geometry;
+// otherwise, and for all secondary rays, shading falls back to one ray at
+// a time.
+static void trace_packet( const PreparedScene& prepared, const CameraRayGenerator& camera_rays,
+                          TraceState& state, size_t packet_width, const Tile& block,
+                          const Tile& region, const FrameTarget& target )
+{
+    const Scene* scene = prepared.get_scene();
+    const PointLight* light = scene->get_lights();
+    size_t num_lights = scene->num_lights();
+    size_t block_width = block.x1 - block.x0;
+
+    RayPacket packet( packet_width );
+    RayInfo rays[MAX_PACKET_WIDTH];
+    IntersectionInfo intersections[MAX_PACKET_WIDTH];
+    int index[MAX_PACKET_WIDTH];
+
+    camera_rays.fill_packet( block, region, &packet );
+    for ( size_t lane = 0; lane < packet_width; ++lane ) {
+        if ( packet.active[lane] ) {
+            rays[lane] = packet.get_ray( lane );
+            ++state.counts.primary;
+            if ( state.profiling ) {
+                state.profile.count_depth( 0 );
+            }
         }
     }
 
-    if ( is_done ) {
+    packet_closest_hit( prepared, packet, EP );
+
+    // resolve each hit with the geometry's own test, so shading sees exactly
+    // what the scalar path would
+    RayCone cone( 0, state.pixel_spread );
+    int first = -1;
+    bool coherent = true;
+    for ( size_t lane = 0; lane < packet_width; ++lane ) {
+        if ( !packet.active[lane] )
+            continue;
+
+        IntersectionInfo& intersection = intersections[lane];
+        intersection.t0 = EP;
+        intersection.t1 = 1000000;
+        index[lane] = packet.hit[lane];
+        if ( index[lane] >= 0 && !prepared.check_geometry( index[lane], rays[lane], intersection, &cone ) ) {
+            intersection.t1 = 1000000;
+            index[lane] = prepared.closest_hit( rays[lane], intersection, state.geometry_tests(), &cone );
+        }
+        if ( index[lane] >= 0 ) {
+            finish_intersection( prepared, intersection, index[lane] );
+        }
+
+        if ( first < 0 ) {
+            first = (int) lane;
+        }
+        coherent = coherent && index[lane] >= 0 && index[lane] == index[first];
+    }
+
+    if ( first < 0 )
+        return;
+
+    // lights chosen per hit cannot be shadow tested as a packet
+    bool packed_shadows = coherent && !prepared.get_light_tree().is_built();
+    std::vector< unsigned char >& visible = state.light_visible;
+    if ( packed_shadows ) {
+        visible.assign( packet_width * num_lights, 0 );
+        for ( size_t i = 0; i < num_lights; ++i ) {
+            RayPacket shadow( packet_width );
+            for ( size_t lane = 0; lane < packet_width; ++lane ) {
+                if ( !packet.active[lane] )
+                    continue;
+                const IntersectionInfo& intersection = intersections[lane];
+                RayInfo shadowray;
+                shadowray.origin = intersection.worldposition;
+                shadowray.direction = normalize( light[i].position - intersection.worldposition );
+                if ( dot( intersection.worldnormal, shadowray.direction ) > 0 ) {
+                    shadow.set_ray( lane, shadowray, length( light[i].position - intersection.worldposition ) );
+                    ++state.counts.shadow;
+                }
+            }
+
+            unsigned char blocked[MAX_PACKET_WIDTH] = { 0 };
+            packet_occluded( prepared, shadow, EP, blocked );
+            for ( size_t lane = 0; lane < packet_width; ++lane ) {
+                visible[lane * num_lights + i] = !blocked[lane];
+            }
+        }
+    }
+
+    for ( size_t lane = 0; lane < packet_width; ++lane ) {
+        if ( !packet.active[lane] )
+            continue;
+
+        size_t x = block.x0 + lane % block_width;
+        size_t y = block.y0 + lane / block_width;
+        Color3 color = scene->background_color;
+        if ( index[lane] >= 0 ) {
+            const unsigned char* lightvisible = packed_shadows && num_lights ? &visible[lane * num_lights] : 0;
+            state.hit_cone_width = cone.width_at( rays[lane], intersections[lane].t1 );
+            state.random = state.pixel_random( x, y, 0 );
+            color = shade( prepared, state, rays[lane], intersections[lane], 0, Color3::White, lightvisible );
+            color = color + trace_pending( prepared, state );
+        }
+        target.store( x, y, color );
+    }
+}
+
+// Traces a region breadth first: all of its primary rays, then every ray
+// they spawn, and so on. Each wave is intersected in bulk and its hits are
+// sorted by geometry, so the shadow and shading stages that follow work
+// through one geometry's hits at a time.
+static void trace_wavefront( const PreparedScene& prepared, const CameraRayGenerator& camera_rays,
+                             TraceState& state, const Tile& region, const FrameTarget& target )
+{
+    const Scene* scene = prepared.get_scene();
+    const PointLight* light = scene->get_lights();
+    size_t num_lights = scene->num_lights();
+    size_t region_width = region.x1 - region.x0;
+
+    std::vector< PendingRay >& wave = state.wave;
+    std::vector< PendingRay >& next_wave = state.next_wave;
+    std::vector< Color3 >& color = state.wave_color;
+    WavefrontStats& stats = state.wavefront_stats;
+
+    {
+        StageTimer timer( &stats.generate );
+
+        std::vector< RayInfo >& rays = state.primary_rays;
+        rays.resize( region_width );
+        wave.clear();
+        for ( size_t y = region.y0; y < region.y1; ++y ) {
+            camera_rays.generate_row( y, region.x0, region.x1, &rays[0] );
+            for ( size_t x = 0; x < region_width; ++x ) {
+                PendingRay primary;
+                primary.ray = rays[x];
+                primary.weight = Color3::White;
+                primary.depth = 0;
+                primary.cone_width = 0;
+                primary.pixel = (unsigned int) wave.size();
+                primary.random = state.pixel_random( region.x0 + x, y, 0 );
+                wave.push_back( primary );
+            }
+        }
+        color.assign( wave.size(), Color3::Black );
+    }
+
+    while ( !wave.empty() ) {
+        ++stats.waves;
+        stats.rays += wave.size();
+
+        state.scratch.reset();
+        WaveHit* hits = state.scratch.allocate_array< WaveHit >( wave.size() );
+        size_t num_hits = 0;
+        unsigned long long* order = 0;
+        unsigned char* visible = 0;
+
+        {
+            StageTimer timer( &stats.intersect );
+
+            for ( size_t i = 0; i < wave.size(); ++i ) {
+                if ( wave[i].depth == 0 ) {
+                    ++state.counts.primary;
+                } else {
+                    ++state.counts.secondary;
+                }
+                if ( state.profiling ) {
+                    state.profile.count_depth( wave[i].depth );
+                }
+
+                WaveHit& hit = hits[num_hits];
+                hit.intersection.t0 = EP;
+                hit.intersection.t1 = 1000000;
+                RayCone cone( wave[i].cone_width, state.pixel_spread );
+                hit.geometry = prepared.closest_hit( wave[i].ray, hit.intersection, state.geometry_tests(), &cone );
+                if ( hit.geometry >= 0 ) {
+                    finish_intersection( prepared, hit.intersection, hit.geometry );
+                    hit.ray = (unsigned int) i;
+                    ++num_hits;
+                } else {
+                    Color3& pixel = color[wave[i].pixel];
+                    pixel = pixel + wave[i].weight * scene->background_color;
+                }
+            }
+        }
+
+        {
+            StageTimer timer( &stats.sort );
+
+            // geometry in the high bits, so ties keep the wave's order
+            order = state.scratch.allocate_array< unsigned long long >( num_hits );
+            for ( size_t i = 0; i < num_hits; ++i ) {
+                order[i] = (unsigned long long) hits[i].geometry << 32 | i;
+            }
+            std::sort( order, order + num_hits );
+        }
+
+        {
+            StageTimer timer( &stats.shadow );
+
+            // one light at a time, so the occluder cache stays warm. lights
+            // chosen per hit are left to the shading stage.
+            visible = state.scratch.allocate_array< unsigned char >( num_hits * num_lights );
+            for ( size_t i = 0; i < num_lights && !prepared.get_light_tree().is_built(); ++i ) {
+                for ( size_t k = 0; k < num_hits; ++k ) {
+                    size_t h = (size_t) ( order[k] & 0xffffffff );
+                    const IntersectionInfo& intersection = hits[h].intersection;
+
+                    RayInfo shadowray;
+                    shadowray.origin = intersection.worldposition;
+                    shadowray.direction = normalize( light[i].position - intersection.worldposition );
+                    if ( dot( intersection.worldnormal, shadowray.direction ) <= 0 )
+                        continue;
+
+                    real_t distance = length( light[i].position - intersection.worldposition );
+                    visible[h * num_lights + i] =
+                        !prepared.occluded( shadowray, EP, distance, &state.last_occluder[i],
+                                            state.geometry_tests() );
+                    ++stats.shadow_rays;
+                    ++state.counts.shadow;
+                }
+            }
+        }
+
+        {
+            StageTimer timer( &stats.shade );
+
+            next_wave.clear();
+            // lights chosen per hit fire their shadow rays from shade
+            size_t shadow_before = state.counts.shadow;
+            for ( size_t k = 0; k < num_hits; ++k ) {
+                size_t h = (size_t) ( order[k] & 0xffffffff );
+                const PendingRay& ray = wave[hits[h].ray];
+
+                // whatever shade queues becomes part of the next wave
+                state.pending.clear();
+                const unsigned char* lightvisible = num_lights && !prepared.get_light_tree().is_built()
+                    ? &visible[h * num_lights] : 0;
+                Color3& pixel = color[ray.pixel];
+                RayCone cone( ray.cone_width, state.pixel_spread );
+                state.hit_cone_width = cone.width_at( ray.ray, hits[h].intersection.t1 );
+                state.random = ray.random;
+                pixel = pixel + shade( prepared, state, ray.ray, hits[h].intersection,
+                                       ray.depth, ray.weight, lightvisible );
+
+                for ( size_t j = 0; j < state.pending.size(); ++j ) {
+                    next_wave.push_back( state.pending[j] );
+                    next_wave.back().pixel = ray.pixel;
+                }
+            }
+            state.pending.clear();
+            if ( prepared.get_light_tree().is_built() ) {
+                stats.shadow_rays += state.counts.shadow - shadow_before;
+            }
+        }
+
+        wave.swap( next_wave );
+    }
+
+    for ( size_t i = 0; i < color.size(); ++i ) {
+        size_t x = region.x0 + i % region_width;
+        size_t y = region.y0 + i / region_width;
+        target.store( x, y, color[i] );
+    }
+}
+
+// Runs progressive passes until the image converges or time is up. Each
+// pass goes through the row or tile machinery as a normal trace would,
+// adding one sample to every pixel that is still noisy.
+bool Raytracer::raytrace_progressive( unsigned char* buffer, real_t* max_time )
+{
+    double slice_start = timer_seconds();
+
+    while ( true ) {
+        real_t remaining = 0;
+        if ( max_time ) {
+            remaining = *max_time - (real_t) ( timer_seconds() - slice_start );
+            // time is kept in whole milliseconds; less than one would
+            // trace nothing
+            if ( remaining < 0.001 )
+                return false;
+        }
+
+        real_t* slice = max_time ? &remaining : 0;
+        bool pass_done = active_threads > 1
+            ? raytrace_tiles( buffer, slice )
+            : raytrace_rows( buffer, slice );
+        if ( !pass_done )
+            return false;
+
+        if ( finish_pass() )
+            return true;
+    }
+}
+
+// Decides which pixels need another sample once a pass is over. Returns
+// true if none do, or the sample or time budget is spent, and otherwise
+// sets up the next pass.
+bool Raytracer::finish_pass()
+{
+    ++pass;
+    size_t num_active = samples.update_active( noise_threshold, MIN_PROGRESSIVE_SAMPLES );
+    bool out_of_time = time_budget > 0 && timer_seconds() - progressive_start >= time_budget;
+
+    if ( verbose ) {
+        printf( "Pass %u: %u of %u pixels still noisy\n", (unsigned int) pass,
+                (unsigned int) num_active, (unsigned int) samples.size() );
+    }
+
+    if ( num_active == 0 || pass >= max_samples || out_of_time ) {
+        if ( verbose ) {
+            printf( "Done raytracing!\n" );
+        }
+        return true;
+    }
+
+    current_row = 0;
+    if ( active_threads > 1 ) {
+        tiles.reset( width, height, TILE_SIZE, active_threads );
+    }
+    return false;
+}
+
+// Adds one sample to every active pixel of a region and shows the new
+// average. The first pass samples pixel centers, as a normal trace would.
+void Raytracer::render_samples( TraceState& state, const FrameTarget& target, const Tile& region )
+{
+    for ( size_t y = region.y0; y < region.y1; ++y ) {
+        for ( size_t x = region.x0; x < region.x1; ++x ) {
+            size_t pixel = y * width + x;
+            if ( !samples.is_active( pixel ) )
+                continue;
+
+            real_t jitter_x, jitter_y;
+            sample_jitter( frame, pixel, pass, &jitter_x, &jitter_y );
+            RayInfo ray = camera_rays.generate( x, y, jitter_x, jitter_y );
+            double start = profiling ? timer_seconds() : 0;
+            samples.add( pixel, trace_pixel( prepared, state, ray, state.pixel_random( x, y, pass ) ) );
+            if ( profiling ) {
+                pixel_costs[pixel] += (float) ( timer_seconds() - start );
+            }
+            target.store( x, y, samples.mean( pixel ) );
+        }
+    }
+}
+
+// Raytraces tiles on active_threads threads until the queue is empty or time is
+// up. A tile is always finished once started, so a slice may run over by up
+// to one tile per thread.
+bool Raytracer::raytrace_tiles( unsigned char *buffer, real_t* max_time )
+{
+    std::vector< WorkerArgs > args( active_threads );
+    std::vector< SDL_Thread* > threads( active_threads, (SDL_Thread*) 0 );
+
+    unsigned int end_time = 0;
+    if ( max_time ) {
+        // convert duration to milliseconds
+        unsigned int duration = (unsigned int) ( *max_time * 1000 );
+        end_time = SDL_GetTicks() + duration;
+    }
+
+    for ( size_t i = 0; i < active_threads; ++i ) {
+        args[i].raytracer = this;
+        args[i].buffer = buffer;
+        args[i].worker = i;
+        args[i].timed = max_time != 0;
+        args[i].end_time = end_time;
+    }
+
+    // the calling thread is worker 0
+    for ( size_t i = 1; i < active_threads; ++i ) {
+        threads[i] = SDL_CreateThread( worker_main, &args[i] );
+    }
+    render_tiles( args[0] );
+    for ( size_t i = 1; i < active_threads; ++i ) {
+        if ( threads[i] ) {
+            SDL_WaitThread( threads[i], 0 );
+        } else {
+            // could not spawn the thread, so do its share here
+            render_tiles( args[i] );
+        }
+    }
+
+    size_t remaining = tiles.remaining();
+    bool is_done = remaining == 0;
+
+    if ( progressive || !verbose ) {
+        // passes report their own progress
+    } else if ( is_done ) {
         printf( "Done raytracing!\n" );
+    } else {
+        printf( "Raytracing (%u of %u tiles left)...\n", (unsigned int) remaining, (unsigned int) tiles.total() );
     }
 
     return is_done;
 }
 
-} 
+int Raytracer::worker_main( void* data )
+{
+    WorkerArgs* args = (WorkerArgs*) data;
+    args->raytracer->render_tiles( *args );
+    return 0;
+}
+
+// Traces tiles for one worker. Tiles never overlap, so every worker writes
+// straight into the shared buffer without locking.
+void Raytracer::render_tiles( const WorkerArgs& args )
+{
+    TraceState& state = states[args.worker];
+    Tile tile;
+
+    while ( !args.timed || args.end_time > SDL_GetTicks() ) {
+        if ( !tiles.pop( args.worker, &tile ) )
+            break;
+
+        render_region( state, args.buffer, tile );
+    }
+}
+
+// Traces a region and reports it as finished
+void Raytracer::render_region( TraceState& state, unsigned char* buffer, const Tile& region )
+{
+    FrameTarget target;
+    target.rgba = buffer;
+    target.hdr = hdr_enabled ? &hdr : 0;
+    target.width = width;
+
+    trace_region( state, target, region );
+
+    if ( hdr_enabled ) {
+        tone_map_region( hdr, region, exposure, buffer );
+    }
+
+    if ( listener ) {
+        listener->region_done( buffer, width, height, region );
+    }
+}
+
+// Traces every pixel of a region, one at a time, in packets or as wavefronts
+void Raytracer::trace_region( TraceState& state, const FrameTarget& target, const Tile& region )
+{
+    if ( progressive ) {
+        render_samples( state, target, region );
+        return;
+    }
+
+    if ( updating ) {
+        update_region( state, target, region );
+        return;
+    }
+
+    if ( wavefront ) {
+        // a wave mixes every pixel of the region, so they share its cost
+        double start = profiling ? timer_seconds() : 0;
+        trace_wavefront( prepared, camera_rays, state, region, target );
+        if ( profiling ) {
+            charge_cost( region, timer_seconds() - start );
+        }
+        return;
+    }
+
+    if ( packet_width <= 1 ) {
+        std::vector< RayInfo >& rays = state.primary_rays;
+        rays.resize( region.x1 - region.x0 );
+        for ( size_t y = region.y0; y < region.y1; ++y ) {
+            camera_rays.generate_row( y, region.x0, region.x1, &rays[0] );
+            for ( size_t x = region.x0; x < region.x1; ++x ) {
+                // trace a pixel
+                double start = profiling ? timer_seconds() : 0;
+                Color3 color = trace_pixel( prepared, state, rays[x - region.x0], state.pixel_random( x, y, 0 ) );
+                if ( profiling ) {
+                    pixel_costs[y * width + x] += (float) ( timer_seconds() - start );
+                }
+                target.store( x, y, color );
+            }
+        }
+        return;
+    }
+
+    // packets cover a block as close to square as the region allows
+    size_t block_height = packet_width == 16 ? 4 : 2;
+    block_height = std::min( block_height, region.y1 - region.y0 );
+    size_t block_width = packet_width / block_height;
+
+    for ( size_t y = region.y0; y < region.y1; y += block_height ) {
+        for ( size_t x = region.x0; x < region.x1; x += block_width ) {
+            Tile block;
+            block.x0 = x;
+            block.y0 = y;
+            block.x1 = x + block_width;
+            block.y1 = y + block_height;
+
+            double start = profiling ? timer_seconds() : 0;
+            trace_packet( prepared, camera_rays, state, packet_width, block, region, target );
+            if ( profiling ) {
+                block.x1 = std::min( block.x1, region.x1 );
+                block.y1 = std::min( block.y1, region.y1 );
+                charge_cost( block, timer_seconds() - start );
+            }
+        }
+    }
+}
+
+// Redoes the pixels of a region that the cache says changed since the last
+// trace, leaving the others as they are
+void Raytracer::update_region( TraceState& state, const FrameTarget& target, const Tile& region )
+{
+    for ( size_t y = region.y0; y < region.y1; ++y ) {
+        for ( size_t x = region.x0; x < region.x1; ++x ) {
+            size_t pixel = y * width + x;
+            PixelUpdate update = cache.get_update( pixel );
+            if ( update == PIXEL_KEEP )
+                continue;
+
+            double start = profiling ? timer_seconds() : 0;
+            RayInfo ray = camera_rays.generate( x, y );
+            PixelRecord& record = cache.get_record( pixel );
+            SampleRandom random = state.pixel_random( x, y, 0 );
+            Color3 color = update == PIXEL_RESHADE
+                ? reshade_pixel( prepared, state, ray, random, record )
+                : retrace_pixel( prepared, state, ray, random, record );
+            if ( profiling ) {
+                pixel_costs[pixel] += (float) ( timer_seconds() - start );
+            }
+            target.store( x, y, color );
+        }
+    }
+}
+
+// Spreads time spent on an area evenly over its pixels
+void Raytracer::charge_cost( const Tile& area, double seconds )
+{
+    float share = (float) ( seconds / ( ( area.x1 - area.x0 ) * ( area.y1 - area.y0 ) ) );
+    for ( size_t y = area.y0; y < area.y1; ++y ) {
+        for ( size_t x = area.x0; x < area.x1; ++x ) {
+            pixel_costs[y * width + x] += share;
+        }
+    }
+}
+
+// Colors each pixel by its share of the trace time, from black through
+// blue, red and yellow to white. The scale tops out at the 99th
+// percentile, so a few very slow pixels do not wash out the rest.
+void Raytracer::make_heatmap( unsigned char* rgba ) const
+{
+    static const float RAMP[5][3] = {
+        { 0, 0, 0 }, { 0, 0, 1 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 } };
+
+    if ( pixel_costs.empty() )
+        return;
+
+    std::vector< float > sorted( pixel_costs );
+    size_t rank = sorted.size() * 99 / 100;
+    std::nth_element( sorted.begin(), sorted.begin() + rank, sorted.end() );
+    float scale = sorted[rank] > 0 ? sorted[rank] : 1;
+
+    for ( size_t i = 0; i < pixel_costs.size(); ++i ) {
+        float t = std::min( pixel_costs[i] / scale, 1.0f ) * 4;
+        int low = std::min( (int) t, 3 );
+        float f = t - low;
+        for ( int c = 0; c < 3; ++c ) {
+            float v = RAMP[low][c] * ( 1 - f ) + RAMP[low + 1][c] * f;
+            rgba[4 * i + c] = (unsigned char) ( v * 255 );
+        }
+        rgba[4 * i + 3] = 255;
+    }
+}
 
+}
\ No newline at end of file
@@ -1,14 +1,35 @@
-
 #ifndef _462_RAYTRACER_HPP_
 #define _462_RAYTRACER_HPP_
 #define EP 0.00001
 #define MAXNUMBER 3
 
 #include "math/color.hpp"
+#include "camera_rays.hpp"
+#include "framebuffer.hpp"
+#include "prepared_scene.hpp"
+#include "progressive.hpp"
+#include "render_cache.hpp"
+#include "tile_queue.hpp"
+#include "trace_state.hpp"
+#include <vector>
 
 namespace _462 {
 
 class Scene;
+class Mesh;
+
+// told about each region of the image as soon as its pixels are final.
+// called from whichever thread traced the region.
+class RegionListener
+{
+public:
+
+    virtual ~RegionListener() { }
+
+    // buffer is the whole width x height rgba image being traced
+    virtual void region_done( const unsigned char* buffer, size_t width, size_t height,
+                              const Tile& region ) = 0;
+};
 
 class Raytracer
 {
@@ -22,8 +43,175 @@ public:
 
     bool raytrace( unsigned char* buffer, real_t* max_time );
 
+    // traces just one region of the image into buffer, split over the
+    // tracing threads, leaving the rest of the buffer alone. for rendering
+    // an image piecewise; not for progressive mode.
+    void raytrace_region( unsigned char* buffer, const Tile& region );
+
+    // number of threads raytrace uses; 1 traces rows on the calling thread,
+    // anything larger renders tiles in parallel. takes effect on initialize.
+    void set_num_threads( size_t num_threads );
+
+    size_t get_num_threads() const { return num_threads; }
+
+    // rays traced together as a packet: 1 traces one ray at a time (the
+    // default), 4, 8 or 16 use packets of that width, and 0 picks the widest
+    // the cpu supports. widths beyond the cpu are clamped to what it has.
+    void set_packet_width( size_t packet_width );
+
+    // traces each tile or row as a series of waves, intersecting and
+    // shading all rays of a wave together, instead of pixel by pixel. the
+    // time spent in each stage is printed when a trace finishes.
+    void set_wavefront( bool wavefront );
+
+    // stage times and ray counts of wavefront traces since initialize
+    WavefrontStats get_wavefront_stats() const;
+
+    // renders in passes of one jittered sample per pixel, averaging them
+    // into the buffer after every pass. pixels stop being sampled once the
+    // standard error of their brightness is under noise_threshold, and
+    // the whole trace stops when no pixel is left, after time_budget
+    // seconds (0 for no limit) or at the sample cap. takes effect on
+    // initialize.
+    void set_progressive( bool progressive, real_t noise_threshold, real_t time_budget );
+
+    // most samples any pixel gets in progressive mode
+    void set_max_samples( size_t max_samples );
+
+    // rays traced since initialize, over all threads
+    RayCounts get_ray_counts() const;
+
+    // how many reflection/refraction bounces are traced after the primary
+    // hit. defaults to MAXNUMBER. takes effect on initialize.
+    void set_max_depth( int max_depth );
+
+    // secondary rays whose weight in every channel is below this are
+    // dropped. 0 traces everything. takes effect on initialize.
+    void set_min_weight( real_t min_weight );
+
+    // shades each hit only with the lights whose attenuation leaves them
+    // bright enough to matter there, found through a tree of their reach.
+    // with a budget, a hit reached by more lights than that fires shadow
+    // rays at budget of them, drawn by their estimated contribution and
+    // weighted to make up for the rest. 0 shades every light that matters.
+    // unlike the default shading, attenuation is applied. takes effect on
+    // initialize.
+    void set_light_culling( bool light_culling, size_t light_budget );
+
+    // which frame of an animation is traced, which keys every random
+    // number drawn for its pixels, so each frame's sampling differs while
+    // any one frame comes out the same whatever the threads, tiles, packet
+    // width or machine. defaults to 0. takes effect on initialize.
+    void set_frame( unsigned int frame );
+
+    // gathers per-geometry test counts, rays per bounce depth, culled
+    // shadow rays and the time spent on every pixel, printing a summary
+    // when a trace finishes. takes effect on initialize.
+    void set_profiling( bool profiling );
+
+    bool is_profiling() const { return profiling; }
+
+    // the counts gathered since initialize, over all threads
+    TraceProfile get_profile() const;
+
+    // seconds spent on each pixel, laid out like the rgba buffer. packets
+    // and wavefronts share their time out evenly over their pixels.
+    const std::vector< float >& get_pixel_costs() const { return pixel_costs; }
+
+    // renders the pixel costs as a width x height rgba image
+    void make_heatmap( unsigned char* rgba ) const;
+
+    // keeps the traced colors in a float framebuffer as well, and fills
+    // the rgba buffer by tone mapping it region by region. takes effect on
+    // initialize.
+    void set_hdr( bool hdr_enabled );
+
+    // scale applied to colors before they are clamped to 8 bits, in hdr
+    // mode. defaults to 1, which matches the plain rgba output.
+    void set_exposure( real_t exposure );
+
+    real_t get_exposure() const { return exposure; }
+
+    // requantises the whole float framebuffer into buffer at the current
+    // exposure, without tracing anything. does nothing outside hdr mode.
+    void tone_map( unsigned char* buffer ) const;
+
+    // the float framebuffer, or null outside hdr mode
+    const HDRFramebuffer* get_hdr() const { return hdr_enabled ? &hdr : 0; }
+
+    // reports every finished row or tile to listener, or to nobody if
+    // null. in progressive mode regions are reported after every pass.
+    void set_region_listener( RegionListener* listener );
+
+    // whether progress and summaries are printed while tracing; on by
+    // default
+    void set_verbose( bool verbose );
+
+    // remembers what every pixel hit, so the next trace of the same scene
+    // from the same camera only redoes the pixels that changed lights,
+    // materials or moved geometries can reach, and keeps the rest of the
+    // buffer as the last trace left it. pixels are then traced one at a
+    // time, whatever the packet width; progressive rendering turns it off.
+    // takes effect on initialize.
+    void set_incremental( bool incremental );
+
+    // tells the raytracer a geometry's transform changed outside of its
+    // position/orientation/scale; rebuilt on the next initialize
+    void geometry_changed( size_t index );
+
+    // builds the raytracing data for a freshly loaded mesh. meshes not
+    // prepared here are prepared on initialize.
+    void prepare_mesh( const Mesh* mesh );
+
+    // takes ownership of a mesh bvh built while loading, as prepare_mesh
+    // would have built it
+    void adopt_mesh_bvh( MeshBVH* bvh );
+
+    // lets go of everything built for a scene before it is freed. what is
+    // built is found by address, so a scene freed without this could have
+    // its data handed to the next one allocated in its place.
+    void forget_scene( const Scene* scene );
+
+    // whether rays are traced through the bvh (the default) or tested
+    // against every geometry, for checking the bvh against
+    void set_use_bvh( bool use_bvh );
+
 private:
 
+    // per-thread arguments for a parallel raytrace slice
+    struct WorkerArgs
+    {
+        Raytracer* raytracer;
+        unsigned char* buffer;
+        size_t worker;
+        bool timed;
+        unsigned int end_time;
+    };
+
+    static int worker_main( void* data );
+
+    bool raytrace_rows( unsigned char* buffer, real_t* max_time );
+
+    bool raytrace_tiles( unsigned char* buffer, real_t* max_time );
+
+    void render_tiles( const WorkerArgs& args );
+
+    bool raytrace_progressive( unsigned char* buffer, real_t* max_time );
+
+    bool finish_pass();
+
+    void render_samples( TraceState& state, const FrameTarget& target, const Tile& region );
+
+    void render_region( TraceState& state, unsigned char* buffer, const Tile& region );
+
+    void trace_region( TraceState& state, const FrameTarget& target, const Tile& region );
+
+    void update_region( TraceState& state, const FrameTarget& target, const Tile& region );
+
+    void charge_cost( const Tile& area, double seconds );
+
+    void print_profile() const;
+
     // the scene to trace
     Scene* scene;
 
@@ -33,9 +221,72 @@ private:
     // the next row to raytrace
     size_t current_row;
 
+    // number of threads requested, and the number the current trace uses
+    size_t num_threads, active_threads;
+
+    // rays per packet, 1 when not tracing packets
+    size_t packet_width;
+
+    // whether regions are traced as wavefronts
+    bool wavefront;
+
+    // bounce limit and pruning threshold for secondary rays
+    int max_depth;
+    real_t min_weight;
+
+    // whether lights are culled by reach, and the shadow rays each hit may
+    // fire if so
+    bool light_culling;
+    size_t light_budget;
+
+    // the frame random numbers are keyed by
+    unsigned int frame;
+
+    // told about finished regions, if set
+    RegionListener* listener;
+
+    // whether traces reuse the last one, whether the current one does, and
+    // how many pixels it redoes
+    bool incremental, updating;
+    size_t num_updates;
+    RenderCache cache;
+
+    // whether progress is printed
+    bool verbose;
+
+    // whether profiling, and the time spent on each pixel if so
+    bool profiling;
+    std::vector< float > pixel_costs;
+
+    // float framebuffer and its exposure, if enabled
+    bool hdr_enabled;
+    HDRFramebuffer hdr;
+    real_t exposure;
+
+    // progressive rendering settings, the passes done so far, and when
+    // the first one started
+    bool progressive;
+    real_t noise_threshold, time_budget;
+    size_t max_samples, pass;
+    double progressive_start;
+
+    // running sums of every pixel's samples
+    SampleBuffer samples;
+
+    // transforms and other data derived from the scene
+    PreparedScene prepared;
+
+    // primary rays of the current camera and image size
+    CameraRayGenerator camera_rays;
+
+    // tiles not yet traced, when tracing in parallel
+    TileQueue tiles;
+
+    // scratch state for each thread
+    std::vector< TraceState > states;
+
 };
 
 } 
 
 #endif 
-
@@ -0,0 +1,252 @@
+#include "render_cache.hpp"
+#include "prepared_scene.hpp"
+#include "scene/material.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace _462 {
+
+static bool same_color( const Color3& a, const Color3& b )
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static bool same_light( const PointLight& a, const PointLight& b )
+{
+    return a.position == b.position && same_color( a.color, b.color )
+        && a.attenuation.constant == b.attenuation.constant
+        && a.attenuation.linear == b.attenuation.linear
+        && a.attenuation.quadratic == b.attenuation.quadratic;
+}
+
+// whether origin + t * direction crosses box for some t in [0, limit]
+static bool crosses( const Vector3& origin, const Vector3& direction, real_t limit,
+                     const BoundingBox& box )
+{
+    real_t tmin = 0, tmax = limit;
+    for ( int i = 0; i < 3; ++i ) {
+        if ( direction[i] == 0 ) {
+            if ( origin[i] < box.lower[i] || origin[i] > box.upper[i] )
+                return false;
+            continue;
+        }
+        real_t t0 = ( box.lower[i] - origin[i] ) / direction[i];
+        real_t t1 = ( box.upper[i] - origin[i] ) / direction[i];
+        if ( t0 > t1 ) {
+            std::swap( t0, t1 );
+        }
+        if ( t0 > tmin ) tmin = t0;
+        if ( t1 < tmax ) tmax = t1;
+        if ( tmin > tmax )
+            return false;
+    }
+    return true;
+}
+
+// whether inner lies entirely within outer
+static bool contains( const BoundingBox& outer, const BoundingBox& inner )
+{
+    for ( int i = 0; i < 3; ++i ) {
+        if ( inner.lower[i] < outer.lower[i] || inner.upper[i] > outer.upper[i] )
+            return false;
+    }
+    return true;
+}
+
+void PixelRecord::clear()
+{
+    geometry = -1;
+    touched = 0;
+    bounced = escaped = false;
+    for ( int i = 0; i < 3; ++i ) {
+        reach_lower[i] = HUGE_VALF;
+        reach_upper[i] = -HUGE_VALF;
+    }
+}
+
+void PixelRecord::reach( const Vector3& point )
+{
+    for ( int i = 0; i < 3; ++i ) {
+        // round outwards, so the box never shrinks below the real one
+        float lower = (float) point[i], upper = lower;
+        if ( lower > point[i] ) lower = nextafterf( lower, -HUGE_VALF );
+        if ( upper < point[i] ) upper = nextafterf( upper, HUGE_VALF );
+        reach_lower[i] = std::min( reach_lower[i], lower );
+        reach_upper[i] = std::max( reach_upper[i], upper );
+    }
+}
+
+bool PixelRecord::may_reach( const BoundingBox& box ) const
+{
+    for ( int i = 0; i < 3; ++i ) {
+        if ( reach_lower[i] > box.upper[i] || reach_upper[i] < box.lower[i] )
+            return false;
+    }
+    return true;
+}
+
+Vector3 exit_point( const Vector3& origin, const Vector3& direction, const BoundingBox& box )
+{
+    real_t t = HUGE_VAL;
+    for ( int i = 0; i < 3; ++i ) {
+        if ( direction[i] > 0 ) {
+            t = std::min( t, ( box.upper[i] - origin[i] ) / direction[i] );
+        } else if ( direction[i] < 0 ) {
+            t = std::min( t, ( box.lower[i] - origin[i] ) / direction[i] );
+        }
+    }
+    return t > 0 && t < HUGE_VAL ? origin + direction * t : origin;
+}
+
+RenderCache::RenderCache()
+    : complete( false ), scene( 0 ), num_geometries( 0 ), refractive_index( 0 ) { }
+
+void RenderCache::clear()
+{
+    complete = false;
+}
+
+size_t RenderCache::plan( const PreparedScene& prepared, const CameraRayGenerator& camera_rays,
+                          size_t width, size_t height )
+{
+    const Scene* scene = prepared.get_scene();
+    size_t size = width * height;
+
+    bool retrace_all = !complete || scene != this->scene
+        || records.size() != size || !camera.same_rays( camera_rays )
+        || prepared.num_geometries() != num_geometries
+        || scene->num_lights() != lights.size()
+        || scene->num_materials() != materials.size();
+
+    if ( retrace_all ) {
+        records.resize( size );
+        updates.assign( size, PIXEL_RETRACE );
+        take_snapshot( prepared, camera_rays );
+        scene_bounds = prepared.get_bvh().get_bounds();
+        return size;
+    }
+
+    updates.assign( size, same_shading( scene ) ? PIXEL_KEEP : PIXEL_RESHADE );
+
+    const std::vector< unsigned int >& moved = prepared.get_moved();
+    for ( size_t m = 0; m < moved.size(); ++m ) {
+        const BoundingBox& bounds = prepared.get_world_bounds( moved[m] );
+        unsigned long long bit = 1ULL << ( moved[m] % 64 );
+        // escaping rays were only followed as far as the old scene bounds
+        bool escapes_seen = contains( scene_bounds, bounds );
+
+        // without bounds, nothing can be ruled out
+        if ( bounds.empty() ) {
+            updates.assign( size, PIXEL_RETRACE );
+            break;
+        }
+
+        for ( size_t y = 0; y < height; ++y ) {
+            for ( size_t x = 0; x < width; ++x ) {
+                size_t pixel = y * width + x;
+                const PixelRecord& record = records[pixel];
+                if ( updates[pixel] == PIXEL_RETRACE )
+                    continue;
+                if ( ( record.touched & bit )
+                        || ( record.bounced && record.may_reach( bounds ) )
+                        || ( record.escaped && !escapes_seen )
+                        || reaches( record, camera_rays.generate( x, y ), bounds ) ) {
+                    updates[pixel] = PIXEL_RETRACE;
+                }
+            }
+        }
+    }
+
+    take_snapshot( prepared, camera_rays );
+
+    // kept records were cut off at the old bounds, new ones will be at the
+    // new bounds, so only where the two overlap is every escape followed
+    BoundingBox bounds = prepared.get_bvh().get_bounds();
+    for ( int i = 0; i < 3; ++i ) {
+        scene_bounds.lower[i] = std::max( scene_bounds.lower[i], bounds.lower[i] );
+        scene_bounds.upper[i] = std::min( scene_bounds.upper[i], bounds.upper[i] );
+    }
+
+    size_t work = 0;
+    for ( size_t i = 0; i < size; ++i ) {
+        if ( updates[i] != PIXEL_KEEP ) {
+            ++work;
+        }
+    }
+    return work;
+}
+
+bool RenderCache::same_shading( const Scene* scene ) const
+{
+    if ( !same_color( scene->ambient_light, ambient_light )
+            || !same_color( scene->background_color, background_color )
+            || scene->refractive_index != refractive_index ) {
+        return false;
+    }
+
+    const PointLight* scene_lights = scene->get_lights();
+    for ( size_t i = 0; i < lights.size(); ++i ) {
+        if ( !same_light( scene_lights[i], lights[i] ) )
+            return false;
+    }
+
+    Material* const* scene_materials = scene->get_materials();
+    for ( size_t i = 0; i < materials.size(); ++i ) {
+        const Material& material = *scene_materials[i];
+        const MaterialValues& values = materials[i];
+        if ( !same_color( material.ambient, values.ambient )
+                || !same_color( material.diffuse, values.diffuse )
+                || !same_color( material.specular, values.specular )
+                || material.refractive_index != values.refractive_index ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void RenderCache::take_snapshot( const PreparedScene& prepared, const CameraRayGenerator& camera_rays )
+{
+    const Scene* scene = prepared.get_scene();
+    this->scene = scene;
+    num_geometries = scene->num_geometries();
+    camera = camera_rays;
+    complete = false;
+
+    lights.assign( scene->get_lights(), scene->get_lights() + scene->num_lights() );
+
+    Material* const* scene_materials = scene->get_materials();
+    materials.resize( scene->num_materials() );
+    for ( size_t i = 0; i < materials.size(); ++i ) {
+        materials[i].ambient = scene_materials[i]->ambient;
+        materials[i].diffuse = scene_materials[i]->diffuse;
+        materials[i].specular = scene_materials[i]->specular;
+        materials[i].refractive_index = scene_materials[i]->refractive_index;
+    }
+
+    ambient_light = scene->ambient_light;
+    background_color = scene->background_color;
+    refractive_index = scene->refractive_index;
+}
+
+bool RenderCache::reaches( const PixelRecord& record, const RayInfo& primary,
+                           const BoundingBox& bounds ) const
+{
+    // the primary ray up to its hit; camera rays are normalized
+    if ( record.geometry < 0 )
+        return crosses( primary.origin, primary.direction, HUGE_VAL, bounds );
+    real_t distance = dot( record.position - primary.origin, primary.direction );
+    if ( crosses( primary.origin, primary.direction, distance, bounds ) )
+        return true;
+
+    // the shadow rays from the hit towards every light
+    const PointLight* scene_lights = scene->get_lights();
+    for ( size_t i = 0; i < scene->num_lights(); ++i ) {
+        if ( crosses( record.position, scene_lights[i].position - record.position, 1, bounds ) )
+            return true;
+    }
+    return false;
+}
+
+} /* _462 */
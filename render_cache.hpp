@@ -0,0 +1,130 @@
+#ifndef _462_RAYTRACER_RENDER_CACHE_HPP_
+#define _462_RAYTRACER_RENDER_CACHE_HPP_
+
+#include "bounds.hpp"
+#include "camera_rays.hpp"
+#include "math/color.hpp"
+#include "math/vector.hpp"
+#include "scene/scene.hpp"
+#include <vector>
+
+namespace _462 {
+
+class PreparedScene;
+
+// the work a pixel needs on the next trace
+enum PixelUpdate
+{
+    // the pixel is still right
+    PIXEL_KEEP,
+    // its primary hit still holds, but it must be shaded again
+    PIXEL_RESHADE,
+    // everything must be traced again
+    PIXEL_RETRACE
+};
+
+// what the rays of one traced pixel ran into
+struct PixelRecord
+{
+    // the geometry the primary ray hit, or -1, and where it hit it
+    int geometry;
+    Vector3 position;
+    // bit i % 64 is set for every geometry i that a ray of the pixel hit,
+    // or that blocked one of its shadow rays
+    unsigned long long touched;
+    // whether the pixel traced any reflection or refraction rays, and
+    // whether any of them left the scene
+    bool bounced, escaped;
+    // a box around those rays and the shadow rays cast where they hit,
+    // with escaping rays cut off where they leave the scene
+    float reach_lower[3], reach_upper[3];
+
+    void clear();
+
+    void touch( int index ) { touched |= 1ULL << ( index % 64 ); }
+
+    void reach( const Vector3& point );
+
+    // whether the secondary rays may have crossed box
+    bool may_reach( const BoundingBox& box ) const;
+};
+
+// where a ray starting inside box leaves it
+Vector3 exit_point( const Vector3& origin, const Vector3& direction, const BoundingBox& box );
+
+/**
+ * Remembers what every pixel of the last trace hit, and enough of the scene
+ * to tell what has changed since, so tracing a slightly changed scene only
+ * redoes the pixels the change can reach.
+ *
+ * A changed camera, image size or set of lights and materials retraces
+ * everything. Edited lights, materials or scene colors reshade every pixel
+ * from its cached primary hit, skipping the primary intersection. A moved
+ * geometry retraces the pixels whose rays hit it or were blocked by it
+ * before, and those whose rays may cross its new bounds: the primary ray
+ * and its shadow rays are tested exactly, the rest through the box around
+ * them.
+ *
+ * Each record is only ever written by the thread tracing its pixel.
+ */
+class RenderCache
+{
+public:
+
+    RenderCache();
+
+    // forgets the last trace, so the next plan retraces everything
+    void clear();
+
+    // works out what every pixel needs to catch up with the scene as
+    // prepared, and returns how many pixels need any work. the records of
+    // those pixels must be brought up to date by the trace that follows.
+    size_t plan( const PreparedScene& prepared, const CameraRayGenerator& camera_rays,
+                 size_t width, size_t height );
+
+    // marks the planned trace as finished; until then, the next plan
+    // retraces everything
+    void finish() { complete = true; }
+
+    PixelUpdate get_update( size_t pixel ) const { return (PixelUpdate) updates[pixel]; }
+
+    PixelRecord& get_record( size_t pixel ) { return records[pixel]; }
+
+private:
+
+    // the material values shading depends on
+    struct MaterialValues
+    {
+        Color3 ambient, diffuse, specular;
+        real_t refractive_index;
+    };
+
+    // whether everything shading reads is as it was at the last plan
+    bool same_shading( const Scene* scene ) const;
+
+    void take_snapshot( const PreparedScene& prepared, const CameraRayGenerator& camera_rays );
+
+    // whether a ray of the pixel may cross bounds
+    bool reaches( const PixelRecord& record, const RayInfo& primary, const BoundingBox& bounds ) const;
+
+    std::vector< PixelRecord > records;
+    std::vector< unsigned char > updates;
+
+    // whether the records describe a whole trace
+    bool complete;
+
+    // the scene as the records saw it
+    const Scene* scene;
+    size_t num_geometries;
+    CameraRayGenerator camera;
+    std::vector< PointLight > lights;
+    std::vector< MaterialValues > materials;
+    Color3 ambient_light, background_color;
+    real_t refractive_index;
+    // the box every escaping ray on record was followed through
+    BoundingBox scene_bounds;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_RENDER_CACHE_HPP_ */
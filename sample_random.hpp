@@ -0,0 +1,64 @@
+#ifndef _462_RAYTRACER_SAMPLE_RANDOM_HPP_
+#define _462_RAYTRACER_SAMPLE_RANDOM_HPP_
+
+#include "math/math.hpp"
+#include <cstddef>
+
+namespace _462 {
+
+// the pcg hash: one step of pcg's generator followed by its output
+// permutation, which spreads every bit of x over every bit of the result
+inline unsigned int pcg_hash( unsigned int x )
+{
+    unsigned int state = x * 747796405u + 2891336453u;
+    unsigned int word = ( ( state >> ( ( state >> 28 ) + 4 ) ) ^ state ) * 277803737u;
+    return ( word >> 22 ) ^ word;
+}
+
+/**
+ * Random numbers for one ray, computed rather than stepped: the n-th
+ * number of a stream is a hash of its key and n, and a primary ray's key is
+ * a hash of the frame, pixel and sample. Each ray a hit spawns gets a
+ * stream of its own, keyed by a number drawn from its parent's. Nothing is
+ * shared and nothing depends on the order rays are traced in, so a pixel
+ * comes out the same on any thread, in any tile, packet or wave, and on
+ * any machine.
+ */
+class SampleRandom
+{
+public:
+
+    SampleRandom() : key( 0 ), counter( 0 ) { }
+
+    explicit SampleRandom( unsigned int key ) : key( key ), counter( 0 ) { }
+
+    SampleRandom( unsigned int frame, size_t pixel, size_t sample )
+        : key( pcg_hash( frame ^ pcg_hash( (unsigned int) pixel ^ pcg_hash( (unsigned int) sample ) ) ) ),
+          counter( 0 ) { }
+
+    unsigned int next_uint()
+    {
+        return pcg_hash( key ^ pcg_hash( counter++ ) );
+    }
+
+    // uniform in [0, 1)
+    real_t next()
+    {
+        return ( next_uint() >> 8 ) * ( (real_t) 1 / ( 1 << 24 ) );
+    }
+
+    // a stream for a ray spawned from this one
+    SampleRandom branch()
+    {
+        return SampleRandom( next_uint() );
+    }
+
+private:
+
+    unsigned int key;
+    unsigned int counter;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_SAMPLE_RANDOM_HPP_ */
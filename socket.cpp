@@ -0,0 +1,224 @@
+#include "socket.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace _462 {
+
+#ifndef _WIN32
+
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+// small messages go out at once instead of waiting to be batched, and
+// where sends cannot be told not to raise SIGPIPE, the socket is
+static void set_options( int handle )
+{
+    int on = 1;
+    setsockopt( handle, IPPROTO_TCP, TCP_NODELAY, (const char*) &on, sizeof on );
+#ifdef SO_NOSIGPIPE
+    setsockopt( handle, SOL_SOCKET, SO_NOSIGPIPE, (const char*) &on, sizeof on );
+#endif
+}
+
+#endif
+
+Socket::Socket() : handle( -1 ) { }
+
+Socket::~Socket()
+{
+    close();
+}
+
+void Socket::close()
+{
+#ifndef _WIN32
+    if ( handle >= 0 ) {
+        ::close( handle );
+    }
+#endif
+    handle = -1;
+}
+
+bool Socket::connect( const char* host, unsigned short port )
+{
+    close();
+
+#ifndef _WIN32
+    char service[16];
+    snprintf( service, sizeof service, "%u", (unsigned int) port );
+
+    addrinfo hints;
+    memset( &hints, 0, sizeof hints );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses;
+    if ( getaddrinfo( host, service, &hints, &addresses ) != 0 )
+        return false;
+
+    // a name may have several addresses, not all of them listening
+    for ( addrinfo* address = addresses; address; address = address->ai_next ) {
+        handle = socket( address->ai_family, address->ai_socktype, address->ai_protocol );
+        if ( handle < 0 )
+            continue;
+        if ( ::connect( handle, address->ai_addr, address->ai_addrlen ) == 0 )
+            break;
+        close();
+    }
+    freeaddrinfo( addresses );
+
+    if ( handle >= 0 ) {
+        set_options( handle );
+    }
+#endif
+    return handle >= 0;
+}
+
+bool Socket::listen( unsigned short port )
+{
+    close();
+
+#ifndef _WIN32
+    handle = socket( AF_INET, SOCK_STREAM, 0 );
+    if ( handle < 0 )
+        return false;
+
+    // a restarted coordinator can take its port back at once
+    int on = 1;
+    setsockopt( handle, SOL_SOCKET, SO_REUSEADDR, (const char*) &on, sizeof on );
+
+    sockaddr_in address;
+    memset( &address, 0, sizeof address );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_ANY );
+    address.sin_port = htons( port );
+    if ( bind( handle, (const sockaddr*) &address, sizeof address ) != 0
+            || ::listen( handle, SOMAXCONN ) != 0 ) {
+        close();
+    }
+#endif
+    return handle >= 0;
+}
+
+bool Socket::accept( Socket* connection )
+{
+    connection->close();
+
+#ifndef _WIN32
+    if ( handle < 0 )
+        return false;
+
+    int accepted;
+    do {
+        accepted = ::accept( handle, 0, 0 );
+    } while ( accepted < 0 && errno == EINTR );
+    if ( accepted < 0 )
+        return false;
+
+    set_options( accepted );
+    connection->handle = accepted;
+#endif
+    return connection->handle >= 0;
+}
+
+bool Socket::send( const void* data, size_t size )
+{
+#ifndef _WIN32
+    const char* next = (const char*) data;
+    while ( handle >= 0 && size > 0 ) {
+        ssize_t sent = ::send( handle, next, size, SEND_FLAGS );
+        if ( sent < 0 && errno == EINTR )
+            continue;
+        if ( sent <= 0 )
+            return false;
+        next += sent;
+        size -= (size_t) sent;
+    }
+    return handle >= 0;
+#else
+    (void) data;
+    (void) size;
+    return false;
+#endif
+}
+
+bool Socket::receive( void* data, size_t size )
+{
+    char* next = (char*) data;
+    while ( size > 0 ) {
+        long received = receive_some( next, size );
+        if ( received <= 0 )
+            return false;
+        next += received;
+        size -= (size_t) received;
+    }
+    return true;
+}
+
+long Socket::receive_some( void* data, size_t size )
+{
+#ifndef _WIN32
+    if ( handle < 0 )
+        return -1;
+
+    ssize_t received;
+    do {
+        received = recv( handle, (char*) data, size, 0 );
+    } while ( received < 0 && errno == EINTR );
+    return (long) received;
+#else
+    (void) data;
+    (void) size;
+    return -1;
+#endif
+}
+
+bool Socket::wait( const std::vector< Socket* >& sockets, double seconds,
+                   std::vector< unsigned char >* ready )
+{
+    ready->assign( sockets.size(), 0 );
+
+#ifndef _WIN32
+    fd_set readable;
+    FD_ZERO( &readable );
+    int highest = -1;
+    for ( size_t i = 0; i < sockets.size(); ++i ) {
+        int handle = sockets[i]->handle;
+        if ( handle >= 0 && handle < FD_SETSIZE ) {
+            FD_SET( handle, &readable );
+            highest = handle > highest ? handle : highest;
+        }
+    }
+
+    timeval timeout;
+    timeout.tv_sec = (long) seconds;
+    timeout.tv_usec = (long) ( ( seconds - (double) timeout.tv_sec ) * 1e6 );
+    if ( select( highest + 1, &readable, 0, 0, &timeout ) <= 0 )
+        return false;
+
+    for ( size_t i = 0; i < sockets.size(); ++i ) {
+        int handle = sockets[i]->handle;
+        ( *ready )[i] = handle >= 0 && handle < FD_SETSIZE && FD_ISSET( handle, &readable );
+    }
+    return true;
+#else
+    (void) seconds;
+    return false;
+#endif
+}
+
+} /* _462 */
@@ -0,0 +1,64 @@
+#ifndef _462_RAYTRACER_SOCKET_HPP_
+#define _462_RAYTRACER_SOCKET_HPP_
+
+#include <cstddef>
+#include <vector>
+
+namespace _462 {
+
+/**
+ * A tcp connection or listening socket, closed when destroyed. Sends never
+ * raise SIGPIPE; a lost peer just makes the call fail. Built on posix
+ * sockets; where those are missing, every call fails.
+ */
+class Socket
+{
+public:
+
+    Socket();
+
+    ~Socket();
+
+    // connects to port on host, a name or a numeric address
+    bool connect( const char* host, unsigned short port );
+
+    // listens for connections to port on every interface
+    bool listen( unsigned short port );
+
+    // takes the oldest pending connection of a listening socket into
+    // connection. blocks if there is none.
+    bool accept( Socket* connection );
+
+    // sends all of data, failing if the connection is lost part way
+    bool send( const void* data, size_t size );
+
+    // reads exactly size bytes, blocking until they are all in
+    bool receive( void* data, size_t size );
+
+    // reads whatever has arrived, up to size bytes, blocking only if
+    // nothing has. returns the count read, 0 once the peer has closed the
+    // connection, or -1 on error.
+    long receive_some( void* data, size_t size );
+
+    void close();
+
+    bool is_open() const { return handle >= 0; }
+
+    // waits up to seconds for any of sockets to have something to read, a
+    // connection to accept or a closed connection to report. sets ready[i]
+    // to whether sockets[i] does, and returns false if none does.
+    static bool wait( const std::vector< Socket* >& sockets, double seconds,
+                      std::vector< unsigned char >* ready );
+
+private:
+
+    // no meaningful copy
+    Socket( const Socket& );
+    Socket& operator=( const Socket& );
+
+    int handle;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_SOCKET_HPP_ */
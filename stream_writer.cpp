@@ -0,0 +1,170 @@
+#include "stream_writer.hpp"
+
+#include <SDL/SDL_mutex.h>
+#include <SDL/SDL_thread.h>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace _462 {
+
+StreamingImageWriter::StreamingImageWriter()
+    : file( 0 ), data_offset( 0 ), width( 0 ), height( 0 ), failed( false ),
+      thread( 0 ), stopping( false )
+{
+    lock = SDL_CreateMutex();
+    changed = SDL_CreateCond();
+}
+
+StreamingImageWriter::~StreamingImageWriter()
+{
+    finish();
+    SDL_DestroyCond( changed );
+    SDL_DestroyMutex( lock );
+}
+
+bool StreamingImageWriter::open( const char* filename, size_t width, size_t height )
+{
+    finish();
+
+    file = fopen( filename, "wb" );
+    if ( !file )
+        return false;
+
+    this->width = width;
+    this->height = height;
+    failed = false;
+
+    fprintf( file, "P6\n%u %u\n255\n", (unsigned int) width, (unsigned int) height );
+    data_offset = ftell( file );
+
+    // claim the whole image now, so it is readable however far we get
+    std::vector< unsigned char > row( 3 * width, 0 );
+    for ( size_t y = 0; y < height; ++y ) {
+        if ( fwrite( &row[0], 1, row.size(), file ) != row.size() ) {
+            failed = true;
+        }
+    }
+    fflush( file );
+
+    stopping = false;
+    thread = SDL_CreateThread( thread_main, this );
+    return true;
+}
+
+void StreamingImageWriter::region_done( const unsigned char* buffer, size_t width, size_t height,
+                                        const Tile& region )
+{
+    if ( !file || width != this->width || height != this->height )
+        return;
+
+    size_t region_width = region.x1 - region.x0;
+    Job job;
+    job.region = region;
+    job.pixels = (unsigned char*) malloc( 3 * region_width * ( region.y1 - region.y0 ) );
+    if ( !job.pixels ) {
+        throw std::bad_alloc();
+    }
+
+    unsigned char* out = job.pixels;
+    for ( size_t y = region.y0; y < region.y1; ++y ) {
+        const unsigned char* in = &buffer[4 * ( y * width + region.x0 )];
+        for ( size_t x = 0; x < region_width; ++x, in += 4, out += 3 ) {
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+        }
+    }
+
+    SDL_LockMutex( lock );
+    if ( thread ) {
+        jobs.push_back( job );
+        SDL_CondSignal( changed );
+    } else {
+        // no thread to hand it to, so write it here
+        if ( !write_job( job ) ) {
+            failed = true;
+        }
+        free( job.pixels );
+    }
+    SDL_UnlockMutex( lock );
+}
+
+bool StreamingImageWriter::finish()
+{
+    if ( thread ) {
+        SDL_LockMutex( lock );
+        stopping = true;
+        SDL_CondSignal( changed );
+        SDL_UnlockMutex( lock );
+
+        SDL_WaitThread( thread, 0 );
+        thread = 0;
+    }
+
+    if ( !file )
+        return !failed;
+
+    if ( fclose( file ) != 0 ) {
+        failed = true;
+    }
+    file = 0;
+    return !failed;
+}
+
+int StreamingImageWriter::thread_main( void* data )
+{
+    ( (StreamingImageWriter*) data )->run();
+    return 0;
+}
+
+// writes queued regions until told to stop and nothing is left
+void StreamingImageWriter::run()
+{
+    SDL_LockMutex( lock );
+
+    while ( true ) {
+        while ( jobs.empty() && !stopping ) {
+            SDL_CondWait( changed, lock );
+        }
+        if ( jobs.empty() )
+            break;
+
+        Job job = jobs.front();
+        jobs.pop_front();
+        SDL_UnlockMutex( lock );
+
+        bool ok = write_job( job );
+        free( job.pixels );
+
+        SDL_LockMutex( lock );
+        if ( !ok ) {
+            failed = true;
+        }
+    }
+
+    SDL_UnlockMutex( lock );
+}
+
+// writes a region's rows into place and flushes them. ppm rows run top to
+// bottom, the buffer's bottom to top.
+bool StreamingImageWriter::write_job( const Job& job )
+{
+    const Tile& region = job.region;
+    size_t row_size = 3 * ( region.x1 - region.x0 );
+    bool ok = true;
+
+    for ( size_t y = region.y0; y < region.y1; ++y ) {
+        size_t row = height - 1 - y;
+        long offset = data_offset + (long) ( 3 * ( row * width + region.x0 ) );
+        const unsigned char* pixels = job.pixels + ( y - region.y0 ) * row_size;
+        if ( fseek( file, offset, SEEK_SET ) != 0
+                || fwrite( pixels, 1, row_size, file ) != row_size ) {
+            ok = false;
+        }
+    }
+
+    return fflush( file ) == 0 && ok;
+}
+
+} /* _462 */
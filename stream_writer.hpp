@@ -0,0 +1,78 @@
+#ifndef _462_RAYTRACER_STREAM_WRITER_HPP_
+#define _462_RAYTRACER_STREAM_WRITER_HPP_
+
+#include "raytracer.hpp"
+#include <cstdio>
+#include <deque>
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+namespace _462 {
+
+/**
+ * Writes a binary ppm while it is being traced. The file is created at its
+ * full size up front, all black, and each region the raytracer finishes is
+ * copied out and written into place by a background thread, then flushed.
+ * If the process dies part way, everything traced so far is on disk and
+ * the file is still a valid image.
+ */
+class StreamingImageWriter : public RegionListener
+{
+public:
+
+    StreamingImageWriter();
+
+    // finishes any open file
+    virtual ~StreamingImageWriter();
+
+    // creates the file and starts the writer thread. returns false if the
+    // file could not be created.
+    bool open( const char* filename, size_t width, size_t height );
+
+    // queues the region's pixels to be written
+    virtual void region_done( const unsigned char* buffer, size_t width, size_t height,
+                              const Tile& region );
+
+    // writes everything still queued and closes the file. returns false if
+    // any write failed.
+    bool finish();
+
+private:
+
+    // the rgb pixels of a finished region, bottom row first like the buffer
+    struct Job
+    {
+        Tile region;
+        unsigned char* pixels;
+    };
+
+    static int thread_main( void* data );
+
+    void run();
+
+    bool write_job( const Job& job );
+
+    // no meaningful copy
+    StreamingImageWriter( const StreamingImageWriter& );
+    StreamingImageWriter& operator=( const StreamingImageWriter& );
+
+    FILE* file;
+    // where the pixel data starts, after the header
+    long data_offset;
+    size_t width, height;
+    bool failed;
+
+    SDL_mutex* lock;
+    // signalled whenever a job is queued or the thread should stop
+    SDL_cond* changed;
+    SDL_Thread* thread;
+
+    std::deque< Job > jobs;
+    bool stopping;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_STREAM_WRITER_HPP_ */
@@ -0,0 +1,170 @@
+#include "texture.hpp"
+#include "scene/material.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace _462 {
+
+// textures are stored in square tiles of 1 << TILE_BITS texels a side
+static const int TILE_BITS = 3;
+static const int TILE_MASK = ( 1 << TILE_BITS ) - 1;
+static const int TILE_TEXELS = 1 << ( 2 * TILE_BITS );
+
+// spreads the bits of a coordinate within a tile to every other bit
+static int spread_bits( int v )
+{
+    return ( v & 1 ) | ( v & 2 ) << 1 | ( v & 4 ) << 2;
+}
+
+static unsigned char to_byte( real_t value )
+{
+    return (unsigned char) std::min( std::max( value * 255 + (real_t) 0.5, (real_t) 0 ), (real_t) 255 );
+}
+
+// wraps a texel coordinate into [0, size)
+static int wrap( int i, int size )
+{
+    i %= size;
+    return i < 0 ? i + size : i;
+}
+
+MipTexture::MipTexture( const Material& material )
+{
+    int width, height;
+    material.get_texture_size( &width, &height );
+
+    std::vector< Color3 > image( width * height );
+    for ( int y = 0; y < height; ++y ) {
+        for ( int x = 0; x < width; ++x ) {
+            image[y * width + x] = material.get_texture_pixel( x, y );
+        }
+    }
+    add_level( image, width, height );
+
+    // each level averages 2x2 texels of the one above, repeating the last
+    // row or column of odd sizes
+    while ( width > 1 || height > 1 ) {
+        int next_width = std::max( width / 2, 1 );
+        int next_height = std::max( height / 2, 1 );
+        std::vector< Color3 > next( next_width * next_height );
+        for ( int y = 0; y < next_height; ++y ) {
+            int y0 = std::min( 2 * y, height - 1 ), y1 = std::min( 2 * y + 1, height - 1 );
+            for ( int x = 0; x < next_width; ++x ) {
+                int x0 = std::min( 2 * x, width - 1 ), x1 = std::min( 2 * x + 1, width - 1 );
+                next[y * next_width + x] = ( image[y0 * width + x0] + image[y0 * width + x1]
+                                             + image[y1 * width + x0] + image[y1 * width + x1] ) * 0.25;
+            }
+        }
+        image.swap( next );
+        width = next_width;
+        height = next_height;
+        add_level( image, width, height );
+    }
+}
+
+void MipTexture::add_level( const std::vector< Color3 >& image, int width, int height )
+{
+    Level level;
+    level.width = width;
+    level.height = height;
+    level.tiles_across = ( width + TILE_MASK ) >> TILE_BITS;
+    level.offset = texels.size() / 4;
+    levels.push_back( level );
+
+    int tiles_down = ( height + TILE_MASK ) >> TILE_BITS;
+    texels.resize( texels.size() + 4 * level.tiles_across * tiles_down * TILE_TEXELS, 0 );
+    for ( int y = 0; y < height; ++y ) {
+        for ( int x = 0; x < width; ++x ) {
+            unsigned char* texel = &texels[4 * texel_index( level, x, y )];
+            const Color3& color = image[y * width + x];
+            texel[0] = to_byte( color.r );
+            texel[1] = to_byte( color.g );
+            texel[2] = to_byte( color.b );
+            texel[3] = 255;
+        }
+    }
+}
+
+size_t MipTexture::texel_index( const Level& level, int x, int y ) const
+{
+    size_t tile = (size_t) ( y >> TILE_BITS ) * level.tiles_across + ( x >> TILE_BITS );
+    int within = spread_bits( x & TILE_MASK ) | spread_bits( y & TILE_MASK ) << 1;
+    return level.offset + tile * TILE_TEXELS + within;
+}
+
+real_t MipTexture::level_for( real_t texels )
+{
+    return texels > 1 ? log( texels ) / log( 2.0 ) : 0;
+}
+
+Color3 MipTexture::bilinear( const Level& level, real_t u, real_t v ) const
+{
+    // texel centers sit half a texel in from their edges
+    real_t x = ( u - floor( u ) ) * level.width - 0.5;
+    real_t y = ( v - floor( v ) ) * level.height - 0.5;
+    real_t fx = floor( x ), fy = floor( y );
+    real_t ax = x - fx, ay = y - fy;
+
+    int x0 = wrap( (int) fx, level.width ), x1 = wrap( (int) fx + 1, level.width );
+    int y0 = wrap( (int) fy, level.height ), y1 = wrap( (int) fy + 1, level.height );
+    const unsigned char* t00 = &texels[4 * texel_index( level, x0, y0 )];
+    const unsigned char* t10 = &texels[4 * texel_index( level, x1, y0 )];
+    const unsigned char* t01 = &texels[4 * texel_index( level, x0, y1 )];
+    const unsigned char* t11 = &texels[4 * texel_index( level, x1, y1 )];
+
+    real_t channel[3];
+    for ( int i = 0; i < 3; ++i ) {
+        real_t top = t00[i] + ( t10[i] - t00[i] ) * ax;
+        real_t bottom = t01[i] + ( t11[i] - t01[i] ) * ax;
+        channel[i] = ( top + ( bottom - top ) * ay ) / 255;
+    }
+    return Color3( channel[0], channel[1], channel[2] );
+}
+
+Color3 MipTexture::sample( real_t u, real_t v, real_t level ) const
+{
+    size_t last = levels.size() - 1;
+    if ( level <= 0 )
+        return bilinear( levels[0], u, v );
+    if ( level >= last )
+        return bilinear( levels[last], u, v );
+
+    size_t upper = (size_t) level;
+    real_t blend = level - upper;
+    Color3 fine = bilinear( levels[upper], u, v );
+    Color3 coarse = bilinear( levels[upper + 1], u, v );
+    return fine + ( coarse - fine ) * blend;
+}
+
+TextureStore::~TextureStore()
+{
+    clear();
+}
+
+const MipTexture* TextureStore::prepare( const Material* material )
+{
+    if ( !material || material->texture_filename.empty() )
+        return 0;
+
+    int width, height;
+    material->get_texture_size( &width, &height );
+    if ( width <= 0 || height <= 0 )
+        return 0;
+
+    MipTexture*& texture = textures[material->texture_filename];
+    if ( !texture ) {
+        texture = new MipTexture( *material );
+    }
+    return texture;
+}
+
+void TextureStore::clear()
+{
+    for ( TextureMap::iterator i = textures.begin(); i != textures.end(); ++i ) {
+        delete i->second;
+    }
+    textures.clear();
+}
+
+} /* _462 */
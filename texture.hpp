@@ -0,0 +1,116 @@
+#ifndef _462_RAYTRACER_TEXTURE_HPP_
+#define _462_RAYTRACER_TEXTURE_HPP_
+
+#include "math/color.hpp"
+#include "math/vector.hpp"
+#include "scene/scene.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace _462 {
+
+class Material;
+
+/**
+ * The footprint of a ray as a cone: how wide it is where the ray starts,
+ * and how much wider it gets per unit of distance. Stands in for the ray's
+ * differentials when picking a mip level. Primary rays start at a point
+ * and spread by the angle of one pixel; a bounce carries on with the width
+ * the cone had where it hit, ignoring the curvature of the surface.
+ */
+struct RayCone
+{
+    real_t width;
+    real_t spread;
+
+    RayCone() : width( 0 ), spread( 0 ) { }
+
+    RayCone( real_t width, real_t spread ) : width( width ), spread( spread ) { }
+
+    // the width at parameter t along ray
+    real_t width_at( const RayInfo& ray, real_t t ) const
+    {
+        return width + spread * t * length( ray.direction );
+    }
+};
+
+/**
+ * A texture prepared for raytracing: every mip level down to 1x1, stored
+ * as 8x8 tiles with the texels of each tile in Morton order, so a filtered
+ * lookup usually stays within one or two cache lines whatever direction
+ * the surface runs in. Coordinates repeat outside [0, 1], as the OpenGL
+ * path sets them up to.
+ */
+class MipTexture
+{
+public:
+
+    // builds every level from the material's texture, which must be loaded
+    explicit MipTexture( const Material& material );
+
+    int get_width() const { return levels[0].width; }
+    int get_height() const { return levels[0].height; }
+
+    size_t num_levels() const { return levels.size(); }
+
+    // the level at which a footprint texels wide at full resolution covers
+    // about one texel
+    static real_t level_for( real_t texels );
+
+    // the color at ( u, v ), filtered bilinearly within the two levels
+    // around level and blended between them
+    Color3 sample( real_t u, real_t v, real_t level ) const;
+
+private:
+
+    struct Level
+    {
+        int width, height;
+        int tiles_across;
+        // first texel of the level within texels
+        size_t offset;
+    };
+
+    // where texel ( x, y ) of a level is stored
+    size_t texel_index( const Level& level, int x, int y ) const;
+
+    Color3 bilinear( const Level& level, real_t u, real_t v ) const;
+
+    void add_level( const std::vector< Color3 >& image, int width, int height );
+
+    std::vector< Level > levels;
+    // rgba bytes of every level, one after another
+    std::vector< unsigned char > texels;
+};
+
+/**
+ * The mip textures of every material the raytracer has seen, keyed by
+ * texture filename, so materials using the same image share one copy.
+ */
+class TextureStore
+{
+public:
+
+    TextureStore() { }
+
+    ~TextureStore();
+
+    // the material's texture, built on first use, or null if it has none
+    const MipTexture* prepare( const Material* material );
+
+    void clear();
+
+private:
+
+    // no meaningful copy
+    TextureStore( const TextureStore& );
+    TextureStore& operator=( const TextureStore& );
+
+    typedef std::map< std::string, MipTexture* > TextureMap;
+    TextureMap textures;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_TEXTURE_HPP_ */
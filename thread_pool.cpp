@@ -0,0 +1,99 @@
+#include "thread_pool.hpp"
+
+#include <SDL/SDL_mutex.h>
+#include <SDL/SDL_thread.h>
+
+namespace _462 {
+
+ThreadPool::ThreadPool( size_t num_threads )
+    : running( 0 ), stopping( false )
+{
+    lock = SDL_CreateMutex();
+    queued = SDL_CreateCond();
+    idle = SDL_CreateCond();
+
+    for ( size_t i = 0; i < num_threads; ++i ) {
+        SDL_Thread* thread = SDL_CreateThread( thread_main, this );
+        if ( !thread )
+            break;
+        threads.push_back( thread );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+
+    SDL_LockMutex( lock );
+    stopping = true;
+    SDL_CondBroadcast( queued );
+    SDL_UnlockMutex( lock );
+
+    for ( size_t i = 0; i < threads.size(); ++i ) {
+        SDL_WaitThread( threads[i], 0 );
+    }
+
+    SDL_DestroyCond( idle );
+    SDL_DestroyCond( queued );
+    SDL_DestroyMutex( lock );
+}
+
+void ThreadPool::submit( Job* job )
+{
+    if ( threads.empty() ) {
+        // nothing to hand it to
+        job->run( *this );
+        return;
+    }
+
+    SDL_LockMutex( lock );
+    jobs.push_back( job );
+    SDL_CondSignal( queued );
+    SDL_UnlockMutex( lock );
+}
+
+void ThreadPool::wait()
+{
+    SDL_LockMutex( lock );
+    while ( !jobs.empty() || running > 0 ) {
+        SDL_CondWait( idle, lock );
+    }
+    SDL_UnlockMutex( lock );
+}
+
+int ThreadPool::thread_main( void* data )
+{
+    ( (ThreadPool*) data )->run();
+    return 0;
+}
+
+// runs queued jobs until told to stop
+void ThreadPool::run()
+{
+    SDL_LockMutex( lock );
+
+    while ( true ) {
+        while ( jobs.empty() && !stopping ) {
+            SDL_CondWait( queued, lock );
+        }
+        if ( jobs.empty() )
+            break;
+
+        Job* job = jobs.front();
+        jobs.pop_front();
+        ++running;
+        SDL_UnlockMutex( lock );
+
+        job->run( *this );
+
+        SDL_LockMutex( lock );
+        --running;
+        if ( jobs.empty() && running == 0 ) {
+            SDL_CondBroadcast( idle );
+        }
+    }
+
+    SDL_UnlockMutex( lock );
+}
+
+} /* _462 */
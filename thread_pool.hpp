@@ -0,0 +1,68 @@
+#ifndef _462_RAYTRACER_THREAD_POOL_HPP_
+#define _462_RAYTRACER_THREAD_POOL_HPP_
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+namespace _462 {
+
+/**
+ * A fixed set of threads running jobs in the order they are submitted.
+ * Jobs may submit further jobs, which is how a finished load hands its
+ * result on without waiting for the rest. The pool does not own its jobs.
+ */
+class ThreadPool
+{
+public:
+
+    class Job
+    {
+    public:
+        virtual ~Job() { }
+        virtual void run( ThreadPool& pool ) = 0;
+    };
+
+    // starts num_threads threads. if none can be started, jobs run on the
+    // thread that submits them.
+    explicit ThreadPool( size_t num_threads );
+
+    // waits for every job, then stops the threads
+    ~ThreadPool();
+
+    void submit( Job* job );
+
+    // blocks until no job is queued or running
+    void wait();
+
+    size_t num_threads() const { return threads.size(); }
+
+private:
+
+    static int thread_main( void* data );
+
+    void run();
+
+    // no meaningful copy
+    ThreadPool( const ThreadPool& );
+    ThreadPool& operator=( const ThreadPool& );
+
+    SDL_mutex* lock;
+    // signalled whenever a job is queued or the threads should stop
+    SDL_cond* queued;
+    // signalled whenever the pool may have gone idle
+    SDL_cond* idle;
+    std::vector< SDL_Thread* > threads;
+
+    std::deque< Job* > jobs;
+    size_t running;
+    bool stopping;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_THREAD_POOL_HPP_ */
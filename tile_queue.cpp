@@ -0,0 +1,101 @@
+#include "tile_queue.hpp"
+
+#include <SDL/SDL_mutex.h>
+#include <algorithm>
+#include <cassert>
+
+namespace _462 {
+
+TileQueue::TileQueue() : num_tiles( 0 ) { }
+
+TileQueue::~TileQueue()
+{
+    clear();
+}
+
+void TileQueue::clear()
+{
+    for ( size_t i = 0; i < deques.size(); ++i ) {
+        SDL_DestroyMutex( deques[i].lock );
+    }
+    deques.clear();
+    num_tiles = 0;
+}
+
+void TileQueue::reset( size_t width, size_t height, size_t tile_size, size_t num_workers )
+{
+    Tile area = { 0, 0, width, height };
+    reset( area, tile_size, num_workers );
+}
+
+void TileQueue::reset( const Tile& area, size_t tile_size, size_t num_workers )
+{
+    assert( tile_size > 0 && num_workers > 0 );
+
+    clear();
+    deques.resize( num_workers );
+    for ( size_t i = 0; i < num_workers; ++i ) {
+        deques[i].lock = SDL_CreateMutex();
+    }
+
+    // deal round-robin so every worker starts near the bottom of the image
+    // and the picture still fills in roughly row by row
+    size_t next = 0;
+    for ( size_t y = area.y0; y < area.y1; y += tile_size ) {
+        for ( size_t x = area.x0; x < area.x1; x += tile_size ) {
+            Tile tile;
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = std::min( x + tile_size, area.x1 );
+            tile.y1 = std::min( y + tile_size, area.y1 );
+            deques[next].tiles.push_back( tile );
+            next = ( next + 1 ) % num_workers;
+            ++num_tiles;
+        }
+    }
+}
+
+bool TileQueue::pop( size_t worker, Tile* tile )
+{
+    assert( worker < deques.size() );
+
+    // own work first, oldest tile first
+    WorkerDeque& own = deques[worker];
+    SDL_LockMutex( own.lock );
+    if ( !own.tiles.empty() ) {
+        *tile = own.tiles.front();
+        own.tiles.pop_front();
+        SDL_UnlockMutex( own.lock );
+        return true;
+    }
+    SDL_UnlockMutex( own.lock );
+
+    // steal from the far end of someone else's deque
+    for ( size_t i = 1; i < deques.size(); ++i ) {
+        WorkerDeque& victim = deques[( worker + i ) % deques.size()];
+        SDL_LockMutex( victim.lock );
+        if ( !victim.tiles.empty() ) {
+            *tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            SDL_UnlockMutex( victim.lock );
+            return true;
+        }
+        SDL_UnlockMutex( victim.lock );
+    }
+
+    return false;
+}
+
+size_t TileQueue::remaining() const
+{
+    size_t count = 0;
+    for ( size_t i = 0; i < deques.size(); ++i ) {
+        SDL_LockMutex( deques[i].lock );
+        count += deques[i].tiles.size();
+        SDL_UnlockMutex( deques[i].lock );
+    }
+    return count;
+}
+
+} /* _462 */
+
@@ -0,0 +1,69 @@
+#ifndef _462_RAYTRACER_TILE_QUEUE_HPP_
+#define _462_RAYTRACER_TILE_QUEUE_HPP_
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+struct SDL_mutex;
+
+namespace _462 {
+
+// a rectangular block of pixels, [x0, x1) by [y0, y1)
+struct Tile
+{
+    size_t x0, y0, x1, y1;
+};
+
+/**
+ * Hands out the tiles of an image to a fixed set of workers. Each worker
+ * owns a deque of tiles and takes from the front of it; once it runs dry,
+ * it steals from the back of another worker's deque.
+ */
+class TileQueue
+{
+public:
+
+    TileQueue();
+
+    ~TileQueue();
+
+    // splits a width x height image into tiles and deals them out to
+    // num_workers deques, in scanline order
+    void reset( size_t width, size_t height, size_t tile_size, size_t num_workers );
+
+    // the same for just the given area of an image
+    void reset( const Tile& area, size_t tile_size, size_t num_workers );
+
+    // takes the next tile for the given worker, stealing if necessary.
+    // returns false if there is no work left anywhere.
+    bool pop( size_t worker, Tile* tile );
+
+    // the number of tiles not yet handed out
+    size_t remaining() const;
+
+    // the total number of tiles since the last reset
+    size_t total() const { return num_tiles; }
+
+private:
+
+    struct WorkerDeque
+    {
+        SDL_mutex* lock;
+        std::deque< Tile > tiles;
+    };
+
+    void clear();
+
+    // no meaningful copy
+    TileQueue( const TileQueue& );
+    TileQueue& operator=( const TileQueue& );
+
+    std::vector< WorkerDeque > deques;
+    size_t num_tiles;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_TILE_QUEUE_HPP_ */
+
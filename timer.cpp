@@ -0,0 +1,42 @@
+#include "timer.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+namespace _462 {
+
+#ifdef _WIN32
+
+double timer_seconds()
+{
+    LARGE_INTEGER frequency, count;
+    QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &count );
+    return (double) count.QuadPart / (double) frequency.QuadPart;
+}
+
+#elif defined( CLOCK_MONOTONIC )
+
+double timer_seconds()
+{
+    timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+#else
+
+double timer_seconds()
+{
+    timeval now;
+    gettimeofday( &now, 0 );
+    return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+#endif
+
+} /* _462 */
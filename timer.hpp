@@ -0,0 +1,27 @@
+#ifndef _462_RAYTRACER_TIMER_HPP_
+#define _462_RAYTRACER_TIMER_HPP_
+
+namespace _462 {
+
+// seconds since an arbitrary fixed point, at the finest resolution the
+// platform offers. only differences between two calls are meaningful.
+double timer_seconds();
+
+// accumulates the time between start and stop into a running total
+class StageTimer
+{
+public:
+
+    explicit StageTimer( double* total ) : total( total ), begin( timer_seconds() ) { }
+
+    ~StageTimer() { *total += timer_seconds() - begin; }
+
+private:
+
+    double* total;
+    double begin;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_TIMER_HPP_ */
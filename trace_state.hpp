@@ -0,0 +1,223 @@
+#ifndef _462_RAYTRACER_TRACE_STATE_HPP_
+#define _462_RAYTRACER_TRACE_STATE_HPP_
+
+#include "arena.hpp"
+#include "light_tree.hpp"
+#include "math/color.hpp"
+#include "sample_random.hpp"
+#include "scene/scene.hpp"
+#include <vector>
+
+namespace _462 {
+
+struct PixelRecord;
+
+// a ray waiting to be traced, and how much its color counts towards the
+// pixel it belongs to
+struct PendingRay
+{
+    RayInfo ray;
+    Color3 weight;
+    // bounces taken to reach this ray, 0 for a primary ray
+    int depth;
+    // width of the ray's cone where it starts
+    real_t cone_width;
+    // pixel of the region the ray belongs to, when tracing wavefronts
+    unsigned int pixel;
+    // random numbers for shading the ray's hit
+    SampleRandom random;
+};
+
+// a hit found by the intersection stage of a wavefront
+struct WaveHit
+{
+    IntersectionInfo intersection;
+    // the ray within its wave, and the geometry it hit
+    unsigned int ray;
+    int geometry;
+};
+
+// rays traced, by kind
+struct RayCounts
+{
+    size_t primary, secondary, shadow;
+
+    RayCounts() { clear(); }
+
+    void clear() { primary = secondary = shadow = 0; }
+
+    void add( const RayCounts& other )
+    {
+        primary += other.primary;
+        secondary += other.secondary;
+        shadow += other.shadow;
+    }
+
+    size_t total() const { return primary + secondary + shadow; }
+};
+
+// finer counts, gathered only while profiling
+struct TraceProfile
+{
+    // tests of a ray against each geometry
+    std::vector< size_t > geometry_tests;
+    // rays traced at each bounce depth, primary rays first
+    std::vector< size_t > depth_rays;
+    // shadow rays never cast because the light was behind the surface
+    size_t shadow_culled;
+
+    TraceProfile() : shadow_culled( 0 ) { }
+
+    void reset( size_t num_geometries )
+    {
+        geometry_tests.assign( num_geometries, 0 );
+        depth_rays.clear();
+        shadow_culled = 0;
+    }
+
+    void count_depth( int depth )
+    {
+        if ( depth_rays.size() <= (size_t) depth ) {
+            depth_rays.resize( depth + 1, 0 );
+        }
+        ++depth_rays[depth];
+    }
+
+    void add( const TraceProfile& other )
+    {
+        if ( geometry_tests.size() < other.geometry_tests.size() ) {
+            geometry_tests.resize( other.geometry_tests.size(), 0 );
+        }
+        for ( size_t i = 0; i < other.geometry_tests.size(); ++i ) {
+            geometry_tests[i] += other.geometry_tests[i];
+        }
+        if ( depth_rays.size() < other.depth_rays.size() ) {
+            depth_rays.resize( other.depth_rays.size(), 0 );
+        }
+        for ( size_t i = 0; i < other.depth_rays.size(); ++i ) {
+            depth_rays[i] += other.depth_rays[i];
+        }
+        shadow_culled += other.shadow_culled;
+    }
+};
+
+// where a wavefront trace spends its time, in seconds, and how much it did
+struct WavefrontStats
+{
+    double generate, intersect, sort, shadow, shade;
+    size_t rays, shadow_rays, waves;
+
+    WavefrontStats() { clear(); }
+
+    void clear()
+    {
+        generate = intersect = sort = shadow = shade = 0;
+        rays = shadow_rays = waves = 0;
+    }
+
+    void add( const WavefrontStats& other )
+    {
+        generate += other.generate;
+        intersect += other.intersect;
+        sort += other.sort;
+        shadow += other.shadow;
+        shade += other.shade;
+        rays += other.rays;
+        shadow_rays += other.shadow_rays;
+        waves += other.waves;
+    }
+};
+
+/**
+ * Scratch state owned by one tracing thread. Nothing in here is shared, so
+ * it can be updated freely from inside the ray loops.
+ */
+struct TraceState
+{
+    // for each light, the geometry that last blocked a shadow ray towards
+    // it, or -1. neighbouring pixels are usually blocked by the same thing,
+    // so it is tested before anything else.
+    std::vector< int > last_occluder;
+
+    // bounce limit and pruning threshold, copied from the raytracer
+    int max_depth;
+    real_t min_weight;
+
+    // how fast ray cones widen, from the camera, and the width of the cone
+    // at the hit being shaded, which the rays it spawns start with
+    real_t pixel_spread;
+    real_t hit_cone_width;
+
+    // the frame and the width of the image being traced, which key the
+    // random numbers of every pixel, and the stream of the ray whose hit
+    // is being shaded
+    unsigned int frame;
+    size_t image_width;
+    SampleRandom random;
+
+    // the random stream of one sample of pixel x, y
+    SampleRandom pixel_random( size_t x, size_t y, size_t sample ) const
+    {
+        return SampleRandom( frame, y * image_width + x, sample );
+    }
+
+    // secondary rays still to be traced for the current pixel. used as a
+    // stack, so a ray's children are traced before its siblings.
+    std::vector< PendingRay > pending;
+
+    // primary rays of the row being traced
+    std::vector< RayInfo > primary_rays;
+
+    // shadow test results of a packet, one row of lights per lane
+    std::vector< unsigned char > light_visible;
+
+    // with light culling, the most shadow rays a hit may fire (0 for no
+    // limit), and the lights considered and chosen for the current hit
+    size_t light_budget;
+    std::vector< LightChoice > light_candidates, light_choices;
+
+    // the rays of the current and the next wave, and the color gathered by
+    // each pixel
+    std::vector< PendingRay > wave, next_wave;
+    std::vector< Color3 > wave_color;
+
+    // records that live for one wave: its hits, the order they are shaded
+    // in and their shadow test results. emptied at the start of every wave.
+    Arena scratch;
+
+    WavefrontStats wavefront_stats;
+
+    // rays this thread traced since the last reset
+    RayCounts counts;
+
+    // whether profile is being gathered; checked before every update so
+    // the cost when off is a predictable branch
+    bool profiling;
+    TraceProfile profile;
+
+    // what the pixel being traced runs into is noted here, if set
+    PixelRecord* record;
+
+    // where geometry tests are counted, or null when not profiling
+    size_t* geometry_tests()
+    {
+        return profiling && !profile.geometry_tests.empty() ? &profile.geometry_tests[0] : 0;
+    }
+
+    TraceState()
+        : max_depth( 0 ), min_weight( 0 ), pixel_spread( 0 ), hit_cone_width( 0 ),
+          frame( 0 ), image_width( 0 ), light_budget( 0 ), profiling( false ), record( 0 ) { }
+
+    // forgets everything cached for the previous scene
+    void reset( size_t num_lights )
+    {
+        last_occluder.assign( num_lights, -1 );
+        pending.clear();
+        wavefront_stats.clear();
+        counts.clear();
+    }
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_TRACE_STATE_HPP_ */